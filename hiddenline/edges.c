@@ -4,6 +4,15 @@
  *
  * builds and proceses list of edges to be drawn
  *
+ * The work is spread over a thread per core, the same way as paint's
+ * tile binning (bin.c): the threads build the edge lists an object at
+ * a time, then classify them EDGE_CHUNK edges at a time. The edges to
+ * draw are then binned, in order, to the EDGE_TILE x EDGE_TILE screen
+ * tiles their lines touch, and each thread draws whole tiles, writing
+ * only inside the tile. Every pixel sees its lines in the same order
+ * as drawing them one at a time, so the image doesn't depend on the
+ * number of threads. The z-buffer is only read.
+ *
  */
 
 /*
@@ -34,7 +43,9 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <unistd.h>
 #include <math.h>
+#include <pthread.h>
 
 #include "rp.h"
 #include "hidden.h"
@@ -51,28 +62,91 @@
 /* tabel of edges for all the objects */
 static ObjEdges_t	*objEdges[MAX_OBJS];
 
+typedef struct {	/* an edge to draw */
+    int		obj, edge;
+    int		force;		/* draw regardless of the z-buffer */
+} EdgeRef_t;
+
+typedef struct {	/* one screen tile */
+    int		*refs;		/* indexes into subs[], in drawing order */
+    int		count, max;
+} EdgeTile_t;
+
+typedef struct {	/* per thread state */
+    pthread_t	thread;
+    int		id;
+    int		total_edges, drawn_edges;
+} EdgeWorker_t;
+
+int		edge_threads = 0;
+
+static EdgeWorker_t	workers[EDGE_MAX_THREADS];
+static int		next_job = 0, job_count = 0;
+static pthread_mutex_t	job_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int		*jobs = (int *) NULL;	/* objects, or edge chunks: */
+static int		*chunk_first = (int *) NULL;
+
+static EdgeRef_t	*subs = (EdgeRef_t *) NULL;
+static int		sub_count = 0, sub_max = 0;
+static EdgeTile_t	*tiles = (EdgeTile_t *) NULL;
+static int		tiles_x = 0, tiles_y = 0;
+
+
+/*
+ * the edges of the object being built are found through a hash table
+ * on the vertex pair (smaller index first, so the order of the verts
+ * doesn't matter), open addressed and sized to at least twice the
+ * most edges it could have. Each slot holds an edge index + 1 (0 is
+ * empty). Each object has its own, so objects can be built at once.
+ */
+
+static u32
+hash_edge(int p0, int p1)
+{
+    u32		a = (u32) Min(p0, p1), b = (u32) Max(p0, p1);
+
+    return ((a * 0x9e3779b1u) ^ (b * 0x85ebca6bu));
+}
 
 /* find an edge in the list, order of verts doesn't matter */
 static int
 find_edge(int id, int p0, int p1)
 {
+    ObjEdges_t	*oe = objEdges[id];
     Edge_t	*ep;
-    int		i, ecnt;
+    u32		h;
+    int		e;
 
-    ep = (Edge_t *) objEdges[id]->edges;
-    ecnt = objEdges[id]->num_edges;
+    ep = (Edge_t *) oe->edges;
 
-    for (i=0; i<ecnt; i++) {
-	if ((ep[i].v0 == p0 && ep[i].v1 == p1) ||
-	    (ep[i].v0 == p1 && ep[i].v1 == p0)) {
+    for (h=hash_edge(p0, p1) & oe->hash_mask; (e = oe->hash[h]) != 0;
+	 h=(h+1) & oe->hash_mask) {
+	e--;
+	if ((ep[e].v0 == p0 && ep[e].v1 == p1) ||
+	    (ep[e].v0 == p1 && ep[e].v1 == p0)) {
 
-	    return(i);		 /* found! */
-	} 
+	    return(e);		 /* found! */
+	}
     }
 
     return (-1);
 }
 
+/* remember edge e of the list (just added, so not in the table yet) */
+static void
+hash_add_edge(int id, int e)
+{
+    ObjEdges_t	*oe = objEdges[id];
+    Edge_t	*ep = &(oe->edges[e]);
+    u32		h;
+
+    for (h=hash_edge(ep->v0, ep->v1) & oe->hash_mask; oe->hash[h] != 0;
+	 h=(h+1) & oe->hash_mask)
+	;
+    oe->hash[h] = e + 1;
+}
+
 /* add edge to the list... either as a shared edge or a new edge */
 static void
 add_edge(Object_t *op, int id, int thistri, int p0, int p1)
@@ -88,14 +162,13 @@ add_edge(Object_t *op, int id, int thistri, int p0, int p1)
 
     if (thisedge < 0) {		/* add new edge to the list */
 
-	ep[objEdges[id]->num_edges].id = total_edges;
+	ep[objEdges[id]->num_edges].id = objEdges[id]->num_edges;	/* (see build_scene_edges()) */
 	ep[objEdges[id]->num_edges].tri0 = thistri;
 	ep[objEdges[id]->num_edges].v0 = p0;
 	ep[objEdges[id]->num_edges].v1 = p1;
+	hash_add_edge(id, objEdges[id]->num_edges);
 	objEdges[id]->num_edges++;
 
-	total_edges++;
-
 #ifdef DEBUG_EDGES
 	fprintf(stderr,"\tadding new edge {%d}: p0 = %d, p1 = %d from tri %d\n",
 			ep[objEdges[id]->num_edges-1].id,
@@ -128,11 +201,12 @@ add_edge(Object_t *op, int id, int thistri, int p0, int p1)
 }
 
 /* create edge list for this object */
-void
+static void
 create_obj_edges(Object_t *op)
 {
     Tri_t	*tp;
     Edge_t	*ep;
+    u32		size;
     int		i;
 
     objEdges[op->id] = (ObjEdges_t *) calloc(1, sizeof(ObjEdges_t));
@@ -151,6 +225,12 @@ create_obj_edges(Object_t *op)
     objEdges[op->id]->edges = ep;
     objEdges[op->id]->num_edges = 0;
 
+	/* the edge table, a power of 2 at least twice the possible edges */
+    for (size=16; size < 6*(u32)op->tri_count; size<<=1)
+	;
+    objEdges[op->id]->hash = (int *) calloc(size, sizeof(int));
+    objEdges[op->id]->hash_mask = size - 1;
+
 	/* populate edge table */
     for (i=0; i<op->tri_count; i++) {
 
@@ -172,19 +252,24 @@ create_obj_edges(Object_t *op)
 	    add_edge(op, op->id, i, tp->v2, tp->v0); 
         }
     }
+
+    free(objEdges[op->id]->hash);
+    objEdges[op->id]->hash = (int *) NULL;
 }
 
-/* we've added all the edges, now go through and find creases, silhouettes, etc */
-void
-process_obj_edges(Object_t *op)
+/*
+ * we've added all the edges, now go through edges first to last-1 and
+ * find creases, silhouettes, etc. Returns how many are to be drawn.
+ */
+static int
+process_obj_edges(Object_t *op, int first, int last)
 {
     Vtx_t	*vp;
     Tri_t	*tp, *t0, *t1;
     Edge_t	*ep;
     float	costheta;
-    int		i, ecnt;
+    int		i, drawn = 0;
 
-    ecnt = objEdges[op->id]->num_edges;
     ep = (Edge_t *) objEdges[op->id]->edges;
 
     vp = (Vtx_t *) op->verts;
@@ -199,7 +284,7 @@ process_obj_edges(Object_t *op)
          *         - if one tri is culled and one not - edge is a silhouette (draw)
 	 */
 
-    for (i=0; i<ecnt; i++) {
+    for (i=first; i<last; i++) {
 
 	if (ep[i].tri0 >= 0) t0 = (Tri_t *) &(tp[ep[i].tri0]); else t0 = (Tri_t *) NULL;
 	if (ep[i].tri1 >= 0) t1 = (Tri_t *) &(tp[ep[i].tri1]); else t1 = (Tri_t *) NULL;
@@ -308,7 +393,14 @@ process_obj_edges(Object_t *op)
 		}
             }
         }	/* else, both t0 and t1 non-NULL */
+
+	if (Flagged(ep[i].flags, FLAG_EDGE_SILHOUETTE) ||
+	    Flagged(ep[i].flags, FLAG_EDGE_CREASE)     ||
+	    Flagged(ep[i].flags, FLAG_EDGE_MATERIAL))
+	    drawn++;
     }	/* for all edges */
+
+    return (drawn);
 }
 
 /*
@@ -338,11 +430,42 @@ static int filter5[5][5] =
 };
 #endif
 
-/* simple DDA line function, handles z-buffer and slightly fat line */
-static void draw_line(int force, int x0, int y0, int z0, int x1, int y1, int z1, rgba_t color)
+/* how far a line's pixels reach from the line */
+#if (defined FILTER5)
+#define LINE_RADIUS	2
+#elif (defined FILTER3)
+#define LINE_RADIUS	1
+#else
+#define LINE_RADIUS	0
+#endif
+
+/* write the pixels x0 to x1 of row y that are inside the clip box */
+static void
+put_row(int x0, int x1, int y, rgba_t *pixels, Scissor_t *clip)
+{
+    int		first, last;
+
+    if (y < clip->uly || y > clip->lry)
+	return;
+    first = Max(x0, clip->ulx);
+    last = Min(x1, clip->lrx);
+    if (first <= last)
+	RPPutColorSpan(first, last, y, pixels + (first - x0), (u8 *) NULL);
+}
+
+/* simple DDA line function, handles z-buffer and slightly fat line
+ * (the filter's rows are tested and written as spans). Only the pixels
+ * inside the clip box (a screen tile) are written; the line is stepped
+ * from its start all the same, so they are the same pixels.
+ */
+static void draw_line(int force, int x0, int y0, int z0, int x1, int y1, int z1, rgba_t color,
+		      Scissor_t *clip)
 {
     float	x, y, z, dx, dy, dz, step;
     int		i=1, tx, ty, tz;
+    rgba_t	pixels[5];
+    float	zs[5];
+    u8		mask[5];
 #if (defined FILTER3 || defined FILTER5)
     int		j, k;
     float	zsum, weight;
@@ -366,10 +489,14 @@ static void draw_line(int force, int x0, int y0, int z0, int x1, int y1, int z1,
 
     x = x0; y = y0; z = z0;
   
-    while (i <= step) {
+    for (; i <= step; x += dx, y += dy, z += dz, i++) {
 
 	tx = (int) (x+0.5); ty = (int) (y+0.5);
 
+	if (tx + LINE_RADIUS < clip->ulx || tx - LINE_RADIUS > clip->lrx ||
+	    ty + LINE_RADIUS < clip->uly || ty - LINE_RADIUS > clip->lry)
+	    continue;		/* (another tile's) */
+
 #if (defined FILTER3 || defined FILTER5)
 	/* rather than use a DEPTH_BIAS as similar algorithms do, we use
 	 * our filter kernal to sample z around the point to get a better
@@ -378,9 +505,14 @@ static void draw_line(int force, int x0, int y0, int z0, int x1, int y1, int z1,
 	zsum = 0.0;
 
 	for (j=-2; j<3; j++) {
+	    for (k=-2; k<3; k++) {
+		zs[k+2] = z;
+		mask[k+2] = TRUE;
+	    }
+	    RPTestDepthSpan(tx-2, tx+2, ty+j, zs, mask);
 	    for (k=-2; k<3; k++) {
 		weight = 32.0/(float)filter5[k+2][j+2];
-		zsum += (weight * RPTestDepthFB(tx+k, ty+j, z));
+		zsum += (weight * mask[k+2]);
 	    }
 	}
 
@@ -390,7 +522,9 @@ static void draw_line(int force, int x0, int y0, int z0, int x1, int y1, int z1,
 
 	if (zsum > 0.5) {
 #else
-	if (force || RPTestDepthFB(tx, ty, z - (z * DEPTH_BIAS))) {
+	zs[0] = z - (z * DEPTH_BIAS);
+	mask[0] = TRUE;
+	if (force || RPTestDepthSpan(tx, tx, ty, zs, mask)) {
 #endif
 
 		/* we manipulate alhpa for a nice filter effect */
@@ -398,79 +532,252 @@ static void draw_line(int force, int x0, int y0, int z0, int x1, int y1, int z1,
 		/* filter 3 gaussian */
 	    for (j=-1; j<2; j++) {
 	        for (k=-1; k<2; k++) {
-	            RPPutColorFBPixel(tx+k, ty+j, 
-			color.r, color.g, color.b, color.a/filter3[k+1][j+1]);
+		    pixels[k+1] = color;
+		    pixels[k+1].a = color.a/filter3[k+1][j+1];
 	        }
+		put_row(tx-1, tx+1, ty+j, pixels, clip);
 	    }
 #elif (defined FILTER5)
 		/* filter 5 gaussian */
 	    for (j=-2; j<3; j++) {
 	        for (k=-2; k<3; k++) {
-	            RPPutColorFBPixel(tx+k, ty+j, 
-			color.r, color.g, color.b, color.a/filter5[k+2][j+2]);
+		    pixels[k+2] = color;
+		    pixels[k+2].a = color.a/filter5[k+2][j+2];
 	        }
+		put_row(tx-2, tx+2, ty+j, pixels, clip);
 	    }
 #else
-	    RPPutColorFBPixel(tx,   ty,   color.r, color.g, color.b, color.a);
+	    put_row(tx, tx, ty, &color, clip);
 #endif
         }
-
-	x += dx; y += dy; z += dz;
-	i++;
     }
 }
 
-/* draw all the visible edges for this object */
-void
-draw_edges(Object_t *op)
+/* draw the edges binned to this tile */
+static void
+draw_tile(int tile)
 {
     rgba_t	black = { 0, 0, 0, 255};
+    EdgeTile_t	*t = &(tiles[tile]);
+    EdgeRef_t	*r;
+    Object_t	*op;
     Vtx_t	*vp;
     Edge_t	*ep;
-    int		x0, y0, z0, x1, y1, z1, i, ecnt, force = FALSE;
-
-    ecnt = objEdges[op->id]->num_edges;
-    ep = (Edge_t *) objEdges[op->id]->edges;
+    Scissor_t	clip;
+    int		i;
 
-    vp = (Vtx_t *) op->verts;
+    clip.ulx = (tile % tiles_x) * EDGE_TILE;
+    clip.uly = (tile / tiles_x) * EDGE_TILE;
+    clip.lrx = clip.ulx + EDGE_TILE - 1;
+    clip.lry = clip.uly + EDGE_TILE - 1;
 
-    for (i=0; i<ecnt; i++) {
+    for (i=0; i<t->count; i++) {
+	r = &(subs[t->refs[i]]);
+	op = RPScene.obj_list[r->obj];
+	vp = (Vtx_t *) op->verts;
+	ep = &(objEdges[op->id]->edges[r->edge]);
 
-	if (Flagged(ep[i].flags, FLAG_EDGE_SILHOUETTE) ||
-	    Flagged(ep[i].flags, FLAG_EDGE_CREASE)     ||
-	    Flagged(ep[i].flags, FLAG_EDGE_MATERIAL)) {
+	draw_line(r->force, vp[ep->v0].sx, vp[ep->v0].sy, vp[ep->v0].sz,
+		  vp[ep->v1].sx, vp[ep->v1].sy, vp[ep->v1].sz, black, &clip);
+    }
+}
 
-	    x0 = vp[ep[i].v0].sx;
-	    y0 = vp[ep[i].v0].sy;
-	    z0 = vp[ep[i].v0].sz;
+/* add edge e of object obj to the bins of the tiles its line touches */
+static void
+bin_edge(int obj, int e, int force)
+{
+    Object_t	*op = RPScene.obj_list[obj];
+    Vtx_t	*vp = (Vtx_t *) op->verts;
+    Edge_t	*ep = &(objEdges[op->id]->edges[e]);
+    EdgeTile_t	*t;
+    int		tx0, ty0, tx1, ty1, x, y;
+
+    if (sub_count >= sub_max) {
+	sub_max = Max(2*sub_max, 1024);
+	subs = (EdgeRef_t *) realloc(subs, sub_max * sizeof(EdgeRef_t));
+    }
+    subs[sub_count].obj = obj;
+    subs[sub_count].edge = e;
+    subs[sub_count].force = force;
+
+	/* the line's bounding box, as far as its pixels reach */
+    tx0 = Max(Min(vp[ep->v0].sx, vp[ep->v1].sx) - LINE_RADIUS, 0) / EDGE_TILE;
+    ty0 = Max(Min(vp[ep->v0].sy, vp[ep->v1].sy) - LINE_RADIUS, 0) / EDGE_TILE;
+    tx1 = Min(Max(vp[ep->v0].sx, vp[ep->v1].sx) + LINE_RADIUS, RPScene.xres-1) / EDGE_TILE;
+    ty1 = Min(Max(vp[ep->v0].sy, vp[ep->v1].sy) + LINE_RADIUS, RPScene.yres-1) / EDGE_TILE;
+
+    for (y=ty0; y<=ty1; y++) {
+	for (x=tx0; x<=tx1; x++) {
+	    t = &(tiles[y*tiles_x + x]);
+	    if (t->count >= t->max) {
+		t->max = Max(2*t->max, 64);
+		t->refs = (int *) realloc(t->refs, t->max * sizeof(int));
+	    }
+	    t->refs[t->count++] = sub_count;
+	}
+    }
+    sub_count++;
+}
 
-	    x1 = vp[ep[i].v1].sx;
-	    y1 = vp[ep[i].v1].sy;
-	    z1 = vp[ep[i].v1].sz;
+	/* the jobs the threads take in turn: */
+#define JOB_BUILD	0	/* build an object's edges */
+#define JOB_CLASSIFY	1	/* classify a chunk of edges */
+#define JOB_DRAW	2	/* draw a tile */
 
-	    if (Flagged(ep[i].flags, FLAG_EDGE_MATERIAL))
-		force = TRUE;	/* force draw regardless of depth buffer */
+static int	job_type = JOB_BUILD;
 
-#ifdef DEBUG_EDGES
-	if (Flagged(ep[i].flags, FLAG_EDGE_SILHOUETTE)) {
-	    fprintf(stderr,"drawing silhouette edge {%d}:\t%d, %d\n",
-		ep[i].id,ep[i].v0, ep[i].v1);
-	    fprintf(stderr,"\t(%d,%d) -- (%d,%d)\n",
-		x0,y0,x1,y1);
+static void *
+edge_worker(void *arg)
+{
+    EdgeWorker_t	*w = (EdgeWorker_t *) arg;
+    Object_t		*op;
+    int			job, last;
+
+    while (TRUE) {
+	pthread_mutex_lock(&job_lock);
+	job = next_job++;
+	pthread_mutex_unlock(&job_lock);
+
+	if (job >= job_count)
+	    break;
+
+	switch (job_type) {
+	  case JOB_BUILD:
+	    op = RPScene.obj_list[jobs[job]];
+	    create_obj_edges(op);
+	    w->total_edges += objEdges[op->id]->num_edges;
+	    break;
+	  case JOB_CLASSIFY:
+	    op = RPScene.obj_list[jobs[job]];
+	    last = Min(chunk_first[job] + EDGE_CHUNK, objEdges[op->id]->num_edges);
+	    w->drawn_edges += process_obj_edges(op, chunk_first[job], last);
+	    break;
+	  case JOB_DRAW:
+	    draw_tile(job);
+	    break;
 	}
-	if (Flagged(ep[i].flags, FLAG_EDGE_CREASE)) {
-	    fprintf(stderr,"drawing crease edge {%d}:\t\t%d, %d\n",
-		ep[i].id,ep[i].v0, ep[i].v1);
-	    fprintf(stderr,"\t(%d,%d) -- (%d,%d)\n",
-		x0,y0,x1,y1);
+    }
+    return (NULL);
+}
+
+/* do count jobs of this type, a thread per core */
+static void
+run_jobs(int type, int count)
+{
+    int		i, nthreads;
+
+    edge_threads = Max(1, Min((int) sysconf(_SC_NPROCESSORS_ONLN), EDGE_MAX_THREADS));
+    nthreads = Min(edge_threads, count);
+
+    job_type = type;
+    job_count = count;
+    next_job = 0;
+    for (i=0; i<nthreads; i++) {
+	workers[i].id = i;
+	workers[i].total_edges = workers[i].drawn_edges = 0;
+	if (pthread_create(&(workers[i].thread), NULL, edge_worker, &(workers[i])) != 0) {
+	    fprintf(stderr,"%s : ERROR : %s : %d : can't create thread %d\n",
+		    program_name, __FILE__, __LINE__, i);
+	    exit(EXIT_FAILURE);
 	}
-#endif
+    }
+    for (i=0; i<nthreads; i++) {
+	pthread_join(workers[i].thread, NULL);
+	total_edges += workers[i].total_edges;
+	drawn_edges += workers[i].drawn_edges;
+    }
+}
 
-            draw_line(force, x0, y0, z0, x1, y1, z1, black);
+/* build the edge lists of all the polygon objects and classify the edges */
+void
+build_scene_edges(void)
+{
+    Object_t	*op;
+    Edge_t	*ep;
+    int		*objs, i, j, nobjs, nchunks, id = 0;
 
-	    drawn_edges++;
+    objs = (int *) malloc(RPScene.obj_count * sizeof(int));
+    for (i=nobjs=0; i<RPScene.obj_count; i++) {
+	if (RPScene.obj_list[i]->type == OBJ_TYPE_POLY)	/* (no spheres yet) */
+	    objs[nobjs++] = i;
+    }
+    jobs = objs;
+    run_jobs(JOB_BUILD, nobjs);
+
+	/* number the edges through the scene, in order, and cut them into chunks */
+    nchunks = 0;
+    for (i=0; i<nobjs; i++) {
+	op = RPScene.obj_list[objs[i]];
+	ep = objEdges[op->id]->edges;
+	for (j=0; j<objEdges[op->id]->num_edges; j++)
+	    ep[j].id = id++;
+	nchunks += (objEdges[op->id]->num_edges + EDGE_CHUNK - 1) / EDGE_CHUNK;
+    }
+    jobs = (int *) malloc(Max(nchunks, 1) * sizeof(int));
+    chunk_first = (int *) malloc(Max(nchunks, 1) * sizeof(int));
+    for (i=nchunks=0; i<nobjs; i++) {
+	op = RPScene.obj_list[objs[i]];
+	for (j=0; j<objEdges[op->id]->num_edges; j+=EDGE_CHUNK) {
+	    jobs[nchunks] = objs[i];
+	    chunk_first[nchunks++] = j;
 	}
     }
+    run_jobs(JOB_CLASSIFY, nchunks);
+
+    free(objs);
+    free(jobs);
+    free(chunk_first);
+    jobs = chunk_first = (int *) NULL;
 }
 
+/* draw all the visible edges of the scene, a tile per thread at a time */
+void
+draw_scene_edges(void)
+{
+    Object_t	*op;
+    Edge_t	*ep;
+    int		i, e, force;
+
+    tiles_x = (RPScene.xres + EDGE_TILE - 1) / EDGE_TILE;
+    tiles_y = (RPScene.yres + EDGE_TILE - 1) / EDGE_TILE;
+    tiles = (EdgeTile_t *) calloc(tiles_x * tiles_y, sizeof(EdgeTile_t));
+    sub_count = 0;
+
+	/* bin the edges to draw, in order */
+    for (i=0; i<RPScene.obj_count; i++) {
 
+	op = RPScene.obj_list[i];
+	if (op->type != OBJ_TYPE_POLY)
+	    continue;
+
+	ep = (Edge_t *) objEdges[op->id]->edges;
+	force = FALSE;
+	for (e=0; e<objEdges[op->id]->num_edges; e++) {
+
+	    if (Flagged(ep[e].flags, FLAG_EDGE_SILHOUETTE) ||
+		Flagged(ep[e].flags, FLAG_EDGE_CREASE)     ||
+		Flagged(ep[e].flags, FLAG_EDGE_MATERIAL)) {
+
+		if (Flagged(ep[e].flags, FLAG_EDGE_MATERIAL))
+		    force = TRUE;	/* force draw regardless of depth buffer */
+
+#ifdef DEBUG_EDGES
+		fprintf(stderr,"drawing %s edge {%d}:\t%d, %d\n",
+			Flagged(ep[e].flags, FLAG_EDGE_SILHOUETTE) ? "silhouette" : "crease",
+			ep[e].id, ep[e].v0, ep[e].v1);
+#endif
+		bin_edge(i, e, force);
+	    }
+	}
+    }
+
+    run_jobs(JOB_DRAW, tiles_x * tiles_y);
+
+    for (i=0; i<tiles_x * tiles_y; i++)
+	free(tiles[i].refs);
+    free(tiles);
+    free(subs);
+    tiles = (EdgeTile_t *) NULL;
+    subs = (EdgeRef_t *) NULL;
+    sub_max = 0;
+}
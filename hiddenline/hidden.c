@@ -45,6 +45,18 @@ int	drawn_edges = 0;
 
 /* from libpaint: */
 extern void     paint_tri(Object_t *op, Tri_t *tri, int usecfb);
+extern int	hiz_enabled, hiz_tris_rejected, hiz_objs_rejected;
+extern void	hiz_init(void);
+extern void	hiz_cleanup(void);
+extern int	hiz_object_hidden(Object_t *op);
+extern double	order_usec;
+extern int	order_clusters;
+extern void	order_scene(void);
+extern void	lights_init(void);
+extern void	lights_cleanup(void);
+extern void	gouraud_init(void);
+extern void	gouraud_cleanup(void);
+extern double	paint_usec(void);
 
 /*
  * draw the entire scene.
@@ -57,6 +69,7 @@ draw_scene(void)
     Object_t	*op;
     Tri_t	*tri;
     float       progress = 0.0;
+    double	start, zpass_usec, edges_usec, lines_usec;
     int         i, j, retval = CLIP_TRIVIAL_ACCEPT, paintshade = FALSE;
 
     fprintf(stderr,"Drawing Scene:\n");
@@ -72,6 +85,9 @@ draw_scene(void)
     RPProcessObjects(TRUE); 		/* tranform objects to camera space */
 					/* TRUE flag also does projection */
 
+    if (Flagged(RPScene.generic_flags, FLAG_RENDER_08))
+	order_scene();			/* front to back */
+
 	/* use the generic flags to decide if we want to paint the objects into
          * the color frame buffer (as well as the zbuffer) during pre-processing.
          * this permits an effective "toon shade" effect to be relalized.
@@ -79,11 +95,22 @@ draw_scene(void)
 
     if (Flagged(RPScene.generic_flags, FLAG_RENDER_03)) {
 	paintshade = TRUE;
+	lights_init();
+	gouraud_init();
+    }
+
+	/* RENDER07 rejects hidden objects and triangles in the z-buffer pass
+	 * with a hierarchical z (only if painting writes depth)
+	 */
+    if (Flagged(RPScene.generic_flags, FLAG_RENDER_07) &&
+	(!paintshade || Flagged(RPScene.flags, FLAG_ZBUFFER))) {
+	hiz_init();
     }
 
     fprintf(stderr,"Progress:  %5.2f %%",progress*33.0);
 
 	/* fill the z-buffer first */
+    start = paint_usec();
     for (i=0; i<RPScene.obj_count; i++) {
 
 	op = RPScene.obj_list[i];
@@ -92,6 +119,11 @@ draw_scene(void)
 
 		/* can't handle these yet */
 
+	} else if (op->type == OBJ_TYPE_POLY && hiz_enabled && hiz_object_hidden(op)) {
+
+	    hiz_objs_rejected++;
+	    hiz_tris_rejected += op->tri_count;
+
 	} else if (op->type == OBJ_TYPE_POLY) {
 
 	    for (j=0; j<op->tri_count; j++) {
@@ -101,8 +133,8 @@ draw_scene(void)
 	        if (!Flagged(RPScene.generic_flags, FLAG_RENDER_01)) 
         	    retval = RPClipTriangle(op, tri);
 
-		if (retval > CLIP_TRIVIAL_REJECT)
-		    paint_tri(op, tri, paintshade);
+		if (retval > CLIP_TRIVIAL_REJECT)	/* (clipping may move op->tris) */
+		    paint_tri(op, &(op->tris[j]), paintshade);
             }
 
     	} else {     /* can't happen */
@@ -113,43 +145,24 @@ draw_scene(void)
         progress = (float)i/(float)RPScene.obj_count;
         fprintf(stderr,"\b\b\b\b\b\b\b%5.2f %%",progress*33.0);
     }
+    zpass_usec = paint_usec() - start;
 
-	/* process edges */
-    for (i=0; i<RPScene.obj_count; i++) {
-
-	op = RPScene.obj_list[i];
-
-        if (op->type == OBJ_TYPE_SPHERE) {
-
-		/* can't handle these yet */
-
-	} else if (op->type == OBJ_TYPE_POLY) {
-
-	    create_obj_edges(op);
-	    process_obj_edges(op);
-        }
-
-        progress = (float)i/(float)RPScene.obj_count;
-        fprintf(stderr,"\b\b\b\b\b\b\b%5.2f %%",progress*33.0+33.0);
+    if (hiz_enabled)
+	hiz_cleanup();
+    if (paintshade) {
+	lights_cleanup();
+	gouraud_cleanup();
     }
 
-	/* paint edges */
-    for (i=0; i<RPScene.obj_count; i++) {
-
-	op = RPScene.obj_list[i];
-
-        if (op->type == OBJ_TYPE_SPHERE) {
-
-		/* can't handle these yet */
-
-	} else if (op->type == OBJ_TYPE_POLY) {
-
-	    draw_edges(op);
-	}
+	/* build and classify the edges, then draw them (threaded, see edges.c) */
+    start = paint_usec();
+    build_scene_edges();
+    edges_usec = paint_usec() - start;
+    fprintf(stderr,"\b\b\b\b\b\b\b%5.2f %%",66.0);
 
-        progress = (float)i/(float)RPScene.obj_count;
-        fprintf(stderr,"\b\b\b\b\b\b\b%5.2f %%",(progress*33.0)+66.0);
-    }
+    start = paint_usec();
+    draw_scene_edges();
+    lines_usec = paint_usec() - start;
 
     fprintf(stderr,"\b\b\b\b\b\b\b\b100 %% ... done!\n");
 
@@ -161,8 +174,28 @@ draw_scene(void)
             program_name, RPScene.trivial_rejected_polys);
     fprintf(stderr,"%s : [%'16d] clipped polygons\n",
             program_name, RPScene.clipped_polys);
+    if (Flagged(RPScene.generic_flags, FLAG_RENDER_08)) {
+	fprintf(stderr,"%s : [%'16d] triangle clusters sorted\n",
+		program_name, order_clusters);
+	fprintf(stderr,"%s : [%16.1f] front to back sort time (usec)\n",
+		program_name, order_usec);
+    }
+    if (Flagged(RPScene.generic_flags, FLAG_RENDER_07)) {
+	fprintf(stderr,"%s : [%'16d] hierarchical z rejected objects\n",
+		program_name, hiz_objs_rejected);
+	fprintf(stderr,"%s : [%'16d] hierarchical z rejected polygons\n",
+		program_name, hiz_tris_rejected);
+    }
+    fprintf(stderr,"%s : [%16.1f] z-buffer pass time (usec)\n",
+	    program_name, zpass_usec);
     fprintf(stderr,"%s : [%'16d] total edges\n",
             program_name, total_edges);
+    fprintf(stderr,"%s : [%'16d] edge threads\n",
+	    program_name, edge_threads);
+    fprintf(stderr,"%s : [%16.1f] edge build time (usec)\n",
+	    program_name, edges_usec);
+    fprintf(stderr,"%s : [%16.1f] edge drawing time (usec)\n",
+	    program_name, lines_usec);
     fprintf(stderr,"%s : [%'16d] drawn edges\n",
             program_name, drawn_edges);
     fprintf(stderr,"\n");
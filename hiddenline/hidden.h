@@ -46,6 +46,10 @@
 
 #define MAX_ZVAL	REALLY_BIG_FLOAT
 
+#define EDGE_CHUNK	(4096)	/* edges classified per job */
+#define EDGE_TILE	(64)	/* screen tile the lines are drawn in (pixels) */
+#define EDGE_MAX_THREADS	(64)
+
 	/* data types: */
 
 	/* an edge structure */
@@ -64,6 +68,8 @@ typedef struct {
 
     Edge_t	*edges;
     int		num_edges;
+    int		*hash;		/* (while it is built) */
+    u32		hash_mask;
 
 } ObjEdges_t;
 
@@ -75,9 +81,9 @@ extern int	total_edges, drawn_edges;
 extern void	draw_scene(void);
 
 /* from edges.c */
-extern void		create_obj_edges(Object_t *op);
-extern void		process_obj_edges(Object_t *op);
-extern void		draw_edges(Object_t *op);
+extern int		edge_threads;
+extern void		build_scene_edges(void);
+extern void		draw_scene_edges(void);
 
 #endif
 /* __HIDDEN_H__ */
@@ -52,7 +52,7 @@
 #define MAX_SPHERES     	(1024)
 #define MAX_MATERIALS    	(64)
 #define MAX_TEXTURES    	(64)
-#define MAX_LIGHTS      	(32)
+#define MAX_LIGHTS      	(1024)
 #define MAX_XRES        	(1920*2)
 #define MAX_YRES        	(1080*2)
 #define MAX_COLOR_VAL   	(255)
@@ -127,6 +127,7 @@
 #define FLAG_VERTNORM   	0x00000400
 #define FLAG_TEXGEN_SPHERE   	0x00000800
 #define FLAG_TEXGEN_CYLINDER   	0x00001000
+#define FLAG_GOURAUD    	0x00002000	/* light the vertices, not the pixels (paint) */
 
 /* for materials: */
 #define MATERIAL_COLOR		(0)
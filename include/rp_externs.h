@@ -74,6 +74,7 @@ extern void     	RPSetBackgroundColor(rgba_t *color);
 extern void     	RPClearColorFB(rgba_t *color);
 extern rgba_t   	*RPGetColorFBPixel(int x, int y);
 extern void     	RPPutColorFBPixel(int x, int y, int r, int g, int b, int a);
+extern void		RPPutColorSpan(int x0, int x1, int y, rgba_t *color, u8 *mask);
 extern void		RPDrawColorFBLine(int x1, int y1, int x2, int y2, 
 					rgba_t color, int useaa);
 extern void     	RPLoadBackgroundImage(void);
@@ -82,6 +83,8 @@ extern int      	RPWriteColorFB(void);
 extern void		RPClearDepthFB(float *zval);
 extern int		RPTestDepthFB(int x, int y, float z);
 extern void		RPPutDepthFBPixel(int x, int y, float z);
+extern int		RPTestDepthSpan(int x0, int x1, int y, float *z, u8 *mask);
+extern int		RPTestPutDepthSpan(int x0, int x1, int y, float *z, u8 *mask);
 extern void     	RPSetObjectFlags(u32 flags);
 extern void     	RPClearObjectFlags(u32 flags);
 extern void     	RPSetCamera(xyz_t pos, xyz_t coi, xyz_t up, float fov, float aspect);
@@ -121,6 +124,7 @@ extern void     	RPSetAmbient(Colorf_t color);
 extern void     	RPSetLight(xyz_t pos, Colorf_t color);
 extern void     	RPSetSpotLight(xyz_t pos, xyz_t coi, float fov, float focus, 
 				float range, float value, Colorf_t color);
+extern void     	RPSetShadowMap(int size);
 extern void     	RPTransformLights(void);
 
 /* from objects.c */
@@ -187,6 +187,7 @@ typedef struct {
     int		obj_count;
     Light_t	*light_list[MAX_LIGHTS];
     int		light_count;
+    int		shadow_size;	/* shadow map resolution, 0 for none */
     Colorf_t	ambient;
     Texture_t	*texture_list[MAX_TEXTURES+1];
     int		texture_count;
@@ -65,7 +65,7 @@
 #ifdef PAINT
 #   include "paint.h"
 #   define PROGRAM_VERSION	"1.0"
-#   define USAGE_STRING "[-D ...] [-I ...] [-b] [-d[d]] [-v] [-y] scenefile"
+#   define USAGE_STRING "[-D ...] [-I ...] [-b] [-d[d]] [-m samples] [-v] [-y] scenefile"
 #endif
 
 
@@ -90,7 +90,7 @@ main(int argc, char *argv[])
     RPInit(argv[0], 0x0);	/* must call this first */
     RPInitScene(); 		/* initialize the scene */
 
-#if (defined  PAINT || defined SCAN || defined DRAW)
+#ifdef DRAW
 	/* if the renderer does not support implicit sphere geometry: */ 
     RPEnableSphereSupport(FALSE);
 #endif
@@ -122,10 +122,14 @@ main(int argc, char *argv[])
 	    }
 	    break;
 	    
-#ifdef  MORAY	    /* only ray tracer does multisampling */
+#if (defined MORAY || defined PAINT)	/* only these do multisampling */
 	  case 'm': /* option flag to set multisampling parameter: */
 	    RPSetSceneFlags(FLAG_SCENE_MULTISAMPLE);
+#ifdef PAINT
+	    RPScene.num_samples = Clamp0x(atoi(argv[2]), MSAA_MAX_SAMPLES);
+#else
 	    RPScene.num_samples = Clamp0x(atoi(argv[2]), 5);
+#endif
 	    argc--;
 	    argv++;
 	    break;
@@ -0,0 +1,407 @@
+
+/*
+ * File:	bin.c
+ *
+ * Sort-middle tile binning for paint (RENDER06).
+ *
+ * paint_scene() transforms and clips as usual, but instead of drawing
+ * each triangle it hands it to bin_tri(), which appends it to the bin
+ * of every BIN_TILE x BIN_TILE screen tile its bounding box touches.
+ * bin_render() then starts a thread per core; each thread takes the
+ * next undrawn tile and rasterizes that tile's bin, in the order the
+ * triangles were submitted, writing only inside the tile. No two
+ * threads touch the same pixels, and every pixel sees its triangles in
+ * the same order as the serial renderer, so the image is the same for
+ * any number of threads.
+ *
+ * Triangles are referred to by object and triangle index (clipping
+ * reallocs the triangle lists), and set up again in every tile they
+ * touch. Sphere impostors are set up once, when they're submitted, and
+ * binned by the rectangle they cover, so they keep their place in the
+ * order too.
+ *
+ */
+
+/*
+ *
+ * MIT License
+ *
+ * Copyright (c) 2018 Steve Anderson
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "rp.h"
+#include "paint.h"
+
+typedef struct {	/* a submitted triangle */
+    int		obj, tri;	/* (tri < 0: sphere -1-tri of spheres[]) */
+} BinRef_t;
+
+typedef struct {	/* one screen tile */
+    int		*refs;		/* indexes into subs[], in submission order */
+    int		count, max;
+    int		thread;		/* for the timing dump: */
+    double	usec;
+    long	rasterized, shaded;
+    int		hiz_rejected;	/* (once per tile the triangle touches) */
+} Bin_t;
+
+typedef struct {	/* per thread state */
+    pthread_t	thread;
+    int		id;
+    long	rasterized, shaded;
+    int		hiz_rejected;
+    long	setup_count;
+    double	setup_usec;
+    int		tiny;		/* (once per tile the triangle touches) */
+    TriLights_t	lights;		/* the lights of the triangle being drawn */
+} BinWorker_t;
+
+int		paint_binned = FALSE;	/* set by paint_scene() for RENDER06 */
+int		bin_threads = 0;
+long		bin_bytes = 0;		/* bins + submitted triangle list */
+double		bin_max_usec = 0.0, bin_avg_usec = 0.0;
+
+static BinRef_t		*subs = (BinRef_t *) NULL;
+static int		sub_count = 0, sub_max = 0;
+static TriSetup_t	*spheres = (TriSetup_t *) NULL;	/* (set up) */
+static int		sphere_count = 0, sphere_max = 0;
+static Bin_t		*bins = (Bin_t *) NULL;
+static int		tiles_x = 0, tiles_y = 0;
+static int		next_tile = 0;
+static pthread_mutex_t	tile_lock = PTHREAD_MUTEX_INITIALIZER;
+
+void
+bin_init(void)
+{
+    tiles_x = (RPScene.xres + BIN_TILE - 1) / BIN_TILE;
+    tiles_y = (RPScene.yres + BIN_TILE - 1) / BIN_TILE;
+    bins = (Bin_t *) calloc(tiles_x * tiles_y, sizeof(Bin_t));
+    sub_count = sub_max = 0;
+    paint_binned = TRUE;
+}
+
+/* a RANDSHADE color from the triangle's position in the scene, so each
+ * tile picks the same one (RPRandom() would give a new color per tile)
+ */
+void
+bin_tri_color(Object_t *op, Tri_t *tri, Colorf_t *color)
+{
+    unsigned int	h;
+
+    h = (unsigned int) op->id * 2654435761u + (unsigned int) (tri - op->tris) * 40503u;
+    h ^= h >> 15;	h *= 2246822519u;	h ^= h >> 13;
+
+    color->r = (float) (h & 0xff) / 255.0;
+    color->g = (float) ((h >> 8) & 0xff) / 255.0;
+    color->b = (float) ((h >> 16) & 0xff) / 255.0;
+    color->a = 1.0;
+}
+
+/* submit a triangle (or sphere), to the bins of the tiles minx..maxy touches */
+static void
+bin_add(int obj, int tri, int minx, int miny, int maxx, int maxy)
+{
+    Bin_t	*b;
+    int		tx, ty;
+
+    if (sub_count == sub_max) {
+	sub_max = Max(1024, 2 * sub_max);
+	subs = (BinRef_t *) realloc(subs, sub_max * sizeof(BinRef_t));
+    }
+    subs[sub_count].obj = obj;
+    subs[sub_count].tri = tri;
+
+    for (ty = miny / BIN_TILE; ty <= maxy / BIN_TILE; ty++) {
+	for (tx = minx / BIN_TILE; tx <= maxx / BIN_TILE; tx++) {
+	    b = &(bins[ty * tiles_x + tx]);
+	    if (b->count == b->max) {
+		b->max = Max(64, 2 * b->max);
+		b->refs = (int *) realloc(b->refs, b->max * sizeof(int));
+	    }
+	    b->refs[b->count++] = sub_count;
+	}
+    }
+    sub_count++;
+}
+
+/* add a triangle to the bins of the tiles it touches */
+void
+bin_tri(int obj, int tri)
+{
+    Object_t	*op = RPScene.obj_list[obj];
+    Tri_t	*tp = &(op->tris[tri]);
+    Vtx_t	*p0, *p1, *p2;
+    int		minx, miny, maxx, maxy;
+
+    if (Flagged(tp->flags, FLAG_TRI_CLIPPED))	/* see paint_tri() */
+	return;
+
+    p0 = &(op->verts[tp->v0]);
+    p1 = &(op->verts[tp->v1]);
+    p2 = &(op->verts[tp->v2]);
+
+    if (tri_reject(op, p0, p1, p2))
+	return;
+
+	/* (a pixel wider: the edge walker's stepped edges can round to
+	 * the column just outside the vertices)
+	 */
+    minx = Max(Min3(p0->sx, p1->sx, p2->sx) - 1, Max(RPScene.scissor_box->ulx, 0));
+    maxx = Min(Max3(p0->sx, p1->sx, p2->sx) + 1, Min(RPScene.scissor_box->lrx, RPScene.xres-1));
+    miny = Max(Min3(p0->sy, p1->sy, p2->sy), Max(RPScene.scissor_box->uly, 0));
+    maxy = Min(Max3(p0->sy, p1->sy, p2->sy), Min(RPScene.scissor_box->lry, RPScene.yres-1));
+
+    drawn_polys++;
+    if (minx > maxx || miny > maxy)
+	return;
+
+    if (GouraudObject(op))	/* (the tile threads only read the lit vertices) */
+	gouraud_tri(op, tp);
+
+    bin_add(obj, tri, minx, miny, maxx, maxy);
+}
+
+/* add a sphere impostor to the bins of the tiles its rectangle touches */
+void
+bin_sphere(int obj)
+{
+    TriSetup_t	*ts;
+
+    if (sphere_count == sphere_max) {
+	sphere_max = Max(16, 2 * sphere_max);
+	spheres = (TriSetup_t *) realloc(spheres, sphere_max * sizeof(TriSetup_t));
+    }
+    ts = &(spheres[sphere_count]);
+    if (!sphere_setup(RPScene.obj_list[obj], ts))
+	return;
+    spheres_drawn++;
+
+    bin_add(obj, -1 - sphere_count++, ts->minx, ts->miny, ts->maxx, ts->maxy);
+}
+
+/* wall clock microseconds, for timing stages of the pipeline */
+double
+paint_usec(void)
+{
+    struct timespec	ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((double) ts.tv_sec * 1.0e6 + (double) ts.tv_nsec / 1.0e3);
+}
+
+/* rasterize one tile's bin, writing only inside the tile */
+static void
+bin_draw_tile(BinWorker_t *w, int tile)
+{
+    Bin_t	*b = &(bins[tile]);
+    TriSetup_t	batch[SETUP_BATCH], sphere, *ts;
+    Object_t	*op;
+    int		tris[SETUP_BATCH];
+    int		i, k, n, obj, count, tx, ty;
+    double	start, setup_start;
+
+    start = paint_usec();
+    tx = (tile % tiles_x) * BIN_TILE;
+    ty = (tile / tiles_x) * BIN_TILE;
+
+    for (i=0; i<b->count; i+=n) {
+	if (subs[b->refs[i]].tri < 0) {	/* a sphere, the part in this tile */
+	    sphere = spheres[-1 - subs[b->refs[i]].tri];
+	    sphere.minx = Max(sphere.minx, tx);
+	    sphere.miny = Max(sphere.miny, ty);
+	    sphere.maxx = Min(sphere.maxx, tx + BIN_TILE - 1);
+	    sphere.maxy = Min(sphere.maxy, ty + BIN_TILE - 1);
+	    lights_tri(&(w->lights), &sphere);
+	    sphere_draw(&sphere);
+	    b->rasterized += sphere.rasterized;
+	    b->shaded += sphere.shaded;
+	    n = 1;
+	    continue;
+	}
+
+	    /* set up the next few triangles of the same object together: */
+	obj = subs[b->refs[i]].obj;
+	op = RPScene.obj_list[obj];
+	for (n=0; n<SETUP_BATCH && i+n < b->count && subs[b->refs[i+n]].obj == obj; n++)
+	    tris[n] = subs[b->refs[i+n]].tri;
+
+	setup_start = paint_usec();
+	count = setup_tris(batch, op, tris, n);
+	w->setup_usec += paint_usec() - setup_start;
+	w->setup_count += n;
+
+	for (k=0; k<count; k++) {
+	    ts = &(batch[k]);
+	    ts->minx = Max(ts->minx, tx);
+	    ts->miny = Max(ts->miny, ty);
+	    ts->maxx = Min(ts->maxx, tx + BIN_TILE - 1);
+	    ts->maxy = Min(ts->maxy, ty + BIN_TILE - 1);
+
+	    if (hiz_enabled && hiz_tri_hidden(ts)) {
+		b->hiz_rejected++;
+		continue;
+	    }
+	    lights_tri(&(w->lights), ts);
+
+	    if (msaa_samples > 0)
+		msaa_tri(ts);
+	    else if (ts->tiny)
+		tiny_tri(ts, TRUE);
+	    else if (Flagged(RPScene.generic_flags, FLAG_RENDER_04))
+		halfspace_tri(ts, TRUE);
+	    else
+		walk_tri(ts, TRUE);
+
+	    b->rasterized += ts->rasterized;
+	    b->shaded += ts->shaded;
+	    w->tiny += ts->tiny;
+	}
+    }
+
+    b->thread = w->id;
+    b->usec = paint_usec() - start;
+    w->rasterized += b->rasterized;
+    w->shaded += b->shaded;
+    w->hiz_rejected += b->hiz_rejected;
+}
+
+static void *
+bin_worker(void *arg)
+{
+    BinWorker_t	*w = (BinWorker_t *) arg;
+    int		tile;
+
+    while (TRUE) {
+	pthread_mutex_lock(&tile_lock);
+	tile = next_tile++;
+	pthread_mutex_unlock(&tile_lock);
+
+	if (tile >= tiles_x * tiles_y)
+	    break;
+	bin_draw_tile(w, tile);
+    }
+    return (NULL);
+}
+
+/* draw all the bins, a thread per core */
+void
+bin_render(void)
+{
+    BinWorker_t	workers[BIN_MAX_THREADS];
+    Object_t	*op;
+    Tri_t	*tri;
+    Vtx_t	*p0, *p1, *p2;
+    int		i, ntiles = tiles_x * tiles_y;
+    rgba_t	red = {MAX_COLOR_VAL, 0, 0, MAX_COLOR_VAL};
+
+    bin_threads = Max(1, Min((int) sysconf(_SC_NPROCESSORS_ONLN), BIN_MAX_THREADS));
+    bin_threads = Min(bin_threads, ntiles);
+
+    next_tile = 0;
+    for (i=0; i<bin_threads; i++) {
+	workers[i].id = i;
+	workers[i].rasterized = workers[i].shaded = 0;
+	workers[i].hiz_rejected = 0;
+	workers[i].setup_count = 0;
+	workers[i].setup_usec = 0.0;
+	workers[i].tiny = 0;
+	memset(&(workers[i].lights), 0, sizeof(TriLights_t));
+	if (pthread_create(&(workers[i].thread), NULL, bin_worker, &(workers[i])) != 0) {
+	    fprintf(stderr,"%s : ERROR : %s : %d : can't create thread %d\n",
+		    program_name, __FILE__, __LINE__, i);
+	    exit(EXIT_FAILURE);
+	}
+    }
+    for (i=0; i<bin_threads; i++) {
+	pthread_join(workers[i].thread, NULL);
+	frags_rasterized += workers[i].rasterized;
+	frags_shaded += workers[i].shaded;
+	hiz_tris_rejected += workers[i].hiz_rejected;
+	setup_count += workers[i].setup_count;
+	setup_usec += workers[i].setup_usec;
+	tiny_tris += workers[i].tiny;
+	lights_tri_done(&(workers[i].lights));
+    }
+
+	/* triangle outlines cross tiles, draw them last */
+    if (Flagged(RPScene.generic_flags, FLAG_RENDER_02)) {
+	for (i=0; i<sub_count; i++) {
+	    if (subs[i].tri < 0)
+		continue;
+	    op = RPScene.obj_list[subs[i].obj];
+	    tri = &(op->tris[subs[i].tri]);
+	    p0 = &(op->verts[tri->v0]);
+	    p1 = &(op->verts[tri->v1]);
+	    p2 = &(op->verts[tri->v2]);
+	    if (msaa_samples > 0) {	/* after the resolve */
+		deferred_outline(p0->sx, p0->sy, p1->sx, p1->sy, p2->sx, p2->sy);
+		continue;
+	    }
+	    RPDrawColorFBLine(p0->sx, p0->sy, p1->sx, p1->sy, red, TRUE);
+	    RPDrawColorFBLine(p1->sx, p1->sy, p2->sx, p2->sy, red, TRUE);
+	    RPDrawColorFBLine(p2->sx, p2->sy, p0->sx, p0->sy, red, TRUE);
+	}
+    }
+
+	/* load balance stats, and the per tile dump with -v */
+    bin_bytes = (long) sub_max * sizeof(BinRef_t) + (long) ntiles * sizeof(Bin_t)
+	+ (long) sphere_max * sizeof(TriSetup_t);
+    bin_max_usec = bin_avg_usec = 0.0;
+    if (Flagged(RPScene.flags, FLAG_VERBOSE))
+	fprintf(stderr,"\ntile\t  x\t  y\tthread\ttris\tfragments\tshaded\tusec\n");
+    for (i=0; i<ntiles; i++) {
+	bin_bytes += (long) bins[i].max * sizeof(int);
+	bin_max_usec = Max(bin_max_usec, bins[i].usec);
+	bin_avg_usec += bins[i].usec;
+	if (Flagged(RPScene.flags, FLAG_VERBOSE))
+	    fprintf(stderr,"%d\t%4d\t%4d\t%d\t%d\t%ld\t\t%ld\t%.1f\n", i,
+		    (i % tiles_x) * BIN_TILE, (i / tiles_x) * BIN_TILE, bins[i].thread,
+		    bins[i].count, bins[i].rasterized, bins[i].shaded, bins[i].usec);
+    }
+    bin_avg_usec /= (double) ntiles;
+}
+
+void
+bin_cleanup(void)
+{
+    int		i;
+
+    for (i=0; i<tiles_x * tiles_y; i++)
+	free(bins[i].refs);
+    free(bins);
+    free(subs);
+    free(spheres);
+    bins = (Bin_t *) NULL;
+    subs = (BinRef_t *) NULL;
+    spheres = (TriSetup_t *) NULL;
+    sub_count = sub_max = 0;
+    sphere_count = sphere_max = 0;
+    paint_binned = FALSE;
+}
@@ -0,0 +1,255 @@
+
+/*
+ * File:	deferred.c
+ *
+ * Deferred shading for paint (RENDER05).
+ *
+ * The rasterizers run as usual, but a pixel that passes the depth test
+ * only stores what the shading needs in a G-buffer (normal, position,
+ * texture coordinates, base color and the triangle it came from).
+ * When the whole scene is drawn, deferred_resolve() textures, lights
+ * and fogs each visible pixel exactly once.
+ *
+ * The triangles that own a G-buffer pixel keep their ShadeTri_t (object,
+ * material and texture deltas) in a growing list, the G-buffer pixels
+ * refer to them by index.
+ *
+ */
+
+/*
+ *
+ * MIT License
+ *
+ * Copyright (c) 2018 Steve Anderson
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "rp.h"
+#include "paint.h"
+
+int		paint_deferred = FALSE;	/* set by paint_scene() for RENDER05 */
+long		gbuf_bytes = 0;		/* G-buffer + triangle list memory */
+long		gbuf_writes = 0;	/* fragments written to the G-buffer */
+
+static GBuf_t		*gbuf = (GBuf_t *) NULL;	/* xres * yres */
+static ShadeTri_t	*gtris = (ShadeTri_t *) NULL;
+static int		gtri_count = 0, gtri_max = 0;
+static int		*outlines = (int *) NULL;	/* RENDER02, x,y x 3 per triangle */
+static int		outline_count = 0, outline_max = 0;
+
+/* allocate the G-buffer for the scene resolution, all background */
+void
+deferred_init(void)
+{
+    int		i, size;
+
+    size = RPScene.xres * RPScene.yres;
+    gbuf = (GBuf_t *) malloc(size * sizeof(GBuf_t));
+    if (gbuf == (GBuf_t *) NULL) {
+	fprintf(stderr,"%s : ERROR : %s : %d : can't allocate %d x %d G-buffer\n",
+		program_name, __FILE__, __LINE__, RPScene.xres, RPScene.yres);
+	exit(EXIT_FAILURE);
+    }
+    for (i=0; i<size; i++)
+	gbuf[i].id = -1;
+
+    gtri_count = gtri_max = 0;
+    gbuf_bytes = (long) size * sizeof(GBuf_t);
+    paint_deferred = TRUE;
+}
+
+/* the triangle's index in the G-buffer triangle list, added the first time */
+static int
+deferred_tri(TriSetup_t *ts)
+{
+    if (ts->defer_id < 0) {
+	if (gtri_count == gtri_max) {
+	    gtri_max = Max(1024, 2 * gtri_max);
+	    gtris = (ShadeTri_t *) realloc(gtris, gtri_max * sizeof(ShadeTri_t));
+	}
+	gtris[gtri_count] = ts->sh;
+	ts->defer_id = gtri_count++;
+    }
+    return (ts->defer_id);
+}
+
+/* store a fragment that passed the depth test */
+void
+deferred_write(TriSetup_t *ts, Frag_t *f, int x, int y)
+{
+    GBuf_t	*g;
+    Colorf_t	*c;
+
+    g = &(gbuf[y * RPScene.xres + x]);
+    c = Flagged(ts->sh.op->flags, FLAG_VERTSHADE) ? &(f->color) : &(ts->polycolor);
+
+    if (ts->attribs & ATTR_LIT)
+	g->u.lit = f->lit;
+    else
+	g->u.n = f->n;
+    g->surf = f->surf;
+    g->eye = f->eye;
+    g->s = f->s;
+    g->t = f->t;
+    g->w = f->w;
+    g->z = f->z;
+    g->color = *c;
+    g->id = deferred_tri(ts);
+
+    gbuf_writes++;
+}
+
+/* save a triangle outline (RENDER02), to draw after the shading */
+void
+deferred_outline(int x0, int y0, int x1, int y1, int x2, int y2)
+{
+    int		*o;
+
+    if (outline_count + 6 > outline_max) {
+	outline_max = Max(1024, 2 * outline_max);
+	outlines = (int *) realloc(outlines, outline_max * sizeof(int));
+    }
+    o = &(outlines[outline_count]);
+    o[0] = x0;	o[1] = y0;
+    o[2] = x1;	o[3] = y1;
+    o[4] = x2;	o[5] = y2;
+    outline_count += 6;
+}
+
+/* draw the saved outlines (after the deferred or multisample resolve) */
+void
+deferred_draw_outlines(void)
+{
+    rgba_t	red = {MAX_COLOR_VAL, 0, 0, MAX_COLOR_VAL};
+    int		i, *o;
+
+    for (i=0; i<outline_count; i+=6) {
+	o = &(outlines[i]);
+	RPDrawColorFBLine(o[0], o[1], o[2], o[3], red, TRUE);
+	RPDrawColorFBLine(o[2], o[3], o[4], o[5], red, TRUE);
+	RPDrawColorFBLine(o[4], o[5], o[0], o[1], red, TRUE);
+    }
+    free(outlines);
+    outlines = (int *) NULL;
+    outline_count = outline_max = 0;
+}
+
+/* cull the lights again, per tile, against the box around the positions it shades */
+static void
+deferred_cull_lights(void)
+{
+    GBuf_t	*g;
+    xyz_t	*bmin, *bmax;
+    int		x, y, t, ntiles = light_tiles_x * light_tiles_y;
+
+    bmin = (xyz_t *) malloc(2 * ntiles * sizeof(xyz_t));
+    bmax = bmin + ntiles;
+    for (t=0; t<ntiles; t++) {
+	bmin[t].x = bmin[t].y = bmin[t].z = REALLY_BIG_FLOAT;
+	bmax[t].x = bmax[t].y = bmax[t].z = -REALLY_BIG_FLOAT;
+    }
+
+    for (y=0; y<RPScene.yres; y++) {
+	g = &(gbuf[y * RPScene.xres]);
+	for (x=0; x<RPScene.xres; x++, g++) {
+	    if (g->id < 0 || !Flagged(gtris[g->id].op->flags, FLAG_LIGHTING) ||
+		GouraudObject(gtris[g->id].op))
+		continue;
+	    t = (y / LIGHT_TILE) * light_tiles_x + x / LIGHT_TILE;
+	    bmin[t].x = Min(bmin[t].x, g->surf.x);	bmax[t].x = Max(bmax[t].x, g->surf.x);
+	    bmin[t].y = Min(bmin[t].y, g->surf.y);	bmax[t].y = Max(bmax[t].y, g->surf.y);
+	    bmin[t].z = Min(bmin[t].z, g->surf.z);	bmax[t].z = Max(bmax[t].z, g->surf.z);
+	}
+    }
+
+    lights_cull(bmin, bmax);
+    free(bmin);
+}
+
+/* shade every visible pixel once, from the G-buffer */
+void
+deferred_resolve(void)
+{
+    ShadeTri_t	*sh;
+    GBuf_t	*g;
+    Frag_t	f;
+    Colorf_t	colorsum;
+    rgba_t	color[MAX_XRES];
+    u8		mask[MAX_XRES];
+    int		x, y;
+
+    gbuf_bytes += (long) gtri_max * sizeof(ShadeTri_t);
+    if (RPScene.light_count > 0)
+	deferred_cull_lights();
+
+    for (y=0; y<RPScene.yres; y++) {
+	g = &(gbuf[y * RPScene.xres]);
+
+	for (x=0; x<RPScene.xres; x++, g++) {
+	    mask[x] = (g->id >= 0);
+	    if (!mask[x])
+		continue;
+
+	    sh = &(gtris[g->id]);
+
+	    if (GouraudObject(sh->op))
+		f.lit = g->u.lit;
+	    else
+		f.n = g->u.n;
+	    f.surf = g->surf;
+	    f.s = g->s;
+	    f.t = g->t;
+	    f.w = g->w;
+	    f.z = g->z;
+	    f.eye = g->eye;
+
+	    colorsum = g->color;
+	    shade_color(sh, &f, x, y, &colorsum);
+
+	    color[x].r = (u8) Clamp0255(colorsum.r * MAX_COLOR_VAL);
+	    color[x].g = (u8) Clamp0255(colorsum.g * MAX_COLOR_VAL);
+	    color[x].b = (u8) Clamp0255(colorsum.b * MAX_COLOR_VAL);
+	    color[x].a = (u8) Clamp0255(colorsum.a * MAX_COLOR_VAL);
+	    frags_shaded++;
+	}
+	RPPutColorSpan(0, RPScene.xres-1, y, color, mask);
+    }
+
+    deferred_draw_outlines();
+}
+
+void
+deferred_cleanup(void)
+{
+    free(gbuf);
+    free(gtris);
+    free(outlines);
+    gbuf = (GBuf_t *) NULL;
+    gtris = (ShadeTri_t *) NULL;
+    outlines = (int *) NULL;
+    gtri_count = gtri_max = 0;
+    outline_count = outline_max = 0;
+    paint_deferred = FALSE;
+}
@@ -0,0 +1,185 @@
+
+/*
+ * File:	depth.c
+ *
+ * Depth-only triangles, for the passes that only fill the z-buffer:
+ * the hidden line renderer's z-buffer pass, the shadow maps, and
+ * paint_tris() with usecfb FALSE.
+ *
+ * Setup only looks at the screen positions: the signed area (for
+ * culling), the edge slopes and the z plane equation, one triangle at a
+ * time - no materials, span variants or attribute streams. The spans
+ * only compute z, from the plane equation at each pixel, and test and
+ * write it a span at a time (RPTestPutDepthSpan()). The edge walk,
+ * half-space (RENDER04) and tiny triangle rasterizers are the same
+ * ones, so the coverage is the same.
+ *
+ */
+
+/*
+ *
+ * MIT License
+ *
+ * Copyright (c) 2018 Steve Anderson
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#include <stdio.h>
+#include <math.h>
+
+#include "rp.h"
+#include "paint.h"
+
+/*
+ * set up triangle tri of object op to write depth only, TRUE if it is
+ * drawn (not clipped, degenerate or culled). The same triangles as in
+ * setup_tris() are tiny (with RENDER04), and the slopes are computed the
+ * same way.
+ */
+static int
+depth_setup(TriSetup_t *ts, Object_t *op, Tri_t *tri)
+{
+    Vtx_t	*p[3], *tmpp;
+    float	inv_r, Hd, Md;
+    int		Hdx, Hdy, Mdx, Mdy, ydell, j;
+
+    if (Flagged(tri->flags, FLAG_TRI_CLIPPED))	/* (see setup_tris()) */
+	return (FALSE);
+
+    p[0] = &(op->verts[tri->v0]);
+    p[1] = &(op->verts[tri->v1]);
+    p[2] = &(op->verts[tri->v2]);
+
+	/* the signed area, in the triangle's own vertex order, for culling: */
+    if (tri_cull(op, (float) ((p[2]->sx - p[0]->sx)*(p[1]->sy - p[0]->sy) -
+			      (p[2]->sy - p[0]->sy)*(p[1]->sx - p[0]->sx))))
+	return (FALSE);
+
+	/* y-sort the 3 vertices of the triangle: */
+    if (p[0]->sy > p[1]->sy) {
+	tmpp = p[0]; p[0] = p[1]; p[1] = tmpp;
+    }
+    if (p[0]->sy > p[2]->sy) {
+	tmpp = p[0]; p[0] = p[2]; p[2] = tmpp;
+    }
+    if (p[1]->sy > p[2]->sy) {
+	tmpp = p[1]; p[1] = p[2]; p[2] = tmpp;
+    }
+
+    for (j=0; j<3; j++) {
+	ts->p[j].sx = p[j]->sx;
+	ts->p[j].sy = p[j]->sy;
+	ts->p[j].sz = p[j]->sz;
+	ts->v[j].z = (float) p[j]->sz;
+    }
+    ts->attribs = 0;
+    ts->rasterized = ts->shaded = 0;
+    ts->minx = Max(RPScene.scissor_box->ulx, 0);
+    ts->miny = Max(RPScene.scissor_box->uly, 0);
+    ts->maxx = Min(RPScene.scissor_box->lrx, RPScene.xres-1);
+    ts->maxy = Min(RPScene.scissor_box->lry, RPScene.yres-1);
+
+    Mdx = p[1]->sx - p[0]->sx;		Mdy = p[1]->sy - p[0]->sy;
+    Hdx = p[2]->sx - p[0]->sx;		Hdy = p[2]->sy - p[0]->sy;
+    ydell = p[2]->sy - p[1]->sy;
+    ts->r = Hdx*Mdy - Hdy*Mdx;
+
+	/* the z plane equation (tiny triangles too, see tiny_tri()): */
+    inv_r = 1.0/ts->r;
+    Hd = ts->v[2].z - ts->v[0].z;
+    Md = ts->v[1].z - ts->v[0].z;
+    ts->DxDz = (((float)Mdy * Hd) - ((float)Hdy * Md)) * inv_r;
+    ts->DyDz = (((float)Hdx * Md) - ((float)Mdx * Hd)) * inv_r;
+
+	/* (only with RENDER04: tiny_tri() has the half-space coverage, not the edge walk's) */
+    ts->tiny = (Flagged(RPScene.generic_flags, FLAG_RENDER_04) && msaa_samples == 0 && Hdy < TINY_TRI &&
+		Max3(p[0]->sx, p[1]->sx, p[2]->sx) - Min3(p[0]->sx, p[1]->sx, p[2]->sx) < TINY_TRI);
+    if (ts->tiny)
+	return (TRUE);
+
+	/* edge slopes (0 for a horizontal edge): */
+    ts->dhdy = (Hdy != 0) ? (float) Hdx / (float) Hdy : 0.0;
+    ts->dmdy = (Mdy != 0) ? (float) Mdx / (float) Mdy : 0.0;
+    ts->dldy = (ydell != 0) ? (float)(p[2]->sx - p[1]->sx) / (float) ydell : 0.0;
+
+    return (TRUE);
+}
+
+/*
+ * depth test and write the pixels x0 to x1 of scanline y. Each pixel's
+ * z comes from the plane equation rather than stepping along the span,
+ * so the z-buffer is exactly what painting it always wrote (the edges
+ * draw tests against it are sensitive to the last bit).
+ */
+void
+depth_span(TriSetup_t *ts, int x0, int x1, int y)
+{
+    SetupVtx_t	*p0 = &(ts->p[0]);
+    float	z[MAX_XRES];
+    int		i;
+
+    for (i=0; i<=x1-x0; i++)
+	z[i] = p0->sz + (x0 + i - p0->sx)*ts->DxDz + (y - p0->sy)*ts->DyDz;
+    RPTestPutDepthSpan(x0, x1, y, z, (u8 *) NULL);
+}
+
+/*
+ * write the depth of triangles tris[0..n-1] of an object (any number
+ * of them) into the z-buffer
+ */
+void
+depth_tris(Object_t *op, int *tris, int n)
+{
+    TriSetup_t	ts;
+    int		i;
+
+    for (i=0; i<n; i++) {
+	setup_count++;
+	if (!depth_setup(&ts, op, &(op->tris[tris[i]])))
+	    continue;
+
+	    /* RENDER07 hierarchical z: skip it if it's behind everything there */
+	if (hiz_enabled && hiz_tri_hidden(&ts)) {
+	    hiz_tris_rejected++;
+	    continue;
+	}
+
+	if (ts.tiny)
+	    tiny_tri(&ts, FALSE);
+	else if (Flagged(RPScene.generic_flags, FLAG_RENDER_04))
+	    halfspace_tri(&ts, FALSE);
+	else
+	    walk_tri(&ts, FALSE);
+
+	frags_rasterized += ts.rasterized;
+	tiny_tris += ts.tiny;
+	drawn_polys++;
+    }
+}
+
+/* write the depth of this triangle */
+void
+depth_tri(Object_t *op, Tri_t *tri)
+{
+    int		t = tri - op->tris;
+
+    depth_tris(op, &t, 1);
+}
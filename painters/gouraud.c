@@ -0,0 +1,130 @@
+
+/*
+ * File:	gouraud.c
+ *
+ * Per-vertex (Gouraud) lighting.
+ *
+ * Objects with the GOURAUD flag (with LIGHTING, and not FLATSHADE) are
+ * lit at their vertices instead of at every pixel. The first triangle
+ * set up with a vertex lights it, with the same shade_pixel() the pixels
+ * use, and the lit color is kept in a cache beside the object's vertex
+ * list, so the other triangles around the vertex just read it. The
+ * rasterizers then interpolate the lit color (ATTR_LIT) and multiply
+ * the (textured) base color by it, so a frame lights each vertex once,
+ * however many pixels and lights there are.
+ *
+ * The cache keeps a color per vertex and material, so a vertex shared
+ * by triangles of different materials is lit once for each. When
+ * binning (RENDER06), bin_tri() lights the vertices of every triangle it
+ * bins, so the tile threads find them all lit and only read the cache.
+ *
+ */
+
+/*
+ *
+ * MIT License
+ *
+ * Copyright (c) 2018 Steve Anderson
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "rp.h"
+#include "paint.h"
+
+int		gouraud_verts = 0;	/* vertices lit */
+
+typedef struct {	/* an object's lit vertices, material_count colors per vertex */
+    Colorf_t	*lit;
+    u8		*done;		/* TRUE once lit */
+    int		size;		/* vertices */
+} VertCache_t;
+
+static VertCache_t	*caches = (VertCache_t *) NULL;	/* one per object (id) */
+static int		cache_count = 0;
+
+void
+gouraud_init(void)
+{
+    cache_count = RPScene.obj_count;
+    caches = (VertCache_t *) calloc(Max(cache_count, 1), sizeof(VertCache_t));
+    gouraud_verts = 0;
+}
+
+/* the lit color of vertex v, for the material of triangle tri */
+Colorf_t *
+gouraud_vertex(Object_t *op, Tri_t *tri, int v)
+{
+    VertCache_t	*vc = &(caches[op->id]);
+    Vtx_t	*p = &(op->verts[v]);
+    ShadeTri_t	sh;
+    int		slots = Max(op->material_count, 1), i;
+
+	/* (clipping adds vertices as the object is drawn) */
+    if (v >= vc->size) {
+	vc->lit = (Colorf_t *) realloc(vc->lit, op->vert_count * slots * sizeof(Colorf_t));
+	vc->done = (u8 *) realloc(vc->done, op->vert_count * slots * sizeof(u8));
+	memset(&(vc->done[vc->size * slots]), 0, (op->vert_count - vc->size) * slots * sizeof(u8));
+	vc->size = op->vert_count;
+    }
+
+    i = v * slots + tri->material_id;
+    if (!vc->done[i]) {
+	sh.op = op;
+	sh.tri = tri;
+	sh.m = &(op->materials[tri->material_id]);
+	shade_setup(&sh);
+
+	    /* (while drawing, every tile has the lights that reach the view) */
+	shade_pixel(&sh, lights_at(0, 0), &(p->n), &(p->pos), &(p->pos), &(p->e),
+		    &(vc->lit[i]));
+	vc->done[i] = TRUE;
+	gouraud_verts++;
+    }
+
+    return (&(vc->lit[i]));
+}
+
+/* light the vertices of a triangle, ahead of the tile threads */
+void
+gouraud_tri(Object_t *op, Tri_t *tri)
+{
+    gouraud_vertex(op, tri, tri->v0);
+    gouraud_vertex(op, tri, tri->v1);
+    gouraud_vertex(op, tri, tri->v2);
+}
+
+void
+gouraud_cleanup(void)
+{
+    int		i;
+
+    for (i=0; i<cache_count; i++) {
+	free(caches[i].lit);
+	free(caches[i].done);
+    }
+    free(caches);
+    caches = (VertCache_t *) NULL;
+    cache_count = 0;
+}
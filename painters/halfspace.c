@@ -0,0 +1,308 @@
+
+/*
+ * File:	halfspace.c
+ *
+ * A half-space (edge function) rasterizer, an alternative to walking the
+ * triangle edges scanline by scanline in rasterize.c.
+ *
+ * Each edge of the triangle is a fixed-point function E(x,y) = A*x + B*y + C
+ * that is >= 0 on the inside. The screen is visited in HS_TILE x HS_TILE
+ * tiles over the triangle's bounding box: the tile corners tell us if a tile
+ * is all outside (skip it), all inside (every pixel is covered), or partly
+ * covered, in which case each row of the tile gets a coverage mask from the
+ * three edge functions evaluated for all HS_TILE pixels at once (written
+ * as simple fixed-length loops so the compiler turns them into SIMD).
+ *
+ * Pixels exactly on an edge use the top-left fill rule, so pixels on an
+ * edge shared by two triangles are drawn once.
+ *
+ * Vertex screen positions are already integers, so the edge functions
+ * are exact.
+ *
+ */
+
+/*
+ *
+ * MIT License
+ *
+ * Copyright (c) 2018 Steve Anderson
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <string.h>
+
+#include "rp.h"
+#include "paint.h"
+
+typedef struct {	/* E(x,y) = A*x + B*y + C, inside if >= 0 */
+    int		A, B, C;
+    int		bias;		/* 1 if C was moved off the edge by the fill rule */
+} edge_t;
+
+int	tiny_tris = 0;
+
+/* set up the edge function from a to b, with the top-left fill rule */
+static void
+edge_setup(edge_t *e, SetupVtx_t *a, SetupVtx_t *b)
+{
+    e->A = a->sy - b->sy;
+    e->B = b->sx - a->sx;
+    e->C = (b->sy - a->sy) * a->sx - (b->sx - a->sx) * a->sy;
+
+	/* only top and left edges own the pixels exactly on them;
+	 * for the rest, on the edge (E == 0) becomes outside.
+	 */
+    e->bias = !(e->A > 0 || (e->A == 0 && e->B > 0));
+    e->C -= e->bias;
+}
+
+/* rasterize the visible pixels of row y from x0 to x1 given by mask;
+ * a triangle covers one run of a row, so it goes out as a single span.
+ */
+static void
+paint_mask(TriSetup_t *ts, int x0, int x1, int y, unsigned int mask, int usecfb)
+{
+    int		first, last;
+
+    for (first=x0; first<=x1 && !(mask & (0x1 << (first - x0))); first++)
+	;
+    for (last=x1; last>first && !(mask & (0x1 << (last - x0))); last--)
+	;
+    paint_span(ts, first, last, y, usecfb);
+}
+
+void
+halfspace_tri(TriSetup_t *ts, int usecfb)
+{
+    SetupVtx_t	*v0 = &(ts->p[0]), *v1 = &(ts->p[1]), *v2 = &(ts->p[2]), *tmpp;
+    edge_t	e[3];
+    int		minx, miny, maxx, maxy, tx, ty, x, y, i, j, k;
+    int		cmin, cmax, c, accept, x1, y1;
+    int		ev[3][HS_TILE], inside[HS_TILE];
+    unsigned int mask;
+
+	/* the edge functions only fit in 32 bits for sane coordinates 
+	 * (can happen with clipping turned off)
+	 */
+    for (i=0; i<3; i++) {
+	if (abs(ts->p[i].sx) > HS_MAX_COORD || abs(ts->p[i].sy) > HS_MAX_COORD) {
+	    walk_tri(ts, usecfb);
+	    return;
+	}
+    }
+
+	/* wind the triangle so the inside is positive (r is the negative area) */
+    if (ts->r > 0.0) {
+	tmpp = v1; v1 = v2; v2 = tmpp;
+    }
+    edge_setup(&(e[0]), v0, v1);
+    edge_setup(&(e[1]), v1, v2);
+    edge_setup(&(e[2]), v2, v0);
+
+	/* bounding box, clamped to the screen (or tile) */
+    minx = Max(Min3(v0->sx, v1->sx, v2->sx), ts->minx);
+    maxx = Min(Max3(v0->sx, v1->sx, v2->sx), ts->maxx);
+    miny = Max(Min3(v0->sy, v1->sy, v2->sy), ts->miny);
+    maxy = Min(Max3(v0->sy, v1->sy, v2->sy), ts->maxy);
+
+    if (minx > maxx || miny > maxy)
+	return;
+
+    for (ty = miny & ~(HS_TILE-1); ty <= maxy; ty += HS_TILE) {
+        for (tx = minx & ~(HS_TILE-1); tx <= maxx; tx += HS_TILE) {
+
+		/* classify the tile with its corners */
+	    accept = TRUE;
+	    for (k=0; k<3; k++) {
+		c = e[k].A * tx + e[k].B * ty + e[k].C;
+		cmin = cmax = c;
+		c += e[k].A * (HS_TILE-1);		/* upper right */
+		cmin = Min(cmin, c);	cmax = Max(cmax, c);
+		c += e[k].B * (HS_TILE-1);		/* lower right */
+		cmin = Min(cmin, c);	cmax = Max(cmax, c);
+		c -= e[k].A * (HS_TILE-1);		/* lower left */
+		cmin = Min(cmin, c);	cmax = Max(cmax, c);
+
+		if (cmax < 0)
+		    break;		/* tile is all outside this edge */
+		if (cmin < 0)
+		    accept = FALSE;
+	    }
+	    if (k < 3)
+		continue;
+
+		/* the part of the tile inside the bounding box */
+	    x = Max(tx, minx);	x1 = Min(tx + HS_TILE - 1, maxx);
+	    y = Max(ty, miny);	y1 = Min(ty + HS_TILE - 1, maxy);
+
+	    if (accept) {	/* tile all inside */
+		for (; y<=y1; y++)
+		    paint_span(ts, x, x1, y, usecfb);
+		continue;
+	    }
+
+	    for (; y<=y1; y++) {	/* partial tile, a coverage mask per row */
+
+		for (k=0; k<3; k++) {
+		    c = e[k].A * tx + e[k].B * y + e[k].C;
+		    for (j=0; j<HS_TILE; j++)
+			ev[k][j] = c + e[k].A * j;
+		}
+		for (j=0; j<HS_TILE; j++)	/* all three >= 0 iff no sign bits */
+		    inside[j] = (ev[0][j] | ev[1][j] | ev[2][j]) >= 0;
+
+		mask = 0x0;
+		for (j=0; j<HS_TILE; j++)
+		    mask |= (inside[j] << j);
+
+		if (mask != 0x0)
+		    paint_mask(ts, x, x1, y, mask >> (x - tx), usecfb);
+	    }
+	}
+    }
+}
+
+/* the attributes at a pixel, weighting the vertices' by wt[] */
+static inline void
+tiny_frag(TriSetup_t *ts, Frag_t *f, float *wt, int attribs)
+{
+    Frag_t	*a = &(ts->v[0]), *b = &(ts->v[1]), *c = &(ts->v[2]);
+
+    if (attribs & ATTR_COLOR) {
+	f->color.r = wt[0]*a->color.r + wt[1]*b->color.r + wt[2]*c->color.r;
+	f->color.g = wt[0]*a->color.g + wt[1]*b->color.g + wt[2]*c->color.g;
+	f->color.b = wt[0]*a->color.b + wt[1]*b->color.b + wt[2]*c->color.b;
+	f->color.a = wt[0]*a->color.a + wt[1]*b->color.a + wt[2]*c->color.a;
+    }
+    if (attribs & ATTR_TEX) {
+	f->s = wt[0]*a->s + wt[1]*b->s + wt[2]*c->s;
+	f->t = wt[0]*a->t + wt[1]*b->t + wt[2]*c->t;
+	f->w = wt[0]*a->w + wt[1]*b->w + wt[2]*c->w;
+    }
+    if (attribs & ATTR_SURF) {
+	f->surf.x = wt[0]*a->surf.x + wt[1]*b->surf.x + wt[2]*c->surf.x;
+	f->surf.y = wt[0]*a->surf.y + wt[1]*b->surf.y + wt[2]*c->surf.y;
+	f->surf.z = wt[0]*a->surf.z + wt[1]*b->surf.z + wt[2]*c->surf.z;
+    }
+    if (attribs & ATTR_NORM) {
+	f->n.x = wt[0]*a->n.x + wt[1]*b->n.x + wt[2]*c->n.x;
+	f->n.y = wt[0]*a->n.y + wt[1]*b->n.y + wt[2]*c->n.y;
+	f->n.z = wt[0]*a->n.z + wt[1]*b->n.z + wt[2]*c->n.z;
+    } else {
+	f->n = ts->sh.tri->normal;		/* FLATSHADE */
+    }
+    if (attribs & ATTR_EYE) {
+	f->eye.x = wt[0]*a->eye.x + wt[1]*b->eye.x + wt[2]*c->eye.x;
+	f->eye.y = wt[0]*a->eye.y + wt[1]*b->eye.y + wt[2]*c->eye.y;
+	f->eye.z = wt[0]*a->eye.z + wt[1]*b->eye.z + wt[2]*c->eye.z;
+    }
+    if (attribs & ATTR_LIT) {
+	f->lit.r = wt[0]*a->lit.r + wt[1]*b->lit.r + wt[2]*c->lit.r;
+	f->lit.g = wt[0]*a->lit.g + wt[1]*b->lit.g + wt[2]*c->lit.g;
+	f->lit.b = wt[0]*a->lit.b + wt[1]*b->lit.b + wt[2]*c->lit.b;
+	f->lit.a = wt[0]*a->lit.a + wt[1]*b->lit.a + wt[2]*c->lit.a;
+    }
+}
+
+/*
+ * rasterize a tiny triangle (see setup.c): every pixel center in its
+ * (at most TINY_TRI x TINY_TRI) bounding box is tested against the edge
+ * functions, with the same fill rule as above, and the covered ones get
+ * their depth and attributes from the vertices, weighted by the edge
+ * functions (the barycentric coordinates) - no slopes. Each row is
+ * depth tested and written as a span, with the coverage as its mask.
+ */
+void
+tiny_tri(TriSetup_t *ts, int usecfb)
+{
+    SetupVtx_t	*v0 = &(ts->p[0]), *v1 = &(ts->p[1]), *v2 = &(ts->p[2]);
+    edge_t	e[3];
+    Frag_t	f;
+    rgba_t	color[TINY_TRI];
+    float	wt[TINY_TRI][3], z[TINY_TRI], inv_area;
+    u8		mask[TINY_TRI];
+    int		minx, miny, maxx, maxy, x, y, i, k, w[3], o1 = 1, o2 = 2;
+    int		zbuf = Flagged(RPScene.flags, FLAG_ZBUFFER);
+
+	/* wind it so the inside is positive, keeping track of which vertex is which */
+    if (ts->r > 0.0) {
+	v1 = &(ts->p[2]);	v2 = &(ts->p[1]);
+	o1 = 2;			o2 = 1;
+    }
+    edge_setup(&(e[0]), v0, v1);	/* (0 at v2) */
+    edge_setup(&(e[1]), v1, v2);	/* (0 at v0) */
+    edge_setup(&(e[2]), v2, v0);	/* (0 at v1) */
+    inv_area = 1.0 / fabsf(ts->r);
+
+    minx = Max(Min3(v0->sx, v1->sx, v2->sx), ts->minx);
+    maxx = Min(Max3(v0->sx, v1->sx, v2->sx), ts->maxx);
+    miny = Max(v0->sy, ts->miny);	/* y-sorted */
+    maxy = Min(ts->p[2].sy, ts->maxy);
+
+    for (y=miny; y<=maxy; y++) {
+	for (x=minx, i=0; x<=maxx; x++, i++) {
+	    for (k=0; k<3; k++)
+		w[k] = e[k].A * x + e[k].B * y + e[k].C;
+	    mask[i] = ((w[0] | w[1] | w[2]) >= 0);
+	    if (!mask[i])
+		continue;
+
+		/* barycentric weights, from the edge functions without the fill rule bias */
+	    wt[i][0] = (float)(w[1] + e[1].bias) * inv_area;
+	    wt[i][o1] = (float)(w[2] + e[2].bias) * inv_area;
+	    wt[i][o2] = (float)(w[0] + e[0].bias) * inv_area;
+	    if (usecfb)
+		z[i] = wt[i][0]*ts->v[0].z + wt[i][1]*ts->v[1].z + wt[i][2]*ts->v[2].z;
+	    else	/* (the plane equation, like depth_span()) */
+		z[i] = v0->sz + (x - v0->sx)*ts->DxDz + (y - v0->sy)*ts->DyDz;
+
+	    ts->rasterized++;
+	    if (hiz_enabled)
+		hiz_mark(x, x, y);
+	}
+
+	if (!usecfb) {		/* write zbuffer only (depth.c) */
+	    RPTestPutDepthSpan(minx, maxx, y, z, mask);
+	    continue;
+	}
+	if (zbuf && RPTestPutDepthSpan(minx, maxx, y, z, mask) == 0)
+	    continue;
+
+	for (x=minx, i=0; x<=maxx; x++, i++) {
+	    if (!mask[i])
+		continue;
+
+	    f.z = z[i];
+	    tiny_frag(ts, &f, wt[i], ts->attribs);
+	    if (paint_deferred) {
+		deferred_write(ts, &f, x, y);
+	    } else {
+		shade_frag(ts, &f, x, y, &(color[i]));
+		ts->shaded++;
+	    }
+	}
+	if (!paint_deferred)
+	    RPPutColorSpan(minx, maxx, y, color, mask);
+    }
+}
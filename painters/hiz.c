@@ -0,0 +1,251 @@
+
+/*
+ * File:	hiz.c
+ *
+ * Hierarchical z (RENDER07).
+ *
+ * A pyramid of the farthest depth in each cell of the depth buffer:
+ * level 0 cells are HIZ_CELL x HIZ_CELL pixels, each level above has
+ * cells twice as big. A triangle (or an object's bounding sphere) whose
+ * nearest depth is behind the farthest depth of the cells under its
+ * screen bounds can't pass a single depth test, so it isn't rasterized.
+ *
+ * Depth only ever gets closer, so a cell's stored value is never too
+ * near; paint_span() marks the cells it wrote (and their parents) dirty,
+ * and a dirty cell is recomputed from the level below when it is
+ * next looked at.
+ *
+ * When binning (RENDER06) the threads only update and look at the levels
+ * inside one bin tile (cells up to BIN_TILE pixels).
+ *
+ */
+
+/*
+ *
+ * MIT License
+ *
+ * Copyright (c) 2018 Steve Anderson
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "rp.h"
+#include "paint.h"
+
+int		hiz_enabled = FALSE;
+int		hiz_tris_rejected = 0;
+int		hiz_objs_rejected = 0;
+
+static float	*hiz[HIZ_MAX_LEVELS];	/* farthest depth per cell */
+static u8	*hiz_dirty[HIZ_MAX_LEVELS];
+static int	hiz_w[HIZ_MAX_LEVELS], hiz_h[HIZ_MAX_LEVELS];
+static int	hiz_levels = 0;
+
+/* build the pyramid for a freshly cleared depth buffer */
+void
+hiz_init(void)
+{
+    int		i, l, w, h;
+
+    w = (RPScene.xres + HIZ_CELL - 1) / HIZ_CELL;
+    h = (RPScene.yres + HIZ_CELL - 1) / HIZ_CELL;
+
+    for (l=0; l<HIZ_MAX_LEVELS; l++) {
+	hiz_w[l] = w;
+	hiz_h[l] = h;
+	hiz[l] = (float *) malloc(w * h * sizeof(float));
+	hiz_dirty[l] = (u8 *) calloc(w * h, sizeof(u8));
+	for (i=0; i<w*h; i++)
+	    hiz[l][i] = MAX_ZVAL;
+
+	if (w == 1 && h == 1)
+	    break;
+	w = (w + 1) / 2;
+	h = (h + 1) / 2;
+    }
+    hiz_levels = Min(l + 1, HIZ_MAX_LEVELS);
+    hiz_tris_rejected = hiz_objs_rejected = 0;
+    hiz_enabled = TRUE;
+}
+
+void
+hiz_cleanup(void)
+{
+    int		l;
+
+    for (l=0; l<hiz_levels; l++) {
+	free(hiz[l]);
+	free(hiz_dirty[l]);
+    }
+    hiz_levels = 0;
+    hiz_enabled = FALSE;
+}
+
+/* the highest level the current pass may touch */
+static int
+hiz_top(void)
+{
+    int		l, top = 0;
+
+    if (!paint_binned)
+	return (hiz_levels - 1);
+
+    for (l=0; (HIZ_CELL << l) <= BIN_TILE && l < hiz_levels; l++)
+	top = l;
+    return (top);
+}
+
+/* depth was written to pixels x0..x1 of row y */
+void
+hiz_mark(int x0, int x1, int y)
+{
+    int		cx, cy, l, top = hiz_top(), lx0, lx1;
+    u8		*d;
+
+    x0 /= HIZ_CELL;	x1 /= HIZ_CELL;	cy = y / HIZ_CELL;
+
+    for (l=0; l<=top; l++) {
+	lx0 = x0 >> l;	lx1 = x1 >> l;
+	d = &(hiz_dirty[l][(cy >> l) * hiz_w[l]]);
+	for (cx=lx0; cx<=lx1; cx++)
+	    d[cx] = TRUE;
+    }
+}
+
+/* the farthest depth in cell cx,cy of level l, recomputed if dirty */
+static float
+hiz_cell(int l, int cx, int cy)
+{
+    float	zmax, *zrow;
+    int		x, y, x0, y0, x1, y1;
+
+    if (!hiz_dirty[l][cy * hiz_w[l]+ cx])
+	return (hiz[l][cy * hiz_w[l] + cx]);
+
+    zmax = 0.0;
+    if (l == 0) {
+	x0 = cx * HIZ_CELL;	x1 = Min(x0 + HIZ_CELL, RPScene.xres);
+	y0 = cy * HIZ_CELL;	y1 = Min(y0 + HIZ_CELL, RPScene.yres);
+	for (y=y0; y<y1; y++) {
+	    zrow = &(RPDepthFrameBuffer[y][0]);
+	    for (x=x0; x<x1; x++)
+		zmax = Max(zmax, zrow[x]);
+	}
+    } else {
+	x1 = Min(2*cx + 2, hiz_w[l-1]);
+	y1 = Min(2*cy + 2, hiz_h[l-1]);
+	for (y=2*cy; y<y1; y++)
+	    for (x=2*cx; x<x1; x++)
+		zmax = Max(zmax, hiz_cell(l-1, x, y));
+    }
+
+    hiz[l][cy * hiz_w[l] + cx] = zmax;
+    hiz_dirty[l][cy * hiz_w[l] + cx] = FALSE;
+    return (zmax);
+}
+
+/* TRUE if nothing at depth z or farther can show inside the screen box */
+static int
+hiz_hidden(int minx, int miny, int maxx, int maxy, float z)
+{
+    int		l, top = hiz_top(), cx, cy, x0, x1, y0, y1;
+
+    x0 = minx / HIZ_CELL;	x1 = maxx / HIZ_CELL;
+    y0 = miny / HIZ_CELL;	y1 = maxy / HIZ_CELL;
+
+	/* the lowest level where the box is at most 2x2 cells */
+    for (l=0; l<top && ((x1 >> l) - (x0 >> l) > 1 || (y1 >> l) - (y0 >> l) > 1); l++)
+	;
+
+    for (cy = y0 >> l; cy <= (y1 >> l); cy++)
+	for (cx = x0 >> l; cx <= (x1 >> l); cx++)
+	    if (z < hiz_cell(l, cx, cy))
+		return (FALSE);
+
+    return (TRUE);
+}
+
+/* TRUE if the triangle is behind everything drawn so far */
+int
+hiz_tri_hidden(TriSetup_t *ts)
+{
+    SetupVtx_t	*p = ts->p;
+    int		minx, miny, maxx, maxy;
+    float	zmin;
+
+    minx = Max(Min3(p[0].sx, p[1].sx, p[2].sx), ts->minx);
+    maxx = Min(Max3(p[0].sx, p[1].sx, p[2].sx), ts->maxx);
+    miny = Max(p[0].sy, ts->miny);	/* y-sorted */
+    maxy = Min(p[2].sy, ts->maxy);
+    if (minx > maxx || miny > maxy)
+	return (FALSE);		/* nothing on screen, let the rasterizer see */
+
+	/* spans can reach a pixel past the edges, allow for that much slope */
+    zmin = Min3(p[0].sz, p[1].sz, p[2].sz) - fabsf(ts->DxDz) - fabsf(ts->DyDz);
+
+    return (hiz_hidden(minx, miny, maxx, maxy, zmin));
+}
+
+/* TRUE if the object's bounding sphere is behind everything drawn so far */
+int
+hiz_object_hidden(Object_t *op)
+{
+    Sphere_t	*sp = op->sphere;
+    Vtx_t	corners[8];
+    int		i, minx, miny, maxx, maxy;
+    float	zmin;
+
+    if (sp == (Sphere_t *) NULL)
+	return (FALSE);
+
+	/* eye space, looking down -z: give up if it reaches the near plane */
+    if (sp->center.z + sp->radius > -RPScene.hither)
+	return (FALSE);
+
+	/* project the corners of the sphere's bounding cube */
+    for (i=0; i<8; i++) {
+	corners[i].pos.x = sp->center.x + ((i & 0x1) ? sp->radius : -sp->radius);
+	corners[i].pos.y = sp->center.y + ((i & 0x2) ? sp->radius : -sp->radius);
+	corners[i].pos.z = sp->center.z + ((i & 0x4) ? sp->radius : -sp->radius);
+	corners[i].w = 1.0;
+    }
+    RPProjectAllVertices(8, corners);
+
+    minx = maxx = corners[0].sx;
+    miny = maxy = corners[0].sy;
+    zmin = corners[0].sz;
+    for (i=1; i<8; i++) {
+	minx = Min(minx, corners[i].sx);	maxx = Max(maxx, corners[i].sx);
+	miny = Min(miny, corners[i].sy);	maxy = Max(maxy, corners[i].sy);
+	zmin = Min(zmin, corners[i].sz);
+    }
+
+    minx = Max(minx, 0);	maxx = Min(maxx, RPScene.xres-1);
+    miny = Max(miny, 0);	maxy = Min(maxy, RPScene.yres-1);
+    if (minx > maxx || miny > maxy)
+	return (FALSE);		/* off screen, clipping will deal with it */
+
+	/* sz is rounded, back off a unit */
+    return (hiz_hidden(minx, miny, maxx, maxy, zmin - 1.0));
+}
@@ -0,0 +1,385 @@
+
+/*
+ * File:	impostor.c
+ *
+ * Implicit spheres, painted as screen space impostors instead of
+ * the polygonal sphere librp would otherwise make for us.
+ *
+ * A sphere is drawn by visiting the screen rectangle its silhouette
+ * projects to (the lines from the eye tangent to it, in x and y), and
+ * intersecting the ray through each pixel with the sphere: the nearest
+ * hit gives the exact depth, surface point and normal, so the silhouette
+ * and the depth buffer are as exact as the pixel grid allows.
+ *
+ * The pixel's ray direction, and the depth for an eye space z, come from
+ * the projection librp uses for the vertices (worked out once per scene
+ * in impostor_init()), so spheres and polygons z-buffer against each
+ * other correctly. Texture coordinates are the spherical mapping moray
+ * uses for its spheres.
+ *
+ */
+
+/*
+ *
+ * MIT License
+ *
+ * Copyright (c) 2018 Steve Anderson
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <string.h>
+
+#include "rp.h"
+#include "paint.h"
+
+int	spheres_drawn = 0;
+
+	/* screen x = ax * u + bx for the eye space direction (u, v, -1),
+	 * screen y = ay * v + by, and the projected depth for an eye space z
+	 * is alpha + beta / z (before the viewport mapping):
+	 */
+static float	ax, bx, ay, by, alpha, beta;
+
+static Tri_t	sphere_tri;	/* stands in for a triangle, material 0 */
+
+/* the screen position of an eye space point, as RPProjectAllVertices() works it out */
+static void
+project_point(float x, float y, float z, float *fx, float *fy, float *tz)
+{
+    Vtx_t	v;
+
+    memset(&v, 0, sizeof(Vtx_t));
+    v.pos.x = x;
+    v.pos.y = y;
+    v.pos.z = z;
+    v.w = 1.0;
+    RPProjectAllVertices(1, &v);
+
+    *fx = v.proj.x * v.inv_w *  RPScene.viewport->sx + RPScene.viewport->tx;
+    *fy = v.proj.y * v.inv_w * -RPScene.viewport->sy + RPScene.viewport->ty;
+    *tz = v.proj.z * v.inv_w;
+}
+
+/* work out the pixel to eye ray mapping and the depth function from the projection */
+void
+impostor_init(void)
+{
+    float	fx0, fy0, fx1, fy1, tz1, tz2, tmp;
+
+    project_point(0.0, 0.0, -1.0, &fx0, &fy0, &tz1);
+    project_point(1.0, 1.0, -1.0, &fx1, &fy1, &tmp);
+    project_point(0.0, 0.0, -2.0, &tmp, &tmp, &tz2);
+
+    ax = fx1 - fx0;	bx = fx0;
+    ay = fy1 - fy0;	by = fy0;
+
+    beta = 2.0 * (tz2 - tz1);
+    alpha = tz1 + beta;
+
+    memset(&sphere_tri, 0, sizeof(Tri_t));
+    sphere_tri.material_id = 0;
+    spheres_drawn = 0;
+}
+
+/*
+ * the eye space point at screen position fx,fy on triangle tri's plane
+ * (for shadow lookups: the depth buffer is too coarse to get it from)
+ * or, if the plane is edge on, at depth z
+ */
+void
+screen_to_eye(float fx, float fy, float z, Tri_t *tri, xyz_t *P)
+{
+    xyz_t	d;
+    float	den;
+
+    d.x = (fx - bx) / ax;
+    d.y = (fy - by) / ay;
+    d.z = -1.0;
+
+    den = vector_dot(tri->pN, d);
+    if (!NearlyZero(den, Epsilon))
+	vector_scale(P, &d, tri->d / den);
+    else
+	vector_scale(P, &d, -beta / ((z - RPScene.viewport->tz) / RPScene.viewport->sz - alpha));
+}
+
+/*
+ * one axis of the bounds of a sphere: the slopes (u = a / -z) of the two
+ * lines through the eye that are tangent to the circle of radius r at (a, zc)
+ */
+static void
+sphere_slopes(float a, float zc, float r, float *umin, float *umax)
+{
+    float	q, den;
+
+    q = r * sqrtf(Sqr(a) + Sqr(zc) - Sqr(r));
+    den = Sqr(zc) - Sqr(r);
+
+    *umin = (a * zc - q) / den;
+    *umax = (a * zc + q) / den;
+}
+
+/* the nearest visible hit of the ray through screen position fx,fy, FALSE if none */
+static int
+sphere_hit(Sphere_t *sp, float fx, float fy, xyz_t *P, float *z)
+{
+    xyz_t	d;
+    float	a, hb, cc, disc, t;
+
+    d.x = (fx - bx) / ax;
+    d.y = (fy - by) / ay;
+    d.z = -1.0;
+
+    a = vector_dot(d, d);
+    hb = vector_dot(d, sp->center);
+    cc = vector_dot(sp->center, sp->center) - Sqr(sp->radius);
+    disc = Sqr(hb) - a * cc;
+    if (disc < 0.0)
+	return (FALSE);
+
+    t = (hb - sqrtf(disc)) / a;		/* d.z = -1, so t is the distance in z */
+    if (t < RPScene.hither || t > RPScene.yon)
+	return (FALSE);			/* clipped by the near or far plane */
+
+    P->x = t * d.x;
+    P->y = t * d.y;
+    P->z = -t;
+
+    *z = (alpha + beta / P->z) * RPScene.viewport->sz + RPScene.viewport->tz + 0.5;
+    return (TRUE);
+}
+
+/* the surface attributes of a hit point */
+static void
+sphere_frag(Sphere_t *sp, xyz_t *P, float z, Frag_t *f)
+{
+    float	inv_r = 1.0 / sp->radius;
+
+    f->z = z;
+    f->surf = *P;
+    f->n.x = (P->x - sp->center.x) * inv_r;
+    f->n.y = (P->y - sp->center.y) * inv_r;
+    f->n.z = (P->z - sp->center.z) * inv_r;
+    f->eye.x = -P->x;
+    f->eye.y = -P->y;
+    f->eye.z = -P->z;
+    vector_normalize(&(f->eye));
+
+    f->s = 0.5 + (atan2f(f->n.z, -f->n.x) / (2.0 * Pi));
+    f->t = 0.5 + (asinf(Max(-1.0, Min(1.0, f->n.y))) / Pi);
+    f->w = 1.0;
+}
+
+/* the screen rectangle a sphere covers, FALSE if it's off screen or behind us */
+static int
+sphere_bounds(Sphere_t *sp, TriSetup_t *ts)
+{
+    float	zc, umin, umax, vmin, vmax, x0, x1, y0, y1;
+
+    zc = -sp->center.z;		/* distance in front of the eye, looking down -z */
+
+    if (zc + sp->radius <= RPScene.hither)
+	return (FALSE);		/* all in front of the near plane */
+
+    if (zc - sp->radius > Epsilon) {
+	sphere_slopes(sp->center.x, zc, sp->radius, &umin, &umax);
+	sphere_slopes(sp->center.y, zc, sp->radius, &vmin, &vmax);
+
+	x0 = ax * umin + bx;	x1 = ax * umax + bx;
+	y0 = ay * vmin + by;	y1 = ay * vmax + by;
+
+	    /* (+ a pixel to be safe) */
+	ts->minx = Max(ts->minx, (int) floorf(Min(x0, x1)) - 1);
+	ts->maxx = Min(ts->maxx, (int) ceilf(Max(x0, x1)) + 1);
+	ts->miny = Max(ts->miny, (int) floorf(Min(y0, y1)) - 1);
+	ts->maxy = Min(ts->maxy, (int) ceilf(Max(y0, y1)) + 1);
+    }
+	/* else the eye is in (or touching) the sphere's slab, it could be anywhere */
+
+    return (ts->minx <= ts->maxx && ts->miny <= ts->maxy);
+}
+
+/* shade a hit into pixel, or keep it in the G-buffer */
+static void
+sphere_shade(TriSetup_t *ts, Frag_t *f, int x, int y, rgba_t *pixel)
+{
+    Colorf_t	color;
+
+    if (paint_deferred) {
+	f->color = ts->polycolor;	/* (for VERTSHADE, spheres have no vertex colors) */
+	deferred_write(ts, f, x, y);
+	return;
+    }
+    color = ts->polycolor;
+    shade_color(&(ts->sh), f, x, y, &color);
+    pixel->r = (u8) Clamp0255(color.r * MAX_COLOR_VAL);
+    pixel->g = (u8) Clamp0255(color.g * MAX_COLOR_VAL);
+    pixel->b = (u8) Clamp0255(color.b * MAX_COLOR_VAL);
+    pixel->a = (u8) Clamp0255(color.a * MAX_COLOR_VAL);
+}
+
+/* multisampled: coverage and depth per sample, shaded once; TRUE if it wrote */
+static int
+sphere_msaa_pixel(TriSetup_t *ts, Sphere_t *sp, int x, int y)
+{
+    xyz_t	P[MSAA_MAX_SAMPLES];
+    float	z[MSAA_MAX_SAMPLES], ox, oy, zc;
+    unsigned int covered = 0x0, pass;
+    Frag_t	f;
+    Colorf_t	color;
+    xyz_t	Pc;
+    int		i, first = -1;
+
+    for (i=0; i<msaa_samples; i++) {
+	msaa_sample_pos(i, &ox, &oy);
+	if (sphere_hit(sp, x + ox, y + oy, &(P[i]), &(z[i]))) {
+	    covered |= (0x1 << i);
+	    if (first < 0)
+		first = i;
+	}
+    }
+    if (covered == 0x0)
+	return (FALSE);
+    ts->rasterized++;
+
+    pass = msaa_test(x, y, covered, z);
+    if (pass == 0x0)
+	return (FALSE);
+
+	/* shade at the pixel center, or at a sample if the center misses */
+    if (sphere_hit(sp, x, y, &Pc, &zc))
+	sphere_frag(sp, &Pc, zc, &f);
+    else
+	sphere_frag(sp, &(P[first]), z[first], &f);
+
+    color = ts->polycolor;
+    shade_color(&(ts->sh), &f, x, y, &color);
+    ts->shaded++;
+    msaa_put(x, y, pass, z, &color);
+    return (TRUE);
+}
+
+/*
+ * set up an implicit sphere object to paint, FALSE if it's off screen:
+ * its shading state, and in minx..maxy the screen rectangle it covers
+ */
+int
+sphere_setup(Object_t *op, TriSetup_t *ts)
+{
+    Material_t	*m = &(op->materials[0]);
+
+    memset(ts, 0, sizeof(TriSetup_t));
+    ts->sh.op = op;
+    ts->sh.tri = &sphere_tri;
+    ts->sh.m = m;
+    ts->polycolor = m->color;
+    ts->defer_id = -1;
+    ts->variant = span_variant(op, m);
+    ts->attribs = SpanAttribs(ts->variant);
+    if (SpanPerPixel(ts->variant))
+	shade_setup(&(ts->sh));
+    if (Flagged(op->flags, FLAG_RANDSHADE)) {
+	ts->polycolor.r = RPRandom();
+	ts->polycolor.g = RPRandom();
+	ts->polycolor.b = RPRandom();
+	ts->polycolor.a = 1.0;
+    }
+
+	/* the pixels it may write: the screen, then the sphere's bounds */
+    ts->minx = Max(RPScene.scissor_box->ulx, 0);
+    ts->miny = Max(RPScene.scissor_box->uly, 0);
+    ts->maxx = Min(RPScene.scissor_box->lrx, RPScene.xres-1);
+    ts->maxy = Min(RPScene.scissor_box->lry, RPScene.yres-1);
+    return (sphere_bounds(op->sphere, ts));
+}
+
+/*
+ * paint a sphere set up by sphere_setup(), in the pixels minx..maxx,
+ * miny..maxy (its rectangle, or the part of it in a RENDER06 tile)
+ */
+void
+sphere_draw(TriSetup_t *ts)
+{
+    Sphere_t	*sp = ts->sh.op->sphere;
+    Frag_t	f;
+    xyz_t	P[MAX_XRES];
+    rgba_t	color[MAX_XRES];
+    float	z[MAX_XRES];
+    u8		mask[MAX_XRES];
+    int		x, y, i, wx0, wx1;
+
+    for (y=ts->miny; y<=ts->maxy; y++) {
+	wx0 = ts->maxx + 1;
+	wx1 = ts->minx - 1;
+
+	if (msaa_samples > 0) {
+	    for (x=ts->minx; x<=ts->maxx; x++) {
+		if (!sphere_msaa_pixel(ts, sp, x, y))
+		    continue;
+		wx0 = Min(wx0, x);
+		wx1 = Max(wx1, x);
+	    }
+	} else {
+		/* the row's hits, depth tested together, then shaded */
+	    for (x=ts->minx, i=0; x<=ts->maxx; x++, i++) {
+		mask[i] = sphere_hit(sp, x, y, &(P[i]), &(z[i]));
+		ts->rasterized += mask[i];
+	    }
+	    if (Flagged(RPScene.flags, FLAG_ZBUFFER))
+		RPTestPutDepthSpan(ts->minx, ts->maxx, y, z, mask);
+
+	    for (x=ts->minx, i=0; x<=ts->maxx; x++, i++) {
+		if (!mask[i])
+		    continue;
+		sphere_frag(sp, &(P[i]), z[i], &f);
+		sphere_shade(ts, &f, x, y, &(color[i]));
+		ts->shaded++;
+
+		wx0 = Min(wx0, x);
+		wx1 = Max(wx1, x);
+	    }
+	    if (!paint_deferred)
+		RPPutColorSpan(ts->minx, ts->maxx, y, color, mask);
+	}
+
+	if (hiz_enabled && wx0 <= wx1)
+	    hiz_mark(wx0, wx1, y);
+    }
+}
+
+/* paint an implicit sphere object */
+void
+paint_sphere(Object_t *op)
+{
+    TriSetup_t	ts;
+
+    if (!sphere_setup(op, &ts))
+	return;
+    lights_tri((TriLights_t *) NULL, &ts);
+    sphere_draw(&ts);
+
+    frags_rasterized += ts.rasterized;
+    frags_shaded += ts.shaded;
+    spheres_drawn++;
+}
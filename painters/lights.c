@@ -0,0 +1,513 @@
+
+/*
+ * File:	lights.c
+ *
+ * Tiled light culling.
+ *
+ * The screen is split into LIGHT_TILE x LIGHT_TILE pixel tiles, and each
+ * tile gets its own list of the lights that can reach something in it,
+ * already gathered into the SHADE_LANES wide streams shade_pixel() loops
+ * over. A light's bounds are a sphere of its range (spot lights with a
+ * range) and a cone (spot lights); point lights have no bounds and are
+ * in every tile. A tile's bounds are the box around the eye space
+ * positions it shades, which are only known once the G-buffer is full
+ * (RENDER05); while drawing, all tiles share the lights that reach the
+ * view frustum.
+ *
+ * Without the G-buffer, each triangle culls the lights again for every
+ * tile it shades, the first time it shades a pixel there (lights_tri()).
+ * The shaded positions are interpolated linearly in screen space, so
+ * the ones in the tile lie in the box around their values at the corners
+ * of the part of the tile the triangle covers, and (inside the triangle)
+ * in the box around its vertices. A sphere uses the box around it.
+ *
+ */
+
+/*
+ *
+ * MIT License
+ *
+ * Copyright (c) 2018 Steve Anderson
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "rp.h"
+#include "paint.h"
+
+Colorf_t	lights_ambient;		/* the sum of all the light colors */
+int		light_tiles_x = 0, light_tiles_y = 0;
+int		lights_tile_max = 0;	/* the most lights in one tile */
+double		lights_tile_avg = 0.0;
+double		lights_usec = 0.0;	/* time spent culling */
+long		lights_tri_sets = 0;	/* forward: triangle x tile light lists culled */
+long		lights_tri_total = 0;	/* and the lights in them */
+int		lights_tri_max = 0;
+
+typedef struct {	/* a light, in eye space */
+    xyz_t	pos;
+    xyz_t	dir;		/* spot direction */
+    Colorf_t	color;		/* times its value */
+    float	range;		/* 0.0 if it has none */
+    float	cos_out, sin_out;	/* spot cone (cos_out is -1.0 if it has none) */
+    float	spot_scale, spot_bias;	/* spot falloff, a ramp in the cosine */
+    int		shadow;		/* shadow map number + 1 (0 if it has none) */
+} TileLight_t;
+
+static TileLight_t	*lights = (TileLight_t *) NULL;
+static ShadeLights_t	*tiles = (ShadeLights_t *) NULL;
+static int		*counts = (int *) NULL;	/* lights per tile */
+static float		*pool = (float *) NULL;
+static int		pool_size = 0;
+static float		tanfov;	/* (of half the field of view) */
+static int		bounded = FALSE;	/* TRUE if any light has a range or a cone */
+static TriLights_t	main_lights;	/* lights_tri() for the main thread */
+
+/* set up one scene light for the shading and the tile tests */
+static void
+lights_setup(TileLight_t *tl, Light_t *lp, int i)
+{
+    float	half, cos_in;
+
+    tl->pos = lp->pos;
+    tl->color.r = lp->color.r * lp->value;
+    tl->color.g = lp->color.g * lp->value;
+    tl->color.b = lp->color.b * lp->value;
+    tl->color.a = lp->color.a * lp->value;
+    tl->range = 0.0;
+    tl->dir.x = 0.0; tl->dir.y = 0.0; tl->dir.z = 0.0;
+    tl->cos_out = -1.0; tl->sin_out = 0.0;
+    tl->spot_scale = 0.0; tl->spot_bias = 1.0;
+    tl->shadow = shadow_index(i);
+
+    if (lp->type != SPOT_LIGHT)
+	return;
+
+    tl->range = Max(lp->range, 0.0);
+    if (lp->fov <= 0.0 || lp->fov >= 360.0)
+	return;
+
+	/* fully lit inside focus x the cone angle, falling off to 0 at its edge */
+    vector_sub(&(tl->dir), &(lp->coi), &(lp->pos));
+    vector_normalize(&(tl->dir));
+    half = 0.5 * lp->fov * DegToRad;
+    tl->cos_out = cosf(half);
+    tl->sin_out = sinf(half);
+    cos_in = cosf(half * Clamp0x(lp->focus, 1.0));
+    tl->spot_scale = 1.0 / Max(cos_in - tl->cos_out, Epsilon);
+    tl->spot_bias = -tl->cos_out * tl->spot_scale;
+}
+
+/* the view frustum, between the near and far planes, as a box in eye space */
+static void
+lights_frustum_box(xyz_t *bmin, xyz_t *bmax)
+{
+    float	u, v;
+
+    u = RPScene.camera->aspect * tanfov * 1.01;		/* (+ a bit to be safe) */
+    v = tanfov * 1.01;
+    bmin->x = -u * RPScene.yon;		bmax->x = u * RPScene.yon;
+    bmin->y = -v * RPScene.yon;		bmax->y = v * RPScene.yon;
+    bmin->z = -RPScene.yon;		bmax->z = -RPScene.hither;
+}
+
+/* can light tl reach anything in the box? */
+static int
+lights_touch(TileLight_t *tl, xyz_t *bmin, xyz_t *bmax)
+{
+    xyz_t	c, V;
+    float	d2, r, v1, dist;
+
+    if (tl->range > 0.0) {	/* the range sphere against the box */
+	d2 = 0.0;
+	if (tl->pos.x < bmin->x) d2 += Sqr(bmin->x - tl->pos.x);
+	if (tl->pos.x > bmax->x) d2 += Sqr(tl->pos.x - bmax->x);
+	if (tl->pos.y < bmin->y) d2 += Sqr(bmin->y - tl->pos.y);
+	if (tl->pos.y > bmax->y) d2 += Sqr(tl->pos.y - bmax->y);
+	if (tl->pos.z < bmin->z) d2 += Sqr(bmin->z - tl->pos.z);
+	if (tl->pos.z > bmax->z) d2 += Sqr(tl->pos.z - bmax->z);
+	if (d2 > Sqr(tl->range))
+	    return (FALSE);
+    }
+
+    if (tl->cos_out > 0.0) {	/* the cone (narrower than a half space) against the box's sphere */
+	c.x = 0.5 * (bmin->x + bmax->x);
+	c.y = 0.5 * (bmin->y + bmax->y);
+	c.z = 0.5 * (bmin->z + bmax->z);
+	r = 0.5 * sqrtf(Sqr(bmax->x - bmin->x) + Sqr(bmax->y - bmin->y) + Sqr(bmax->z - bmin->z));
+
+	vector_sub(&V, &c, &(tl->pos));
+	v1 = vector_dot(V, tl->dir);
+	dist = tl->cos_out * sqrtf(Max(vector_dot(V, V) - Sqr(v1), 0.0)) - v1 * tl->sin_out;
+	if (dist > r)
+	    return (FALSE);
+    }
+    return (TRUE);
+}
+
+/* copy light tl into lane i of a set of n */
+static void
+lights_put(ShadeLights_t *sl, int i, TileLight_t *tl)
+{
+    sl->x[i] = tl->pos.x;
+    sl->y[i] = tl->pos.y;
+    sl->z[i] = tl->pos.z;
+    sl->r[i] = tl->color.r;
+    sl->g[i] = tl->color.g;
+    sl->b[i] = tl->color.b;
+    sl->a[i] = tl->color.a;
+    sl->dx[i] = tl->dir.x;
+    sl->dy[i] = tl->dir.y;
+    sl->dz[i] = tl->dir.z;
+    sl->spot_scale[i] = tl->spot_scale;
+    sl->spot_bias[i] = tl->spot_bias;
+    sl->inv_range[i] = (tl->range > 0.0) ? 1.0 / tl->range : 0.0;
+    sl->shadow[i] = (float) tl->shadow;
+    if (tl->range > 0.0 || tl->spot_scale != 0.0)
+	sl->falloffs = TRUE;
+    if (tl->shadow > 0)
+	sl->shadows = TRUE;
+}
+
+/* point set sl at n lanes of the pool, from p on */
+static float *
+lights_streams(ShadeLights_t *sl, float *p, int n)
+{
+    sl->count = n;
+    sl->falloffs = FALSE;
+    sl->shadows = FALSE;
+    sl->x = p;		sl->y = p + n;		sl->z = p + 2*n;
+    sl->r = p + 3*n;	sl->g = p + 4*n;	sl->b = p + 5*n;	sl->a = p + 6*n;
+    sl->dx = p + 7*n;	sl->dy = p + 8*n;	sl->dz = p + 9*n;
+    sl->spot_scale = p + 10*n;	sl->spot_bias = p + 11*n;	sl->inv_range = p + 12*n;
+    sl->shadow = p + 13*n;
+    return (p + n * LS_COUNT);
+}
+
+/*
+ * (re)build the tile lists, for tiles whose shaded points lie inside the
+ * boxes bmin[t] to bmax[t] (eye space, empty if bmin[t].x > bmax[t].x).
+ * If they are NULL (while drawing, before anything is known about the
+ * tiles) every tile gets the lights that reach the view frustum: the
+ * attributes are interpolated linearly in screen space, so a pixel's
+ * shaded position isn't necessarily inside its own tile's slice of it.
+ */
+void
+lights_cull(xyz_t *bmin, xyz_t *bmax)
+{
+    xyz_t		fmin, fmax, *b0, *b1;
+    double		start = paint_usec();
+    long		total = 0;
+    float		*p;
+    int			t, i, n, size, ntiles = light_tiles_x * light_tiles_y;
+    int			shared = (bmin == (xyz_t *) NULL);
+
+	/* (without clipping, the triangles may be anywhere) */
+    lights_frustum_box(&fmin, &fmax);
+    if (shared && Flagged(RPScene.generic_flags, FLAG_RENDER_01)) {
+	fmin.x = fmin.y = fmin.z = -REALLY_BIG_FLOAT;
+	fmax.x = fmax.y = fmax.z = REALLY_BIG_FLOAT;
+    }
+
+	/* count each tile's lights, then gather them */
+    lights_tile_max = 0;
+    for (t=0; t<ntiles; t++) {
+	counts[t] = 0;
+	if (shared && t > 0) {
+	    counts[t] = counts[0];
+	} else {
+	    b0 = shared ? &fmin : &(bmin[t]);
+	    b1 = shared ? &fmax : &(bmax[t]);
+	    if (b0->x > b1->x)
+		continue;
+	    for (i=0; i<RPScene.light_count; i++)
+		counts[t] += lights_touch(&(lights[i]), b0, b1);
+	}
+	total += counts[t];
+	lights_tile_max = Max(lights_tile_max, counts[t]);
+    }
+
+    for (t=0, size=0; t<(shared ? 1 : ntiles); t++)
+	size += (counts[t] + SHADE_LANES-1) / SHADE_LANES * SHADE_LANES * LS_COUNT;
+    if (size > pool_size) {
+	free(pool);
+	pool_size = size;
+	pool = (float *) malloc(pool_size * sizeof(float));
+    }
+    if (size > 0)
+	memset(pool, 0, size * sizeof(float));	/* (black padding lanes) */
+
+    for (t=0, p=pool; t<ntiles; t++) {
+	if (shared && t > 0) {
+	    tiles[t] = tiles[0];
+	    continue;
+	}
+	p = lights_streams(&(tiles[t]), p, (counts[t] + SHADE_LANES-1) / SHADE_LANES * SHADE_LANES);
+	if (counts[t] == 0)
+	    continue;
+	b0 = shared ? &fmin : &(bmin[t]);
+	b1 = shared ? &fmax : &(bmax[t]);
+	for (i=0, n=0; i<RPScene.light_count; i++)
+	    if (lights_touch(&(lights[i]), b0, b1))
+		lights_put(&(tiles[t]), n++, &(lights[i]));
+    }
+
+    lights_tile_avg = (double) total / (double) ntiles;
+    lights_usec += paint_usec() - start;
+}
+
+/* with -v, print the number of lights in each tile, a row of tiles per line */
+void
+lights_report(char *name)
+{
+    int		t;
+
+    if (!Flagged(RPScene.flags, FLAG_VERBOSE) || counts == (int *) NULL)
+	return;
+
+    fprintf(stderr,"%s : lights per %dx%d tile:\n", name, LIGHT_TILE, LIGHT_TILE);
+    for (t=0; t<light_tiles_x * light_tiles_y; t++) {
+	if (t % light_tiles_x == 0)
+	    fprintf(stderr,"%s :", name);
+	fprintf(stderr,"%4d", counts[t]);
+	if (t % light_tiles_x == light_tiles_x-1)
+	    fprintf(stderr,"\n");
+    }
+}
+
+/* set up the (eye space) lights and the tiles, once the scene is transformed */
+void
+lights_init(void)
+{
+    Light_t	*lp;
+    int		i;
+
+    tanfov = tanf(RPScene.camera->fovr/2.0);
+    light_tiles_x = (RPScene.xres + LIGHT_TILE-1) / LIGHT_TILE;
+    light_tiles_y = (RPScene.yres + LIGHT_TILE-1) / LIGHT_TILE;
+    tiles = (ShadeLights_t *) calloc(light_tiles_x * light_tiles_y, sizeof(ShadeLights_t));
+    counts = (int *) calloc(light_tiles_x * light_tiles_y, sizeof(int));
+    lights = (TileLight_t *) calloc(Max(RPScene.light_count, 1), sizeof(TileLight_t));
+
+    lights_ambient.r = 0.0; lights_ambient.g = 0.0;
+    lights_ambient.b = 0.0; lights_ambient.a = 0.0;
+    for (i=0; i<RPScene.light_count; i++) {
+	lp = RPScene.light_list[i];
+	lights_setup(&(lights[i]), lp, i);
+	lights_ambient.r += lights[i].color.r;
+	lights_ambient.g += lights[i].color.g;
+	lights_ambient.b += lights[i].color.b;
+	lights_ambient.a += lights[i].color.a;
+    }
+
+    bounded = FALSE;
+    for (i=0; i<RPScene.light_count; i++)
+	bounded |= (lights[i].range > 0.0 || lights[i].cos_out > 0.0);
+
+    memset(&main_lights, 0, sizeof(TriLights_t));
+    lights_tri_sets = lights_tri_total = 0;
+    lights_tri_max = 0;
+    lights_usec = 0.0;
+    lights_cull((xyz_t *) NULL, (xyz_t *) NULL);
+}
+
+/* the lights that can reach pixel x,y */
+ShadeLights_t *
+lights_at(int x, int y)
+{
+    return (&(tiles[(y / LIGHT_TILE) * light_tiles_x + x / LIGHT_TILE]));
+}
+
+/*
+ * get ready to cull the lights for triangle (or sphere) ts, as it's drawn
+ * with tl's lists (NULL: the main thread's). They're only worth it for
+ * lights with bounds, shaded per pixel as the triangle is drawn.
+ */
+void
+lights_tri(TriLights_t *tl, TriSetup_t *ts)
+{
+    Object_t	*op = ts->sh.op;
+    Sphere_t	*sp;
+    Vtx_t	*p0, *p1, *p2;
+
+    if (tl == (TriLights_t *) NULL)
+	tl = &main_lights;
+    ts->sh.lights = (TriLights_t *) NULL;
+    if (!bounded || paint_deferred || !SpanPerPixel(ts->variant))
+	return;
+
+    if (tl->sets == (ShadeLights_t *) NULL) {
+	tl->sets = (ShadeLights_t *) calloc(light_tiles_x * light_tiles_y, sizeof(ShadeLights_t));
+	tl->stamp = (int *) calloc(light_tiles_x * light_tiles_y, sizeof(int));
+    }
+    tl->current++;	/* (every tile's list is stale) */
+    tl->pool_used = 0;
+
+    if (op->type == OBJ_TYPE_SPHERE) {
+	sp = op->sphere;
+	tl->bmin.x = sp->center.x - sp->radius;	tl->bmax.x = sp->center.x + sp->radius;
+	tl->bmin.y = sp->center.y - sp->radius;	tl->bmax.y = sp->center.y + sp->radius;
+	tl->bmin.z = sp->center.z - sp->radius;	tl->bmax.z = sp->center.z + sp->radius;
+	tl->linear = FALSE;
+	tl->minx = ts->minx;	tl->maxx = ts->maxx;
+	tl->miny = ts->miny;	tl->maxy = ts->maxy;
+    } else {
+	p0 = &(op->verts[ts->sh.tri->v0]);
+	p1 = &(op->verts[ts->sh.tri->v1]);
+	p2 = &(op->verts[ts->sh.tri->v2]);
+	tl->bmin.x = Min3(p0->pos.x, p1->pos.x, p2->pos.x);
+	tl->bmin.y = Min3(p0->pos.y, p1->pos.y, p2->pos.y);
+	tl->bmin.z = Min3(p0->pos.z, p1->pos.z, p2->pos.z);
+	tl->bmax.x = Max3(p0->pos.x, p1->pos.x, p2->pos.x);
+	tl->bmax.y = Max3(p0->pos.y, p1->pos.y, p2->pos.y);
+	tl->bmax.z = Max3(p0->pos.z, p1->pos.z, p2->pos.z);
+
+	    /* (tiny triangles evaluate the vertices, they have no deltas) */
+	tl->linear = !ts->tiny;
+	tl->surf = ts->v[0].surf;
+	tl->DxDsurf = ts->DxDsurf;
+	tl->DyDsurf = ts->DyDsurf;
+	tl->sx = ts->p[0].sx;
+	tl->sy = ts->p[0].sy;
+
+	    /* (+ a pixel: multisampling shades at a sample if the center misses) */
+	tl->minx = Min3(p0->sx, p1->sx, p2->sx) - 1;
+	tl->maxx = Max3(p0->sx, p1->sx, p2->sx) + 1;
+	tl->miny = Min3(p0->sy, p1->sy, p2->sy) - 1;
+	tl->maxy = Max3(p0->sy, p1->sy, p2->sy) + 1;
+    }
+    ts->sh.lights = tl;
+}
+
+/* cull the lights of light tile t for tl's triangle */
+static ShadeLights_t *
+lights_tri_tile(TriLights_t *tl, int t)
+{
+    ShadeLights_t	*sl = &(tl->sets[t]);
+    xyz_t		b0, b1, c;
+    float		*p;
+    int			index[MAX_LIGHTS];
+    int			x0, y0, x1, y1, i, n, lanes;
+
+    b0 = tl->bmin;
+    b1 = tl->bmax;
+    if (tl->linear) {	/* the shaded points at the corners of the part of the tile it covers */
+	x0 = (t % light_tiles_x) * LIGHT_TILE;
+	y0 = (t / light_tiles_x) * LIGHT_TILE;
+	x1 = Min(tl->maxx, x0 + LIGHT_TILE-1) - tl->sx;
+	y1 = Min(tl->maxy, y0 + LIGHT_TILE-1) - tl->sy;
+	x0 = Max(tl->minx, x0) - tl->sx;
+	y0 = Max(tl->miny, y0) - tl->sy;
+
+	b0.x = b0.y = b0.z = REALLY_BIG_FLOAT;
+	b1.x = b1.y = b1.z = -REALLY_BIG_FLOAT;
+	for (i=0; i<4; i++) {
+	    c.x = tl->surf.x + ((i & 1) ? x1 : x0)*tl->DxDsurf.x + ((i & 2) ? y1 : y0)*tl->DyDsurf.x;
+	    c.y = tl->surf.y + ((i & 1) ? x1 : x0)*tl->DxDsurf.y + ((i & 2) ? y1 : y0)*tl->DyDsurf.y;
+	    c.z = tl->surf.z + ((i & 1) ? x1 : x0)*tl->DxDsurf.z + ((i & 2) ? y1 : y0)*tl->DyDsurf.z;
+	    b0.x = Min(b0.x, c.x);	b1.x = Max(b1.x, c.x);
+	    b0.y = Min(b0.y, c.y);	b1.y = Max(b1.y, c.y);
+	    b0.z = Min(b0.z, c.z);	b1.z = Max(b1.z, c.z);
+	}
+
+	    /* the pixels inside the triangle are inside its vertices' box too
+	     * (but multisampling may shade at a center just outside it)
+	     */
+	if (msaa_samples == 0) {
+	    b0.x = Max(b0.x, tl->bmin.x);	b1.x = Min(b1.x, tl->bmax.x);
+	    b0.y = Max(b0.y, tl->bmin.y);	b1.y = Min(b1.y, tl->bmax.y);
+	    b0.z = Max(b0.z, tl->bmin.z);	b1.z = Min(b1.z, tl->bmax.z);
+	}
+    }
+
+    for (i=0, n=0; i<RPScene.light_count; i++)
+	if (lights_touch(&(lights[i]), &b0, &b1))
+	    index[n++] = i;
+    lanes = (n + SHADE_LANES-1) / SHADE_LANES * SHADE_LANES;
+
+    if (tl->pool_used + lanes * LS_COUNT > tl->pool_size) {
+	    /* (a new pool: the other tiles' lists point into the old one) */
+	free(tl->pool);
+	tl->pool_size = Max(2 * tl->pool_size, 16 * lanes * LS_COUNT);
+	tl->pool = (float *) malloc(tl->pool_size * sizeof(float));
+	tl->pool_used = 0;
+	tl->current++;
+    }
+    p = &(tl->pool[tl->pool_used]);
+    memset(p, 0, lanes * LS_COUNT * sizeof(float));	/* (black padding lanes) */
+    tl->pool_used += lanes * LS_COUNT;
+
+    lights_streams(sl, p, lanes);
+    for (i=0; i<n; i++)
+	lights_put(sl, i, &(lights[index[i]]));
+    tl->stamp[t] = tl->current;
+
+    tl->sets_culled++;
+    tl->lights_total += n;
+    tl->lights_max = Max(tl->lights_max, n);
+    return (sl);
+}
+
+/* the lights that can reach pixel x,y of tl's triangle */
+ShadeLights_t *
+lights_tri_at(TriLights_t *tl, int x, int y)
+{
+    int		t = (y / LIGHT_TILE) * light_tiles_x + x / LIGHT_TILE;
+
+    if (tl->stamp[t] == tl->current)
+	return (&(tl->sets[t]));
+    return (lights_tri_tile(tl, t));
+}
+
+/* add up tl's counts (NULL: the main thread's) and free its lists */
+void
+lights_tri_done(TriLights_t *tl)
+{
+    if (tl == (TriLights_t *) NULL)
+	tl = &main_lights;
+
+    lights_tri_sets += tl->sets_culled;
+    lights_tri_total += tl->lights_total;
+    lights_tri_max = Max(lights_tri_max, tl->lights_max);
+
+    free(tl->sets);
+    free(tl->stamp);
+    free(tl->pool);
+    memset(tl, 0, sizeof(TriLights_t));
+}
+
+void
+lights_cleanup(void)
+{
+    free(tiles);
+    free(counts);
+    free(lights);
+    free(pool);
+    tiles = (ShadeLights_t *) NULL;
+    counts = (int *) NULL;
+    lights = (TileLight_t *) NULL;
+    pool = (float *) NULL;
+    pool_size = 0;
+}
@@ -0,0 +1,307 @@
+
+/*
+ * File:	msaa.c
+ *
+ * Multi-sample anti-aliasing (MULTISAMPLE scene flag, or -m samples).
+ *
+ * Each pixel keeps 4 or 8 samples, at the standard rotated grid positions,
+ * each with its own color and depth. A triangle's coverage and depth are
+ * evaluated at every sample, but it is shaded only once per pixel (at the
+ * pixel center), and that color is written to the samples it covers that
+ * pass the depth test. When the scene is painted, the resolve averages the
+ * samples of each pixel into the color frame buffer.
+ *
+ * The coverage uses the edge functions of halfspace.c in 1/16 pixel units
+ * (the sample positions are on a 16x16 grid), with the same top-left fill
+ * rule, so samples on an edge shared by two triangles are covered once.
+ *
+ * The depth frame buffer keeps the farthest sample of each pixel, which
+ * is what the hierarchical z (RENDER07) needs to stay conservative.
+ *
+ * The sample buffers are only allocated when multisampling is on.
+ *
+ */
+
+/*
+ *
+ * MIT License
+ *
+ * Copyright (c) 2018 Steve Anderson
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <string.h>
+
+#include "rp.h"
+#include "paint.h"
+
+int	msaa_samples = 0;	/* samples per pixel, 0 when off */
+long	msaa_bytes = 0;		/* sample buffer memory */
+long	msaa_edge_pixels = 0;	/* resolved pixels whose samples differ */
+
+static rgba_t	*msaa_color = (rgba_t *) NULL;	/* xres * yres * msaa_samples */
+static float	*msaa_depth = (float *) NULL;
+
+	/* sample positions, in 1/16 pixel from the pixel center: */
+static int	pos4[4][2] = {{-2, -6}, {6, -2}, {-6, 2}, {2, 6}};
+static int	pos8[8][2] = {{1, -3}, {-1, 3}, {5, 1}, {-3, -5},
+			      {-5, 5}, {-7, -1}, {3, 7}, {7, -7}};
+static int	(*pos)[2] = pos4;
+
+/* allocate the sample buffers, every sample starting as the (cleared) frame buffer */
+void
+msaa_init(void)
+{
+    int		x, y, i;
+    rgba_t	*c;
+    long	size;
+
+    msaa_samples = (RPScene.num_samples > 4) ? 8 : 4;
+    pos = (msaa_samples == 8) ? pos8 : pos4;
+
+    size = (long) RPScene.xres * RPScene.yres * msaa_samples;
+    msaa_color = (rgba_t *) malloc(size * sizeof(rgba_t));
+    msaa_depth = (float *) malloc(size * sizeof(float));
+    if (msaa_color == (rgba_t *) NULL || msaa_depth == (float *) NULL) {
+	fprintf(stderr,"%s : ERROR : %s : %d : can't allocate %d x %d x %d sample buffers\n",
+		program_name, __FILE__, __LINE__, RPScene.xres, RPScene.yres, msaa_samples);
+	exit(EXIT_FAILURE);
+    }
+
+    c = msaa_color;
+    for (y=0; y<RPScene.yres; y++) {
+	for (x=0; x<RPScene.xres; x++) {
+	    for (i=0; i<msaa_samples; i++)
+		*c++ = RPColorFrameBuffer[y][x];
+	}
+    }
+    for (i=0; i<size; i++)
+	msaa_depth[i] = MAX_ZVAL;
+
+    msaa_bytes = size * (sizeof(rgba_t) + sizeof(float));
+    msaa_edge_pixels = 0;
+}
+
+/* the position of sample i, in pixels from the pixel center */
+void
+msaa_sample_pos(int i, float *ox, float *oy)
+{
+    *ox = pos[i][0] / 16.0;
+    *oy = pos[i][1] / 16.0;
+}
+
+/* the samples of pixel x,y in covered whose depth z[i] passes the depth test */
+unsigned int
+msaa_test(int x, int y, unsigned int covered, float *z)
+{
+    float	*d = &(msaa_depth[(y * RPScene.xres + x) * msaa_samples]);
+    unsigned int pass = covered;
+    int		i;
+
+    if (Flagged(RPScene.flags, FLAG_ZBUFFER)) {
+	for (i=0; i<msaa_samples; i++) {
+	    if ((covered & (0x1 << i)) && !(z[i] < d[i]))
+		pass &= ~(0x1 << i);
+	}
+    }
+    return (pass);
+}
+
+/* write a shaded color (and depth z[i]) to the samples of pixel x,y in pass */
+void
+msaa_put(int x, int y, unsigned int pass, float *z, Colorf_t *color)
+{
+    rgba_t	*c;
+    float	*d, f, zmax;
+    int		i, n, r, g, b, a;
+
+    n = (y * RPScene.xres + x) * msaa_samples;
+    c = &(msaa_color[n]);
+    d = &(msaa_depth[n]);
+
+    r = (int) Clamp0255(color->r * MAX_COLOR_VAL);
+    g = (int) Clamp0255(color->g * MAX_COLOR_VAL);
+    b = (int) Clamp0255(color->b * MAX_COLOR_VAL);
+    a = (int) Clamp0255(color->a * MAX_COLOR_VAL);
+    f = (float) a / (float) MAX_COLOR_VAL;
+
+    for (i=0; i<msaa_samples; i++) {
+	if (pass & (0x1 << i)) {
+	    if (a == MAX_COLOR_VAL) {
+		c[i].r = (u8) r;
+		c[i].g = (u8) g;
+		c[i].b = (u8) b;
+		c[i].a = (u8) a;
+	    } else {	/* alpha-blend, like RPPutColorFBPixel() */
+		c[i].r = (u8) Clamp0255(f*r + (1.0-f)*c[i].r);
+		c[i].g = (u8) Clamp0255(f*g + (1.0-f)*c[i].g);
+		c[i].b = (u8) Clamp0255(f*b + (1.0-f)*c[i].b);
+		c[i].a = (u8) Clamp0255(f*a + (1.0-f)*c[i].a);
+	    }
+	    if (Flagged(RPScene.flags, FLAG_ZBUFFER))
+		d[i] = z[i];
+	}
+    }
+
+	/* the depth frame buffer gets the farthest sample */
+    if (Flagged(RPScene.flags, FLAG_ZBUFFER)) {
+	zmax = d[0];
+	for (i=1; i<msaa_samples; i++)
+	    zmax = Max(zmax, d[i]);
+	RPPutDepthFBPixel(x, y, zmax);
+    }
+}
+
+/* rasterize (and shade) a triangle into the sample buffers */
+void
+msaa_tri(TriSetup_t *ts)
+{
+    SetupVtx_t	*v0 = &(ts->p[0]), *v1 = &(ts->p[1]), *v2 = &(ts->p[2]), *tmpp;
+    SetupVtx_t	*a, *b;
+    long long	A[3], B[3], C[3], off[3][MSAA_MAX_SAMPLES], e[3];
+    float	dz[MSAA_MAX_SAMPLES], z[MSAA_MAX_SAMPLES], zc;
+    int		minx, miny, maxx, maxy, x, y, i, k, wx0, wx1;
+    unsigned int covered, pass;
+    Colorf_t	color;
+
+	/* keeps the 1/16 pixel edge functions in 64 bits
+	 * (only unclipped triangles get this far out, they are skipped)
+	 */
+    for (i=0; i<3; i++) {
+	if (abs(ts->p[i].sx) > MSAA_MAX_COORD || abs(ts->p[i].sy) > MSAA_MAX_COORD)
+	    return;
+    }
+
+	/* wind the triangle so the inside is positive (r is the negative area) */
+    if (ts->r > 0.0) {
+	tmpp = v1; v1 = v2; v2 = tmpp;
+    }
+
+	/* E(x,y) = A*x + B*y + C at the pixel centers, and its offset
+	 * at each sample (in 1/16 pixel, with the top-left bias)
+	 */
+    for (k=0; k<3; k++) {
+	a = (k == 0) ? v0 : (k == 1) ? v1 : v2;
+	b = (k == 0) ? v1 : (k == 1) ? v2 : v0;
+	A[k] = a->sy - b->sy;
+	B[k] = b->sx - a->sx;
+	C[k] = (long long) (b->sy - a->sy) * a->sx - (long long) (b->sx - a->sx) * a->sy;
+	for (i=0; i<msaa_samples; i++) {
+	    off[k][i] = A[k] * pos[i][0] + B[k] * pos[i][1];
+	    if (!(A[k] > 0 || (A[k] == 0 && B[k] > 0)))
+		off[k][i] -= 1;
+	}
+    }
+    for (i=0; i<msaa_samples; i++)
+	dz[i] = (pos[i][0] * ts->DxDz + pos[i][1] * ts->DyDz) / 16.0;
+
+	/* bounding box, clamped to the screen (or tile) */
+    minx = Max(Min3(v0->sx, v1->sx, v2->sx), ts->minx);
+    maxx = Min(Max3(v0->sx, v1->sx, v2->sx), ts->maxx);
+    miny = Max(Min3(v0->sy, v1->sy, v2->sy), ts->miny);
+    maxy = Min(Max3(v0->sy, v1->sy, v2->sy), ts->maxy);
+
+    for (y=miny; y<=maxy; y++) {
+	wx0 = maxx + 1;
+	wx1 = minx - 1;
+
+	for (x=minx; x<=maxx; x++) {
+
+		/* which samples are inside all three edges */
+	    for (k=0; k<3; k++)
+		e[k] = 16 * (A[k] * x + B[k] * y + C[k]);
+	    covered = 0x0;
+	    for (i=0; i<msaa_samples; i++) {
+		if ((e[0] + off[0][i]) >= 0 && (e[1] + off[1][i]) >= 0 &&
+		    (e[2] + off[2][i]) >= 0)
+		    covered |= (0x1 << i);
+	    }
+	    if (covered == 0x0)
+		continue;
+	    ts->rasterized++;
+
+		/* which of those pass the depth test */
+	    zc = ts->p[0].sz + (x - ts->p[0].sx)*ts->DxDz + (y - ts->p[0].sy)*ts->DyDz;
+	    for (i=0; i<msaa_samples; i++)
+		z[i] = zc + dz[i];
+	    pass = msaa_test(x, y, covered, z);
+	    if (pass == 0x0)
+		continue;
+
+		/* shade once, write every passing sample */
+	    shade_pixel_color(ts, x, y, &color);
+	    ts->shaded++;
+	    msaa_put(x, y, pass, z, &color);
+
+	    wx0 = Min(wx0, x);
+	    wx1 = Max(wx1, x);
+	}
+
+	if (hiz_enabled && wx0 <= wx1)
+	    hiz_mark(wx0, wx1, y);
+    }
+}
+
+/* average the samples of each pixel into the color frame buffer */
+void
+msaa_resolve(void)
+{
+    rgba_t	*c;
+    int		x, y, i, r, g, b, a, same;
+
+    c = msaa_color;
+    for (y=0; y<RPScene.yres; y++) {
+	for (x=0; x<RPScene.xres; x++, c+=msaa_samples) {
+	    r = g = b = a = 0;
+	    same = TRUE;
+	    for (i=0; i<msaa_samples; i++) {
+		r += c[i].r;
+		g += c[i].g;
+		b += c[i].b;
+		a += c[i].a;
+		if (memcmp(&(c[i]), &(c[0]), sizeof(rgba_t)) != 0)
+		    same = FALSE;
+	    }
+	    if (!same)
+		msaa_edge_pixels++;
+
+	    RPColorFrameBuffer[y][x].r = (u8) ((r + msaa_samples/2) / msaa_samples);
+	    RPColorFrameBuffer[y][x].g = (u8) ((g + msaa_samples/2) / msaa_samples);
+	    RPColorFrameBuffer[y][x].b = (u8) ((b + msaa_samples/2) / msaa_samples);
+	    RPColorFrameBuffer[y][x].a = (u8) ((a + msaa_samples/2) / msaa_samples);
+	}
+    }
+
+    deferred_draw_outlines();	/* RENDER02 */
+}
+
+void
+msaa_cleanup(void)
+{
+    free(msaa_color);
+    free(msaa_depth);
+    msaa_color = (rgba_t *) NULL;
+    msaa_depth = (float *) NULL;
+    msaa_samples = 0;
+}
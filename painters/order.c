@@ -0,0 +1,147 @@
+
+/*
+ * File:	order.c
+ *
+ * Front to back ordering (RENDER08).
+ *
+ * After RPProcessObjects() everything is in eye space, so the objects
+ * can be sorted nearest first by their bounding spheres, and within an
+ * object, runs of ORDER_CLUSTER triangles (neighbours in the file, so
+ * usually neighbours in space) sorted by their nearest vertex. With the
+ * depth test ahead of the shading, and hierarchical z, drawing near
+ * things first means more of what's behind them is rejected early.
+ *
+ * The order only changes the image where the depth test can't decide:
+ * without ZBUFFER, with alpha blending, and for equal depths.
+ *
+ */
+
+/*
+ *
+ * MIT License
+ *
+ * Copyright (c) 2018 Steve Anderson
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "rp.h"
+#include "paint.h"
+
+double		order_usec = 0.0;	/* time spent sorting */
+int		order_clusters = 0;	/* triangle clusters sorted */
+
+typedef struct {
+    float	depth;		/* distance in front of the eye, nearest point */
+    int		index;		/* original position, for a stable sort */
+} OrderKey_t;
+
+static int
+cmp_order_key(const void *a, const void *b)
+{
+    const OrderKey_t	*ka = (const OrderKey_t *) a, *kb = (const OrderKey_t *) b;
+
+    if (ka->depth < kb->depth)
+	return (-1);
+    if (ka->depth > kb->depth)
+	return (1);
+    return (ka->index - kb->index);
+}
+
+/* sort an object's triangles by clusters, nearest cluster first */
+static void
+order_tris(Object_t *op)
+{
+    OrderKey_t	*keys;
+    Tri_t	*sorted;
+    Vtx_t	*v;
+    float	depth;
+    int		nclusters, c, i, j, n;
+
+    nclusters = (op->tri_count + ORDER_CLUSTER - 1) / ORDER_CLUSTER;
+    if (nclusters < 2)
+	return;
+
+    keys = (OrderKey_t *) malloc(nclusters * sizeof(OrderKey_t));
+    for (c=0; c<nclusters; c++) {
+	depth = REALLY_BIG_FLOAT;
+	for (i=c*ORDER_CLUSTER; i<Min((c+1)*ORDER_CLUSTER, op->tri_count); i++) {
+	    v = op->verts;
+	    depth = Min(depth, -v[op->tris[i].v0].pos.z);
+	    depth = Min(depth, -v[op->tris[i].v1].pos.z);
+	    depth = Min(depth, -v[op->tris[i].v2].pos.z);
+	}
+	keys[c].depth = depth;
+	keys[c].index = c;
+    }
+    qsort(keys, nclusters, sizeof(OrderKey_t), cmp_order_key);
+
+    sorted = (Tri_t *) malloc(op->tri_count * sizeof(Tri_t));
+    for (c=0, j=0; c<nclusters; c++) {
+	i = keys[c].index * ORDER_CLUSTER;
+	n = Min(ORDER_CLUSTER, op->tri_count - i);
+	memcpy(&(sorted[j]), &(op->tris[i]), n * sizeof(Tri_t));
+	j += n;
+    }
+    memcpy(op->tris, sorted, op->tri_count * sizeof(Tri_t));
+
+    order_clusters += nclusters;
+    free(sorted);
+    free(keys);
+}
+
+/* sort the scene's objects (and their triangles) front to back */
+void
+order_scene(void)
+{
+    OrderKey_t	keys[MAX_OBJS];
+    Object_t	*sorted[MAX_OBJS];
+    Object_t	*op;
+    double	start;
+    int		i;
+
+    start = paint_usec();
+    order_clusters = 0;
+
+    for (i=0; i<RPScene.obj_count; i++) {
+	op = RPScene.obj_list[i];
+	if (op->sphere != (Sphere_t *) NULL)	/* eye is at the origin, looking down -z */
+	    keys[i].depth = -op->sphere->center.z - op->sphere->radius;
+	else
+	    keys[i].depth = REALLY_BIG_FLOAT;
+	keys[i].index = i;
+
+	if (op->type == OBJ_TYPE_POLY)
+	    order_tris(op);
+    }
+    qsort(keys, RPScene.obj_count, sizeof(OrderKey_t), cmp_order_key);
+
+    for (i=0; i<RPScene.obj_count; i++)
+	sorted[i] = RPScene.obj_list[keys[i].index];
+    for (i=0; i<RPScene.obj_count; i++)
+	RPScene.obj_list[i] = sorted[i];
+
+    order_usec = paint_usec() - start;
+}
@@ -36,12 +36,33 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <math.h>
+#include <time.h>
+#if (defined __x86_64__ || defined __i386__)
+#include <x86intrin.h>
+#endif
 
 #include "rp.h"
 #include "paint.h"
 
 int     culled_polys = 0;
 int     drawn_polys = 0;
+long	frags_rasterized = 0;
+long	frags_shaded = 0;
+
+/* count the pixels some triangle wrote depth to (for the overdraw stats) */
+static long
+covered_pixels(void)
+{
+    long	count = 0;
+    int		x, y;
+
+    for (y=0; y<RPScene.yres; y++)
+	for (x=0; x<RPScene.xres; x++)
+	    if (RPDepthFrameBuffer[y][x] < MAX_ZVAL)
+		count++;
+
+    return (count);
+}
 
 /*
  * paint the entire scene.
@@ -54,6 +75,9 @@ paint_scene(void)
     Tri_t	*tri;
     float       progress = 0.0;
     int         i, j, retval = CLIP_TRIVIAL_ACCEPT;
+    int		batch[SETUP_BATCH], n;
+    unsigned long long	cycles = 0, start;
+    long	covered;
 
     fprintf(stderr,"Painting Scene:\n");
     fprintf(stderr,"\tResolution %d x %d\n",RPScene.xres,RPScene.yres);
@@ -68,6 +92,13 @@ paint_scene(void)
     RPProcessObjects(TRUE); 		/* tranform objects to camera space */
 					/* TRUE flag also computes projection data */
 
+    if (Flagged(RPScene.generic_flags, FLAG_RENDER_08))
+	order_scene();			/* front to back */
+    impostor_init();			/* sphere projection */
+    shadow_init();			/* shadow maps, from each light */
+    lights_init();			/* eye space lights, per screen tile */
+    gouraud_init();			/* GOURAUD objects' lit vertices */
+
     if (Flagged(RPScene.flags, FLAG_FOG)) {
 	rgba_t	temp;
 	temp.r = (u8) Clamp0255(RPScene.fog_color.r * MAX_COLOR_VAL);
@@ -77,30 +108,77 @@ paint_scene(void)
 	RPClearColorFB(&temp);
     }
 
+	/* MULTISAMPLE: the sample buffers start as the cleared frame buffer */
+    if (Flagged(RPScene.flags, FLAG_SCENE_MULTISAMPLE))
+	msaa_init();
+
+	/* -v times each specialized span variant (not from the tile threads) */
+    span_bench = Flagged(RPScene.flags, FLAG_VERBOSE) &&
+		 !Flagged(RPScene.generic_flags, FLAG_RENDER_06);
+
+	/* RENDER07 keeps a hierarchical z for rejecting hidden geometry;
+	 * RENDER06 bins the triangles into screen tiles, drawn by threads;
+	 * RENDER05 defers the shading until the G-buffer is filled
+	 * (not with MULTISAMPLE, which shades as it goes)
+	 */
+    if (Flagged(RPScene.generic_flags, FLAG_RENDER_07) && Flagged(RPScene.flags, FLAG_ZBUFFER))
+	hiz_init();
+    if (Flagged(RPScene.generic_flags, FLAG_RENDER_06))
+	bin_init();
+    else if (Flagged(RPScene.generic_flags, FLAG_RENDER_05) && msaa_samples == 0)
+	deferred_init();
+
     fprintf(stderr,"Progress:  %5.2f %%",progress*100.0);
 
     for (i=0; i<RPScene.obj_count; i++) {
 
 	op = RPScene.obj_list[i];
 
-        if (op->type == OBJ_TYPE_SPHERE) {
+        if (hiz_enabled && hiz_object_hidden(op)) {
 
-		/* can't handle these yet */
-            fprintf(stderr,"%s : ERROR : %s : %d : can't handle objects of type SPHERE\n",
-                        program_name, __FILE__,__LINE__);
+		/* RENDER07: the whole object is behind what's drawn */
+	    hiz_objs_rejected++;
+	    hiz_tris_rejected += op->tri_count;
+
+	} else if (op->type == OBJ_TYPE_SPHERE) {
+
+		/* painted as an impostor */
+	    start = PaintCycles();
+	    if (paint_binned)
+		bin_sphere(i);	/* (drawn in its place in each tile) */
+	    else
+		paint_sphere(op);
+	    cycles += PaintCycles() - start;
 
 	} else if (op->type == OBJ_TYPE_POLY) {
 
-	    for (j=0; j<op->tri_count; j++) {
+	    for (j=0, n=0; j<op->tri_count; j++) {
                 tri = &(op->tris[j]);
 
 		/* we use this user-defined scene flag to turn off clipping: */
 	        if (!Flagged(RPScene.generic_flags, FLAG_RENDER_01)) 
         	    retval = RPClipTriangle(op, tri);
 
-		if (retval > CLIP_TRIVIAL_REJECT)
-		    paint_tri(op, tri, TRUE);
+		if (retval <= CLIP_TRIVIAL_REJECT)
+		    continue;
+
+		start = PaintCycles();
+		if (paint_binned) {
+		    bin_tri(i, j);
+		} else {	/* set up and paint SETUP_BATCH at a time */
+		    batch[n++] = j;
+		    if (n == SETUP_BATCH) {
+			paint_tris(op, batch, n, TRUE);
+			n = 0;
+		    }
+		}
+		cycles += PaintCycles() - start;
             }
+	    if (n > 0) {
+		start = PaintCycles();
+		paint_tris(op, batch, n, TRUE);
+		cycles += PaintCycles() - start;
+	    }
 
 
     	} else {     /* can't happen */
@@ -112,6 +190,28 @@ paint_scene(void)
         fprintf(stderr,"\b\b\b\b\b\b\b%5.2f %%",progress*100.0);
     }
 
+    if (paint_binned) {
+	start = PaintCycles();
+	bin_render();
+	cycles += PaintCycles() - start;
+	bin_cleanup();
+    }
+    if (paint_deferred) {
+	start = PaintCycles();
+	deferred_resolve();
+	cycles += PaintCycles() - start;
+	deferred_cleanup();
+    }
+
+    if (msaa_samples > 0) {
+	start = PaintCycles();
+	msaa_resolve();
+	cycles += PaintCycles() - start;
+    }
+    lights_tri_done((TriLights_t *) NULL);	/* (the main thread's counts) */
+    if (hiz_enabled)
+	hiz_cleanup();
+
     RPCleanupObjects();
     RPCleanupTextures();
     RPCleanupMaterials();
@@ -126,12 +226,99 @@ paint_scene(void)
             program_name, culled_polys);
     fprintf(stderr,"%s : [%'16d] tiny rejected polygons\n",
             program_name, RPScene.tiny_rejected_polys);
+    fprintf(stderr,"%s : [%'16d] tiny polygons (%dx%d fast path)\n",
+            program_name, tiny_tris, TINY_TRI, TINY_TRI);
     fprintf(stderr,"%s : [%'16d] trivially rejected polygons\n",
             program_name, RPScene.trivial_rejected_polys);
     fprintf(stderr,"%s : [%'16d] clipped polygons\n",
             program_name, RPScene.clipped_polys);
     fprintf(stderr,"%s : [%'16d] drawn polygons\n",
             program_name, drawn_polys);
+    fprintf(stderr,"%s : [%'16d] drawn spheres\n",
+            program_name, spheres_drawn);
+    fprintf(stderr,"%s : [%'16ld] fragments rasterized\n",
+            program_name, frags_rasterized);
+    fprintf(stderr,"%s : [%'16ld] fragments shaded\n",
+            program_name, frags_shaded);
+    if (RPScene.light_count > 0) {
+	fprintf(stderr,"%s : [%16.2f] lights per tile (%d x %d tiles, average)\n",
+		program_name, lights_tile_avg, LIGHT_TILE, LIGHT_TILE);
+	fprintf(stderr,"%s : [%'16d] lights in the busiest tile\n",
+		program_name, lights_tile_max);
+	if (lights_tri_sets > 0) {
+	    fprintf(stderr,"%s : [%16.2f] lights per tile a triangle shades (forward, average)\n",
+		    program_name, (double) lights_tri_total / (double) lights_tri_sets);
+	    fprintf(stderr,"%s : [%'16d] lights in the busiest of them\n",
+		    program_name, lights_tri_max);
+	}
+	fprintf(stderr,"%s : [%16.1f] light culling time (usec)\n",
+		program_name, lights_usec);
+    }
+    if (gouraud_verts > 0)
+	fprintf(stderr,"%s : [%'16d] vertices lit (GOURAUD)\n",
+		program_name, gouraud_verts);
+    if (shadow_maps > 0) {
+	fprintf(stderr,"%s : [%'16d] shadow maps drawn (%d x %d)\n",
+		program_name, shadow_maps, RPScene.shadow_size, RPScene.shadow_size);
+	fprintf(stderr,"%s : [%'16d] polygons drawn into shadow maps\n",
+		program_name, shadow_polys);
+	fprintf(stderr,"%s : [%'16ld] shadow map memory (bytes)\n",
+		program_name, shadow_bytes);
+	fprintf(stderr,"%s : [%16.1f] shadow map time (usec)\n",
+		program_name, shadow_usec);
+    }
+    if (setup_usec > 0.0)
+	fprintf(stderr,"%s : [%'16.0f] triangles set up per second (batches of %d)\n",
+		program_name, (double) setup_count * 1.0e6 / setup_usec, SETUP_BATCH);
+    if (Flagged(RPScene.generic_flags, FLAG_RENDER_08)) {
+	fprintf(stderr,"%s : [%'16d] triangle clusters sorted\n",
+		program_name, order_clusters);
+	fprintf(stderr,"%s : [%16.1f] front to back sort time (usec)\n",
+		program_name, order_usec);
+    }
+    if (Flagged(RPScene.generic_flags, FLAG_RENDER_07)) {
+	fprintf(stderr,"%s : [%'16d] hierarchical z rejected objects\n",
+		program_name, hiz_objs_rejected);
+	fprintf(stderr,"%s : [%'16d] hierarchical z rejected polygons\n",
+		program_name, hiz_tris_rejected);
+    }
+    if (Flagged(RPScene.generic_flags, FLAG_RENDER_06)) {
+	fprintf(stderr,"%s : [%'16d] threads (%d x %d tiles)\n",
+		program_name, bin_threads, BIN_TILE, BIN_TILE);
+	fprintf(stderr,"%s : [%'16ld] bin memory (bytes)\n",
+		program_name, bin_bytes);
+	fprintf(stderr,"%s : [%16.1f] average tile time (usec)\n",
+		program_name, bin_avg_usec);
+	fprintf(stderr,"%s : [%16.1f] slowest tile time (usec)\n",
+		program_name, bin_max_usec);
+    } else if (Flagged(RPScene.generic_flags, FLAG_RENDER_05) && msaa_samples == 0) {
+	fprintf(stderr,"%s : [%'16ld] fragments written to G-buffer\n",
+		program_name, gbuf_writes);
+	fprintf(stderr,"%s : [%'16ld] G-buffer memory (bytes)\n",
+		program_name, gbuf_bytes);
+    }
+    if (msaa_samples > 0) {
+	fprintf(stderr,"%s : [%'16d] samples per pixel\n",
+		program_name, msaa_samples);
+	fprintf(stderr,"%s : [%'16ld] edge pixels resolved\n",
+		program_name, msaa_edge_pixels);
+	fprintf(stderr,"%s : [%'16ld] sample buffer memory (bytes)\n",
+		program_name, msaa_bytes);
+    }
+    if (Flagged(RPScene.flags, FLAG_ZBUFFER) && (covered = covered_pixels()) > 0)
+	fprintf(stderr,"%s : [%16.2f] fragments shaded per covered pixel\n",
+		program_name, (double) frags_shaded / (double) covered);
+    fprintf(stderr,"%s : [%16.2f] cycles per fragment (setup + raster + shade)\n",
+            program_name, (frags_rasterized > 0) ? 
+	    (double) cycles / (double) frags_rasterized : 0.0);
+    span_report(program_name);
+    lights_report(program_name);
     fprintf(stderr,"\n");
+
+    if (msaa_samples > 0)
+	msaa_cleanup();
+    lights_cleanup();
+    shadow_cleanup();
+    gouraud_cleanup();
 }
 
@@ -40,21 +40,301 @@
 
 #define MAX_ZVAL	REALLY_BIG_FLOAT
 
+#define HS_TILE		(8)	/* half-space rasterizer tile size (pixels, power of 2) */
+#define HS_MAX_COORD	(16384)	/* keeps the fixed-point edge functions in 32 bits */
+
+#define BIN_TILE	(64)	/* sort-middle screen tile size (pixels) */
+#define BIN_MAX_THREADS	(64)
+
+#define SETUP_BATCH	(8)	/* triangles set up together (setup.c) */
+#define TINY_TRI	(4)	/* triangles inside a TINY_TRI x TINY_TRI box take the tiny path */
+
+#define SHADE_LANES	(4)	/* lights shaded together (shade.c), one SSE vector */
+#define LIGHT_TILE	(32)	/* light culling screen tile size (pixels) */
+#define LS_COUNT	(14)	/* streams in a ShadeLights_t */
+
+	/* shadow maps (shadow.c): */
+#define SHADOW_ZSCALE	(16777216.0)	/* depths from 0 (near) to 2^24 (far) */
+#define SHADOW_DEPTH_RANGE (4096.0)	/* far / near, at most */
+#define SHADOW_GUARD	(1.25)	/* triangles are clipped this far outside a face */
+#define SHADOW_BORDER	(2)	/* texels around each cube face, for the filter */
+#define SHADOW_MAX_FOV	(120.0)	/* wider spot lights get a cube */
+#define SHADOW_NORMAL_OFFSET (2.0)	/* lookups are pushed off the surface (texels, at 90 degrees) */
+#define SHADOW_BIAS	(1.0)	/* and toward the light (texels) */
+#define SHADOW_MAX_BYTES (512L*1024*1024)
+
+#define ORDER_CLUSTER	(64)	/* triangles per cluster for front to back ordering */
+
+#define MSAA_MAX_SAMPLES (8)	/* multisample anti-aliasing, 4 or 8 samples */
+#define MSAA_MAX_COORD	(1<<24)	/* keeps the sample edge functions in 64 bits */
+
+#define HIZ_CELL	(8)	/* hierarchical z level 0 cell size (pixels) */
+#define HIZ_MAX_LEVELS	(16)
+
+	/* attributes a triangle interpolates (TriSetup_t attribs): */
+#define ATTR_COLOR	0x01	/* vertex color (VERTSHADE) */
+#define ATTR_TEX	0x02	/* s, t, 1/w (textured material) */
+#define ATTR_SURF	0x04	/* world position (lighting, fog) */
+#define ATTR_NORM	0x08	/* normal (lighting, not FLATSHADE) */
+#define ATTR_EYE	0x10	/* eye vector (lighting) */
+#define ATTR_LIT	0x20	/* lit vertex color (GOURAUD) */
+
+	/* specialized span variants (rasterize.c), numbered by the state
+	 * they are compiled for: texture mode, vertex color, lighting mode,
+	 * fog and zbuffer.
+	 */
+#define SPAN_TEX_NONE		0
+#define SPAN_TEX_DECAL		1
+#define SPAN_TEX_MODULATE	2
+#define SPAN_TEX_FILT_DECAL	3
+#define SPAN_TEX_FILT_MODULATE	4
+#define SPAN_LIGHT_NONE		0
+#define SPAN_LIGHT_FLAT		1
+#define SPAN_LIGHT_SMOOTH	2
+#define SPAN_LIGHT_GOURAUD	3
+#define SPAN_VARIANTS		(5*2*4*2*2)
+
+#define SpanVariant(tex,vert,light,fog,zbuf)	\
+		((tex) + 5*((vert) + 2*((light) + 4*((fog) + 2*(zbuf)))))
+#define SpanTex(v)	((v) % 5)
+#define SpanVert(v)	(((v) / 5) % 2)
+#define SpanLight(v)	(((v) / 10) % 4)
+#define SpanFog(v)	(((v) / 40) % 2)
+#define SpanZbuf(v)	((v) / 80)
+#define SpanPerPixel(v)	(SpanLight(v) == SPAN_LIGHT_FLAT || SpanLight(v) == SPAN_LIGHT_SMOOTH)
+#define SpanAttribs(v)	((SpanVert(v) ? ATTR_COLOR : 0) | \
+			 (SpanTex(v) != SPAN_TEX_NONE ? ATTR_TEX : 0) | \
+			 (SpanPerPixel(v) || SpanFog(v) ? ATTR_SURF : 0) | \
+			 (SpanLight(v) == SPAN_LIGHT_SMOOTH ? ATTR_NORM : 0) | \
+			 (SpanPerPixel(v) ? ATTR_EYE : 0) | \
+			 (SpanLight(v) == SPAN_LIGHT_GOURAUD ? ATTR_LIT : 0))
+
+	/* objects lit at their vertices (gouraud.c) */
+#define GouraudObject(op)	((op)->type == OBJ_TYPE_POLY && \
+				 Flagged((op)->flags, FLAG_LIGHTING) && \
+				 Flagged((op)->flags, FLAG_GOURAUD) && \
+				 !Flagged((op)->flags, FLAG_FLATSHADE))
+
+	/* a cycle counter for the inner loop benchmarks 
+	 * (falls back to clock() ticks where there is no rdtsc)
+	 */
+#if (defined __x86_64__ || defined __i386__)
+#define PaintCycles()	((unsigned long long) __rdtsc())
+#else
+#define PaintCycles()	((unsigned long long) clock())
+#endif
+
 	/* data types: */
-/* no renderer-specific data types are required... */
+
+typedef struct {	/* a set of lights, as SHADE_LANES wide streams */
+    int		count;		/* (a multiple of SHADE_LANES, padded with black lights) */
+    float	*x, *y, *z;	/* eye space position */
+    float	*r, *g, *b, *a;	/* color */
+    float	*dx, *dy, *dz;	/* spot direction */
+    float	*spot_scale, *spot_bias;	/* spot falloff (scale 0, bias 1: none) */
+    float	*inv_range;	/* 1 / range (0: none) */
+    float	*shadow;	/* shadow map number + 1 (0: none) */
+    int		falloffs;	/* TRUE if any are spot lights or have a range */
+    int		shadows;	/* TRUE if any have a shadow map */
+} ShadeLights_t;
+
+typedef struct {	/* forward shading: the lights of each light tile a triangle covers (lights_tri()) */
+    ShadeLights_t	*sets;	/* per light tile, */
+    int		*stamp;		/* good while it's the triangle's stamp */
+    int		current;
+    float	*pool;		/* the sets' streams */
+    int		pool_size, pool_used;
+    xyz_t	bmin, bmax;	/* the box around the triangle's vertices */
+    xyz_t	surf, DxDsurf, DyDsurf;	/* the shaded points, linear in x,y from sx,sy */
+    int		sx, sy, linear;
+    int		minx, miny, maxx, maxy;	/* the pixels it covers */
+    long	sets_culled, lights_total;	/* for the summary */
+    int		lights_max;
+} TriLights_t;
+
+typedef struct {	/* what the pixel shading needs from a triangle */
+    Object_t	*op;
+    Tri_t	*tri;
+    Material_t	*m;
+    TriLights_t	*lights;	/* its lights (forward), NULL for the shared tile lists */
+    float	DxDs, DyDs;	/* texture deltas, for filtered sampling */
+    float	DxDt, DyDt;
+    float	DxDw, DyDw;
+    Colorf_t	amb;		/* lighting (shade_setup()): material ambient x the light colors */
+    Colorf_t	diff, spec;	/* material diffuse, specular x highlight */
+    float	shiny;
+} ShadeTri_t;
+
+typedef struct {	/* the interpolated attributes at one pixel */
+    Colorf_t	color;
+    float	s, t, w, z;
+    xyz_t	surf, n, eye;
+    Colorf_t	lit;		/* GOURAUD: the lighting, from the vertices */
+} Frag_t;
+
+typedef struct {	/* a vertex's screen position */
+    int		sx, sy, sz;
+} SetupVtx_t;
+
+typedef struct {	/* everything the rasterizers need from triangle setup */
+    ShadeTri_t	sh;
+    SetupVtx_t	p[3];		/* the vertices, sorted by sy */
+    Frag_t	v[3];		/* the attributes at p[0] (and p[1], p[2] if tiny) */
+    int		tiny;		/* TRUE for tiny_tri(): no edge slopes or deltas but s,t,w */
+    float	r;		/* plane equation denominator (2x signed area) */
+    Colorf_t	polycolor;
+    float	dhdy, dmdy, dldy;	/* edge slopes, for walking the edges */
+    Colorf_t	DxDcol, DyDcol;	/* attribute deltas in x and y: */
+    float	DxDz, DyDz;
+    xyz_t	DxDsurf, DyDsurf;
+    xyz_t	DxDnorm, DyDnorm;
+    xyz_t	DxDeye, DyDeye;
+    Colorf_t	DxDlit, DyDlit;
+    int		attribs;	/* which of the above the pixels need (ATTR_*) */
+    int		variant;	/* specialized span variant (SPAN_VARIANTS) */
+    int		defer_id;	/* G-buffer triangle index, -1 until it writes one */
+    int		minx, miny, maxx, maxy;	/* pixels it may write (screen or tile) */
+    long	rasterized, shaded;	/* fragment counts */
+} TriSetup_t;
+
+typedef struct {	/* one pixel of the deferred shading G-buffer */
+    union {
+	xyz_t	n;		/* normal */
+	Colorf_t lit;		/* or the lighting, for GOURAUD objects */
+    } u;
+    xyz_t	surf;		/* eye space position */
+    xyz_t	eye;		/* eye vector, as interpolated */
+    float	s, t, w;	/* texture coordinates (and 1/w) */
+    float	z;		/* depth */
+    Colorf_t	color;		/* vertex or polygon color (unquantized, like forward) */
+    int		id;		/* triangle (ShadeTri_t) index, -1 for background */
+} GBuf_t;
 
 	/* extern variables and functions: */
 extern int	culled_polys, drawn_polys;
+extern long	frags_rasterized, frags_shaded;
 
 /* from paint.c */
 extern void	paint_scene(void);
 
 /* from rasterize.c */
 extern void     paint_tri(Object_t *op, Tri_t *tri, int usecfb);
+extern void	paint_tris(Object_t *op, int *tris, int n, int usecfb);
+extern int	tri_reject(Object_t *op, Vtx_t *p0, Vtx_t *p1, Vtx_t *p2);
+extern int	tri_cull(Object_t *op, float r);
+extern void	paint_span(TriSetup_t *ts, int x0, int x1, int y, int usecfb);
+extern void	shade_color(ShadeTri_t *sh, Frag_t *f, int x, int y, Colorf_t *color);
+extern void	walk_tri(TriSetup_t *ts, int usecfb);
+extern int	span_bench;
+extern int	span_variant(Object_t *op, Material_t *m);
+extern void	span_report(char *name);
+extern void	shade_pixel_color(TriSetup_t *ts, int x, int y, Colorf_t *color);
+extern void	shade_frag(TriSetup_t *ts, Frag_t *f, int x, int y, rgba_t *pixel);
+
+/* from setup.c */
+extern long	setup_count;
+extern double	setup_usec;
+extern int	setup_tris(TriSetup_t *ts, Object_t *op, int *tris, int n);
+
+/* from depth.c */
+extern void	depth_tris(Object_t *op, int *tris, int n);
+extern void	depth_tri(Object_t *op, Tri_t *tri);
+extern void	depth_span(TriSetup_t *ts, int x0, int x1, int y);
+
+/* from halfspace.c */
+extern int	tiny_tris;
+extern void	halfspace_tri(TriSetup_t *ts, int usecfb);
+extern void	tiny_tri(TriSetup_t *ts, int usecfb);
+
+/* from bin.c */
+extern int	paint_binned, bin_threads;
+extern long	bin_bytes;
+extern double	bin_max_usec, bin_avg_usec;
+extern void	bin_init(void);
+extern void	bin_tri(int obj, int tri);
+extern void	bin_sphere(int obj);
+extern void	bin_render(void);
+extern void	bin_cleanup(void);
+extern void	bin_tri_color(Object_t *op, Tri_t *tri, Colorf_t *color);
+extern double	paint_usec(void);
+
+/* from impostor.c */
+extern int	spheres_drawn;
+extern void	impostor_init(void);
+extern int	sphere_setup(Object_t *op, TriSetup_t *ts);
+extern void	sphere_draw(TriSetup_t *ts);
+extern void	paint_sphere(Object_t *op);
+extern void	screen_to_eye(float fx, float fy, float z, Tri_t *tri, xyz_t *P);
+
+/* from msaa.c */
+extern int	msaa_samples;
+extern long	msaa_bytes, msaa_edge_pixels;
+extern void	msaa_init(void);
+extern void	msaa_tri(TriSetup_t *ts);
+extern void	msaa_sample_pos(int i, float *ox, float *oy);
+extern unsigned int msaa_test(int x, int y, unsigned int covered, float *z);
+extern void	msaa_put(int x, int y, unsigned int pass, float *z, Colorf_t *color);
+extern void	msaa_resolve(void);
+extern void	msaa_cleanup(void);
+
+/* from order.c */
+extern double	order_usec;
+extern int	order_clusters;
+extern void	order_scene(void);
+
+/* from hiz.c */
+extern int	hiz_enabled, hiz_tris_rejected, hiz_objs_rejected;
+extern void	hiz_init(void);
+extern void	hiz_cleanup(void);
+extern void	hiz_mark(int x0, int x1, int y);
+extern int	hiz_tri_hidden(TriSetup_t *ts);
+extern int	hiz_object_hidden(Object_t *op);
+
+/* from deferred.c */
+extern int	paint_deferred;
+extern long	gbuf_bytes, gbuf_writes;
+extern void	deferred_init(void);
+extern void	deferred_write(TriSetup_t *ts, Frag_t *f, int x, int y);
+extern void	deferred_outline(int x0, int y0, int x1, int y1, int x2, int y2);
+extern void	deferred_draw_outlines(void);
+extern void	deferred_resolve(void);
+extern void	deferred_cleanup(void);
+
+/* from shade.c */
+extern void	shade_setup(ShadeTri_t *sh);
+extern void	shade_pixel(ShadeTri_t *sh, ShadeLights_t *sl, xyz_t *N,
+			xyz_t *point, xyz_t *at, xyz_t *view, Colorf_t *shade);
+
+/* from lights.c */
+extern Colorf_t	lights_ambient;
+extern int	light_tiles_x, light_tiles_y, lights_tile_max;
+extern double	lights_tile_avg, lights_usec;
+extern long	lights_tri_sets, lights_tri_total;
+extern int	lights_tri_max;
+extern void	lights_init(void);
+extern void	lights_cull(xyz_t *bmin, xyz_t *bmax);
+extern ShadeLights_t *lights_at(int x, int y);
+extern void	lights_tri(TriLights_t *tl, TriSetup_t *ts);
+extern ShadeLights_t *lights_tri_at(TriLights_t *tl, int x, int y);
+extern void	lights_tri_done(TriLights_t *tl);
+extern void	lights_report(char *name);
+extern void	lights_cleanup(void);
+
+/* from gouraud.c */
+extern int	gouraud_verts;
+extern void	gouraud_init(void);
+extern Colorf_t	*gouraud_vertex(Object_t *op, Tri_t *tri, int v);
+extern void	gouraud_tri(Object_t *op, Tri_t *tri);
+extern void	gouraud_cleanup(void);
 
-/* from paintshade.c */
-extern void	shade_pixel(Object_t *op, Tri_t *tri, 
-			xyz_t *N, xyz_t *point, xyz_t *view, Colorf_t *shade);
+/* from shadow.c */
+extern int	shadow_maps, shadow_polys;
+extern long	shadow_bytes;
+extern double	shadow_usec;
+extern void	shadow_init(void);
+extern int	shadow_index(int i);
+extern float	shadow_lookup(int m, xyz_t *p, xyz_t *n);
+extern void	shadow_cleanup(void);
 
 #endif
 /* __PAINT_H__ */
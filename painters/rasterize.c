@@ -43,56 +43,51 @@
 #include <stdio.h>
 #include <math.h>
 #include <string.h>
+#if (defined __x86_64__ || defined __i386__)
+#include <x86intrin.h>
+#endif
 
 #include "rp.h"
 #include "paint.h"
 
-static void bary_tri_setup(Object_t *op, Tri_t *tri, 
-			Vtx_t *p0, Vtx_t *p1, Vtx_t *p2, int usecfb);
-
-/* compute attribute dx and dy from plane equation */
-static void
-pleq_dxdy(float inv_r, int ax, int ay, int bx, int by, float ac, float bc, 
-	  float *cx, float *cy)
+/* reject degenerate and culled triangles, TRUE if the triangle isn't drawn */
+int
+tri_reject(Object_t *op, Vtx_t *p0, Vtx_t *p1, Vtx_t *p2)
 {
-    *cx = ((float)by * ac) - ((float)ay * bc);
-    *cy = ((float)ax * bc) - ((float)bx * ac);
+    int		Hdx, Hdy, Mdx, Mdy;
 
-    *cx *= inv_r;
-    *cy *= inv_r;
+    	/* edge deltas: */
+    Mdx = p1->sx - p0->sx;          Mdy = p1->sy - p0->sy;
+    Hdx = p2->sx - p0->sx;          Hdy = p2->sy - p0->sy;
+    
+    return (tri_cull(op, Hdx*Mdy - Hdy*Mdx));
 }
 
-/*
- * paint this triangle
- *
- * If usecfb == FALSE, then just update the depth buffer, not the
- * color frame buffer. (this is used by the hidden line renderer)
- *
- */
-void
-paint_tri(Object_t *op, Tri_t *tri, int usecfb)
+/* the same, given the denominator of the plane equation (2x signed area) */
+int
+tri_cull(Object_t *op, float r)
 {
-    Vtx_t	*p0, *p1, *p2;
+    	/* reject degenerate triangles: */
+    if (NearlyZero(r, EpEpsilon)) {
+	RPScene.tiny_rejected_polys++;
+	return (TRUE);
+    }
 
-	/*
-	 * if this triangle was clipped, then we don't want to draw it.
-	 * We know the clip process generated new triangles for the visible
-	 * portions, so drawing this one would be redundant (and potentially
-	 * mathematically error-prone)
-	 */
-    if (Flagged(tri->flags, FLAG_TRI_CLIPPED))
-	return;
+    	/* cull backfacing: */
+    if (Flagged(op->flags, FLAG_CULL_BACK) && r < 0.0) {
+	culled_polys++;
+	return (TRUE);
+    }
 
-    p0 = &(op->verts[tri->v0]);
-    p1 = &(op->verts[tri->v1]);
-    p2 = &(op->verts[tri->v2]);
+    	/* cull frontfacing: */
+    if (Flagged(op->flags, FLAG_CULL_FRONT) && r > 0.0) {
+	culled_polys++;
+	return (TRUE);
+    }
 
-    bary_tri_setup(op, tri, p0, p1, p2, usecfb);
+    return (FALSE);
 }
 
-
-/* setup and rasterize a triangle */
-
 /* rasterizer variable naming conventions:
  *
  * "H" is the high edge, the long edge of the triangle that goes from top to bottom y.
@@ -101,175 +96,495 @@ paint_tri(Object_t *op, Tri_t *tri, int usecfb)
  * "DxD*" are the deltas to walk across in the x direction for each scanline.
  * "DyD*" are the deltas to increment scanline to scanline (y direction) for each attribute)
  *
+ * Triangle setup, which computes these, is in setup.c.
  */
-static void
-bary_tri_setup(Object_t *op, Tri_t *tri, Vtx_t *ip0, Vtx_t *ip1, Vtx_t *ip2, int usecfb)
+
+/*
+ * Specialized span variants:
+ *
+ * The pixel loop is written once, as an always-inlined template that
+ * takes the variant number as a compile-time constant. Each variant
+ * below instantiates it, so the compiler folds away every test on the
+ * object, material, texture and scene state, and the attributes that
+ * aren't interpolated. setup_tris() picks the variant once per triangle
+ * (span_variant()), and paint_span() calls it through span_table[].
+ */
+#ifdef __GNUC__
+#define SPAN_INLINE	static inline __attribute__((always_inline))
+#else
+#define SPAN_INLINE	static inline
+#endif
+
+int	span_bench = FALSE;		/* -v: time each variant */
+long	span_pixels[SPAN_VARIANTS];
+unsigned long long span_cycles[SPAN_VARIANTS];
+
+/* the span variant for this object and material, with the scene state */
+int
+span_variant(Object_t *op, Material_t *m)
 {
-    Material_t	*m;
-    Vtx_t	*tmpp, tmp_buffer, point0, point1, point2, *p0, *p1, *p2;
-    rgba_t	tex_samp;
-    int		ydelh, ydelm, ydell, x, y;
-    int		Hdx, Hdy, Mdx, Mdy;
-    float	dhdy = 0.0, dmdy = 0.0, dldy = 0.0, xminor, xhigh, r, inv_r;
-    Colorf_t	colorsum, polycolor;
-    Colorf_t	Hdcol, Mdcol, DxDcol, DyDcol, thiscolor;
-    float	Hds, Mds, DxDs, DyDs, thiss;
-    float	Hdt, Mdt, DxDt, DyDt, thist;
-    float	Hdw, Mdw, DxDw, DyDw, thisw;
-    float	Hdz, Mdz, DxDz, DyDz, thisz;
-    xyz_t	thispoint;
-    xyz_t	Hdsurf, Mdsurf, DxDsurf, DyDsurf, thissurf;
-    xyz_t	Hdnorm, Mdnorm, DxDnorm, DyDnorm, thisn;
-    xyz_t	Hdeye, Mdeye, DxDeye, DyDeye, thiseye;
-
-
-	/* copy the input points becuase they are shared and we may modify: */
-    bcopy((void *) ip0, &point0, sizeof(Vtx_t)); p0 = &point0;
-    bcopy((void *) ip1, &point1, sizeof(Vtx_t)); p1 = &point1;
-    bcopy((void *) ip2, &point2, sizeof(Vtx_t)); p2 = &point2;
+    Texture_t	*tex = m->texture[MATERIAL_COLOR];
+    int		texmode, light;
+
+    texmode = SPAN_TEX_NONE;
+    if (tex != (Texture_t *) NULL) {
+	if (Flagged(tex->flags, FLAG_TXT_FILT))
+	    texmode = SPAN_TEX_FILT_DECAL;
+	else
+	    texmode = SPAN_TEX_DECAL;
+	if (Flagged(tex->flags, FLAG_TXT_MODULATE))
+	    texmode++;			/* the _MODULATE of each pair */
+    }
 
-    	/* edge deltas: */
-    Mdx = p1->sx - p0->sx;          Mdy = p1->sy - p0->sy;
-    Hdx = p2->sx - p0->sx;          Hdy = p2->sy - p0->sy;
-    
-    r = Hdx*Mdy - Hdy*Mdx;	/* denom of plane equation */
- 
-    	/* reject degenerate triangles: */
-    if (NearlyZero(r, EpEpsilon)) {
-	RPScene.tiny_rejected_polys++;
-	return;
+    light = SPAN_LIGHT_NONE;
+    if (GouraudObject(op))
+	light = SPAN_LIGHT_GOURAUD;
+    else if (Flagged(op->flags, FLAG_LIGHTING))
+	light = Flagged(op->flags, FLAG_FLATSHADE) ? SPAN_LIGHT_FLAT : SPAN_LIGHT_SMOOTH;
+
+    return (SpanVariant(texmode, Flagged(op->flags, FLAG_VERTSHADE) ? 1 : 0, light,
+			Flagged(RPScene.flags, FLAG_FOG) ? 1 : 0,
+			Flagged(RPScene.flags, FLAG_ZBUFFER) ? 1 : 0));
+}
+
+/* evaluate the attributes this triangle needs at pixel x,y from the plane equations */
+SPAN_INLINE void
+frag_at(TriSetup_t *ts, Frag_t *f, int x, int y, const int attribs)
+{
+    Frag_t	*b = &(ts->v[0]);
+    float	dx = x - ts->p[0].sx, dy = y - ts->p[0].sy;
+
+    f->z = b->z + dx*ts->DxDz + dy*ts->DyDz;
+
+    if (attribs & ATTR_COLOR) {
+	f->color.r = b->color.r + dx*ts->DxDcol.r + dy*ts->DyDcol.r;
+	f->color.g = b->color.g + dx*ts->DxDcol.g + dy*ts->DyDcol.g;
+	f->color.b = b->color.b + dx*ts->DxDcol.b + dy*ts->DyDcol.b;
+	f->color.a = b->color.a + dx*ts->DxDcol.a + dy*ts->DyDcol.a;
     }
+    if (attribs & ATTR_TEX) {
+	f->s = b->s + dx*ts->sh.DxDs + dy*ts->sh.DyDs;
+	f->t = b->t + dx*ts->sh.DxDt + dy*ts->sh.DyDt;
+	f->w = b->w + dx*ts->sh.DxDw + dy*ts->sh.DyDw;
+    }
+    if (attribs & ATTR_SURF) {
+	f->surf.x = b->surf.x + dx*ts->DxDsurf.x + dy*ts->DyDsurf.x; 
+	f->surf.y = b->surf.y + dx*ts->DxDsurf.y + dy*ts->DyDsurf.y; 
+	f->surf.z = b->surf.z + dx*ts->DxDsurf.z + dy*ts->DyDsurf.z; 
+    }
+    if (attribs & ATTR_NORM) {
+	f->n.x = b->n.x + dx*ts->DxDnorm.x + dy*ts->DyDnorm.x;
+	f->n.y = b->n.y + dx*ts->DxDnorm.y + dy*ts->DyDnorm.y;
+	f->n.z = b->n.z + dx*ts->DxDnorm.z + dy*ts->DyDnorm.z;
+    } else {
+	f->n = ts->sh.tri->normal;		/* FLATSHADE */
+    }
+    if (attribs & ATTR_EYE) {
+	f->eye.x = b->eye.x + dx*ts->DxDeye.x + dy*ts->DyDeye.x;
+	f->eye.y = b->eye.y + dx*ts->DxDeye.y + dy*ts->DyDeye.y;
+	f->eye.z = b->eye.z + dx*ts->DxDeye.z + dy*ts->DyDeye.z;
+    }
+    if (attribs & ATTR_LIT) {
+	f->lit.r = b->lit.r + dx*ts->DxDlit.r + dy*ts->DyDlit.r;
+	f->lit.g = b->lit.g + dx*ts->DxDlit.g + dy*ts->DyDlit.g;
+	f->lit.b = b->lit.b + dx*ts->DxDlit.b + dy*ts->DyDlit.b;
+	f->lit.a = b->lit.a + dx*ts->DxDlit.a + dy*ts->DyDlit.a;
+    }
+}
 
-    	/* cull backfacing: */
-    if (Flagged(op->flags, FLAG_CULL_BACK) && r < 0.0) {
-	culled_polys++;
-	return;
+/* step the attributes one pixel to the right */
+SPAN_INLINE void
+frag_step(TriSetup_t *ts, Frag_t *f, const int attribs)
+{
+    f->z += ts->DxDz;
+
+    if (attribs & ATTR_COLOR) {
+	f->color.r += ts->DxDcol.r;
+	f->color.g += ts->DxDcol.g;
+	f->color.b += ts->DxDcol.b;
+	f->color.a += ts->DxDcol.a;
     }
+    if (attribs & ATTR_TEX) {
+	f->s += ts->sh.DxDs;
+	f->t += ts->sh.DxDt;
+	f->w += ts->sh.DxDw;
+    }
+    if (attribs & ATTR_SURF) {
+	f->surf.x += ts->DxDsurf.x;
+	f->surf.y += ts->DxDsurf.y;
+	f->surf.z += ts->DxDsurf.z;
+    }
+    if (attribs & ATTR_NORM) {
+	f->n.x += ts->DxDnorm.x;
+	f->n.y += ts->DxDnorm.y;
+	f->n.z += ts->DxDnorm.z;
+    }
+    if (attribs & ATTR_EYE) {
+	f->eye.x += ts->DxDeye.x;
+	f->eye.y += ts->DxDeye.y;
+	f->eye.z += ts->DxDeye.z;
+    }
+    if (attribs & ATTR_LIT) {
+	f->lit.r += ts->DxDlit.r;
+	f->lit.g += ts->DxDlit.g;
+	f->lit.b += ts->DxDlit.b;
+	f->lit.a += ts->DxDlit.a;
+    }
+}
 
-    	/* cull frontfacing: */
-    if (Flagged(op->flags, FLAG_CULL_FRONT) && r > 0.0) {
-	culled_polys++;
+/* texture, light and fog a fragment, starting from its base color in color */
+SPAN_INLINE void
+shade_color_v(ShadeTri_t *sh, Frag_t *f, int x, int y, Colorf_t *color, const int v)
+{
+    Colorf_t	colorsum;
+
+    colorsum = *color;
+
+    if (SpanTex(v) != SPAN_TEX_NONE) {
+	Texture_t	*tex = sh->m->texture[MATERIAL_COLOR];
+	rgba_t		tex_samp;
+	Colorf_t	texcolor;
+
+	if (SpanTex(v) == SPAN_TEX_FILT_DECAL || SpanTex(v) == SPAN_TEX_FILT_MODULATE) {
+	    tex_samp = RPFilterSampleTexture(tex, f->s, f->t, f->w,
+					   sh->DxDs, sh->DyDs, sh->DxDt, sh->DyDt,
+					   sh->DxDw, sh->DyDw);
+	} else {
+	    tex_samp = RPPointSampleTexture(tex, f->s, f->t, f->w);
+	}
+
+	texcolor.r = (float)tex_samp.r / MAX_COLOR_VAL;
+	texcolor.g = (float)tex_samp.g / MAX_COLOR_VAL;
+	texcolor.b = (float)tex_samp.b / MAX_COLOR_VAL;
+	texcolor.a = (float)tex_samp.a / MAX_COLOR_VAL;
+
+	if (SpanTex(v) == SPAN_TEX_MODULATE || SpanTex(v) == SPAN_TEX_FILT_MODULATE) {
+	    colorsum.r *= texcolor.r;
+	    colorsum.g *= texcolor.g;
+	    colorsum.b *= texcolor.b;
+	    colorsum.a *= texcolor.a;
+	} else {	/* decal, replace vert/poly color with tex color */
+	    colorsum.r = texcolor.r;
+	    colorsum.g = texcolor.g;
+	    colorsum.b = texcolor.b;
+	    colorsum.a = texcolor.a;
+	}
+    }
+
+    if (SpanLight(v) == SPAN_LIGHT_GOURAUD) {
+	    /* lit at the vertices (gouraud.c), interpolated */
+	colorsum.r *= f->lit.r;
+	colorsum.g *= f->lit.g;
+	colorsum.b *= f->lit.b;
+	colorsum.a *= f->lit.a;
+
+    } else if (SpanLight(v) != SPAN_LIGHT_NONE) {
+	ShadeLights_t	*sl = (sh->lights != (TriLights_t *) NULL) ?
+			      lights_tri_at(sh->lights, x, y) : lights_at(x, y);
+	Colorf_t	shadeval;
+	xyz_t		at;
+
+	    /* the shadow lookups need the point where the pixel's ray meets the
+	     * surface: surf is interpolated linearly in screen space, which is
+	     * close enough for the lighting but not for the shadow map texels
+	     * (a sphere's is exact)
+	     */
+	if (sl->shadows) {
+	    if (sh->op->type == OBJ_TYPE_SPHERE)
+		at = f->surf;
+	    else
+		screen_to_eye((float) x, (float) y, f->z, sh->tri, &at);
+	}
+	shade_pixel(sh, sl, &(f->n), &(f->surf), &at, &(f->eye), &shadeval);
+
+	/* mult colorsum by shade values */
+	colorsum.r *= shadeval.r;
+	colorsum.g *= shadeval.g;
+	colorsum.b *= shadeval.b;
+	colorsum.a *= shadeval.a;
+    }
+
+	/* we interpolate the world space z (not quite correct) so
+	 * we can simplify the fog calculations matching the librp
+	 * math... that's why we are using surf.z (fog z) instead of
+	 * z, which we use for the zbuffer.
+	 */
+    if (SpanFog(v) && f->surf.z < RPScene.fog_start) {
+        float           fogf;
+        Colorf_t        new;
+
+        if (f->surf.z < RPScene.fog_end) {
+            new.r = RPScene.fog_color.r;
+            new.g = RPScene.fog_color.g;
+            new.b = RPScene.fog_color.b;
+        } else {
+            fogf = (f->surf.z - RPScene.fog_start) / 
+		(RPScene.fog_end - RPScene.fog_start);
+            new.r = fogf * RPScene.fog_color.r + (1.0 - fogf) * colorsum.r;
+            new.g = fogf * RPScene.fog_color.g + (1.0 - fogf) * colorsum.g;
+            new.b = fogf * RPScene.fog_color.b + (1.0 - fogf) * colorsum.b;
+        }
+
+        colorsum.r = new.r;
+        colorsum.g = new.g;
+        colorsum.b = new.b;
+    }
+
+    *color = colorsum;
+}
+
+/* the general (unspecialized) version, for the deferred resolve */
+void
+shade_color(ShadeTri_t *sh, Frag_t *f, int x, int y, Colorf_t *color)
+{
+    shade_color_v(sh, f, x, y, color, span_variant(sh->op, sh->m));
+}
+
+/* the shaded pixel value at x,y of a triangle */
+SPAN_INLINE void
+shade_fragment(TriSetup_t *ts, Frag_t *f, int x, int y, rgba_t *pixel, const int v)
+{
+    Colorf_t	colorsum;
+
+    if (SpanVert(v))
+	colorsum = f->color;
+    else
+	colorsum = ts->polycolor;
+
+    shade_color_v(&(ts->sh), f, x, y, &colorsum, v);
+
+    pixel->r = (u8) Clamp0255(colorsum.r * MAX_COLOR_VAL);
+    pixel->g = (u8) Clamp0255(colorsum.g * MAX_COLOR_VAL);
+    pixel->b = (u8) Clamp0255(colorsum.b * MAX_COLOR_VAL);
+    pixel->a = (u8) Clamp0255(colorsum.a * MAX_COLOR_VAL);
+}
+
+/* the span template: shade the (clipped) pixels x0 to x1 of scanline y,
+ * into a row of colors written out together (RPPutColorSpan())
+ */
+SPAN_INLINE void
+span_template(TriSetup_t *ts, int x0, int x1, int y, const int v)
+{
+    SetupVtx_t	*p0 = &(ts->p[0]);
+    Frag_t	f;
+    rgba_t	color[MAX_XRES];
+    float	z[MAX_XRES];
+    u8		mask[MAX_XRES];
+    int		x, i, next;
+
+    if (!SpanZbuf(v)) {
+	ts->shaded += x1 - x0 + 1;
+	for (x=x0; x<=x1; x++) {
+	    if (x == x0 || (x % BIN_TILE) == 0)	/* (see below) */
+		frag_at(ts, &f, x, y, SpanAttribs(v));
+	    shade_fragment(ts, &f, x, y, &(color[x-x0]), v);
+	    frag_step(ts, &f, SpanAttribs(v));
+	}
+	RPPutColorSpan(x0, x1, y, color, (u8 *) NULL);
 	return;
     }
-	/* choose base pixel color...
- 	 * 
-         * either MATERIAL, RANDSHADE, or POLYSHADE
-	 *
-	 * (cannot combine these terms for now)
-	 *
+
+	/* early depth test, for the whole span: only the fragments that
+	 * pass get their attributes evaluated and shaded. The attributes
+	 * are stepped along runs of passing pixels, and re-evaluated after
+	 * a gap, and at every BIN_TILE column. Each pixel's z comes from the
+	 * plane equation. So a span cut at a tile edge (RENDER06) gets the
+	 * same depths and attributes as the whole span.
 	 */
+    for (i=0; i<=x1-x0; i++) {
+	z[i] = p0->sz + (x0 + i - p0->sx)*ts->DxDz + (y - p0->sy)*ts->DyDz;
+	mask[i] = TRUE;
+    }
+    if (RPTestPutDepthSpan(x0, x1, y, z, mask) == 0)
+	return;
+
+    memset(&f, 0, sizeof(Frag_t));	/* (frag_at() sets it before it's used) */
+    next = x0 - 1;
+    for (x=x0; x<=x1; x++) {
+	if (!mask[x-x0])
+	    continue;
 
-    m = &(op->materials[tri->material_id]);
-    polycolor.r = m->color.r; 	/* start with material color: */
-    polycolor.g = m->color.g;
-    polycolor.b = m->color.b;
-    polycolor.a = m->color.a;
-
-    if (Flagged(op->flags, FLAG_RANDSHADE)) {
-	/* useful for debugging */
-	polycolor.r = RPRandom();
-	polycolor.g = RPRandom();
-	polycolor.b = RPRandom();
-	polycolor.a = 1.0;
-    } else if (Flagged(op->flags, FLAG_POLYSHADE)) {
-	polycolor.r = tri->color.r;
-	polycolor.g = tri->color.g;
-	polycolor.b = tri->color.b;
-	polycolor.a = tri->color.a;
-    } else if (Flagged(op->flags, FLAG_VERTSHADE)) {
-	/* do nothing, rasterizer loop will interp vertex colors */
+	if (x != next || (x % BIN_TILE) == 0)
+	    frag_at(ts, &f, x, y, SpanAttribs(v));
+	f.z = z[x-x0];
+
+	shade_fragment(ts, &f, x, y, &(color[x-x0]), v);
+	ts->shaded++;
+
+	frag_step(ts, &f, SpanAttribs(v));
+	next = x + 1;
     }
+    RPPutColorSpan(x0, x1, y, color, mask);
+}
 
-	/* fix texture coordinates, we want to rasterize in perspected space: */
-    if (Flagged(tri->flags, FLAG_TRI_CLIP_GEN)) {
-		/* texture coord already in s,t */
-	p0->s *= p0->inv_w;
-	p0->t *= p0->inv_w;
-	p1->s *= p1->inv_w;
-	p1->t *= p1->inv_w;
-	p2->s *= p2->inv_w;
-	p2->t *= p2->inv_w;
-    } else {
-        if (op->tcoords != (uv_t *) NULL) {
-            p0->s = op->tcoords[tri->t0].u * p0->inv_w;
-            p0->t = op->tcoords[tri->t0].v * p0->inv_w;
-            p1->s = op->tcoords[tri->t1].u * p1->inv_w;
-            p1->t = op->tcoords[tri->t1].v * p1->inv_w;
-            p2->s = op->tcoords[tri->t2].u * p2->inv_w;
-            p2->t = op->tcoords[tri->t2].v * p2->inv_w;
-        }
+/* the pixel template: the shaded color of one pixel (for the multisample rasterizer) */
+SPAN_INLINE void
+pixel_template(TriSetup_t *ts, int x, int y, Colorf_t *color, const int v)
+{
+    Frag_t	f;
+
+    frag_at(ts, &f, x, y, SpanAttribs(v));
+    *color = SpanVert(v) ? f.color : ts->polycolor;
+    shade_color_v(&(ts->sh), &f, x, y, color, v);
+}
+
+typedef void (*SpanFunc_t)(TriSetup_t *ts, int x0, int x1, int y);
+typedef void (*PixelFunc_t)(TriSetup_t *ts, int x, int y, Colorf_t *color);
+typedef void (*FragFunc_t)(TriSetup_t *ts, Frag_t *f, int x, int y, rgba_t *pixel);
+
+	/* instantiate the variants, ten at a time: */
+#define SPAN_FUNC(n)	static void span_##n(TriSetup_t *ts, int x0, int x1, int y) \
+			{ span_template(ts, x0, x1, y, n); } \
+			static void pixel_##n(TriSetup_t *ts, int x, int y, Colorf_t *color) \
+			{ pixel_template(ts, x, y, color, n); } \
+			static void frag_##n(TriSetup_t *ts, Frag_t *f, int x, int y, rgba_t *pixel) \
+			{ shade_fragment(ts, f, x, y, pixel, n); }
+#define SPAN_FUNCS(a)	SPAN_FUNC(a##0) SPAN_FUNC(a##1) SPAN_FUNC(a##2) SPAN_FUNC(a##3) \
+			SPAN_FUNC(a##4) SPAN_FUNC(a##5) SPAN_FUNC(a##6) SPAN_FUNC(a##7) \
+			SPAN_FUNC(a##8) SPAN_FUNC(a##9)
+#define SPAN_NAMES(p,a)	p##a##0, p##a##1, p##a##2, p##a##3, p##a##4, \
+			p##a##5, p##a##6, p##a##7, p##a##8, p##a##9
+
+SPAN_FUNCS()  SPAN_FUNCS(1) SPAN_FUNCS(2) SPAN_FUNCS(3) SPAN_FUNCS(4) SPAN_FUNCS(5)
+SPAN_FUNCS(6) SPAN_FUNCS(7) SPAN_FUNCS(8) SPAN_FUNCS(9) SPAN_FUNCS(10) SPAN_FUNCS(11)
+SPAN_FUNCS(12) SPAN_FUNCS(13) SPAN_FUNCS(14) SPAN_FUNCS(15)
+
+static SpanFunc_t span_table[SPAN_VARIANTS] = {
+    SPAN_NAMES(span_,),  SPAN_NAMES(span_,1), SPAN_NAMES(span_,2), SPAN_NAMES(span_,3),
+    SPAN_NAMES(span_,4), SPAN_NAMES(span_,5), SPAN_NAMES(span_,6), SPAN_NAMES(span_,7),
+    SPAN_NAMES(span_,8), SPAN_NAMES(span_,9), SPAN_NAMES(span_,10), SPAN_NAMES(span_,11),
+    SPAN_NAMES(span_,12), SPAN_NAMES(span_,13), SPAN_NAMES(span_,14), SPAN_NAMES(span_,15)
+};
+
+static PixelFunc_t pixel_table[SPAN_VARIANTS] = {
+    SPAN_NAMES(pixel_,),  SPAN_NAMES(pixel_,1), SPAN_NAMES(pixel_,2), SPAN_NAMES(pixel_,3),
+    SPAN_NAMES(pixel_,4), SPAN_NAMES(pixel_,5), SPAN_NAMES(pixel_,6), SPAN_NAMES(pixel_,7),
+    SPAN_NAMES(pixel_,8), SPAN_NAMES(pixel_,9), SPAN_NAMES(pixel_,10), SPAN_NAMES(pixel_,11),
+    SPAN_NAMES(pixel_,12), SPAN_NAMES(pixel_,13), SPAN_NAMES(pixel_,14), SPAN_NAMES(pixel_,15)
+};
+
+static FragFunc_t frag_table[SPAN_VARIANTS] = {
+    SPAN_NAMES(frag_,),  SPAN_NAMES(frag_,1), SPAN_NAMES(frag_,2), SPAN_NAMES(frag_,3),
+    SPAN_NAMES(frag_,4), SPAN_NAMES(frag_,5), SPAN_NAMES(frag_,6), SPAN_NAMES(frag_,7),
+    SPAN_NAMES(frag_,8), SPAN_NAMES(frag_,9), SPAN_NAMES(frag_,10), SPAN_NAMES(frag_,11),
+    SPAN_NAMES(frag_,12), SPAN_NAMES(frag_,13), SPAN_NAMES(frag_,14), SPAN_NAMES(frag_,15)
+};
+
+/* the shaded pixel value at x,y of a triangle, given its attributes there (tiny_tri()) */
+void
+shade_frag(TriSetup_t *ts, Frag_t *f, int x, int y, rgba_t *pixel)
+{
+    (*frag_table[ts->variant])(ts, f, x, y, pixel);
+}
+
+/* the shaded color of pixel x,y of a triangle, before any blending */
+void
+shade_pixel_color(TriSetup_t *ts, int x, int y, Colorf_t *color)
+{
+    (*pixel_table[ts->variant])(ts, x, y, color);
+}
+
+/* print the cycles per pixel of each variant that ran (the -v micro-benchmark) */
+void
+span_report(char *name)
+{
+    static char	*texname[] = {"none", "decal", "modulate", "filt-decal", "filt-modulate"};
+    static char	*lightname[] = {"none", "flat", "smooth", "gouraud"};
+    int		v;
+
+    if (!span_bench)
+	return;
+
+    fprintf(stderr,"%s : span variant  texture        vert  light    fog  zbuf        pixels  cycles/pixel\n", name);
+    for (v=0; v<SPAN_VARIANTS; v++) {
+	if (span_pixels[v] == 0)
+	    continue;
+	fprintf(stderr,"%s : %12d  %-13s  %4s  %-7s  %4s  %4s  %12ld  %12.1f\n", name, v,
+		texname[SpanTex(v)], SpanVert(v) ? "yes" : "no",
+		lightname[SpanLight(v)], SpanFog(v) ? "yes" : "no",
+		SpanZbuf(v) ? "yes" : "no", span_pixels[v],
+		(double) span_cycles[v] / (double) span_pixels[v]);
     }
+}
+
+/* rasterize the pixels x0 to x1 of scanline y, stepping the attributes across */
+void
+paint_span(TriSetup_t *ts, int x0, int x1, int y, int usecfb)
+{
+    SetupVtx_t	*p0 = &(ts->p[0]);
+    Frag_t	f;
+    float	z[MAX_XRES];
+    u8		mask[MAX_XRES];
+    int		x, i, next;
 
-    	/* y-sort the 3 vertices of the triangle: */
-    tmpp = &(tmp_buffer);
-    if (p0->sy > p1->sy) {
-	tmpp = p0; p0 = p1; p1 = tmpp;
+    if (y < ts->miny || y > ts->maxy)
+	return;
+    x0 = Max(x0, ts->minx);
+    x1 = Min(x1, ts->maxx);
+    if (x1 < x0)
+	return;
+
+    ts->rasterized += x1 - x0 + 1;
+    if (hiz_enabled)
+	hiz_mark(x0, x1, y);
+
+    if (!usecfb) { 	/* write zbuffer only (depth.c) */
+	depth_span(ts, x0, x1, y);
+	return;
     }
-    if (p0->sy > p2->sy) {
-	tmpp = p0; p0 = p2; p2 = tmpp;
+
+    if (paint_deferred) {	/* fill the G-buffer, shade later */
+	if (!Flagged(RPScene.flags, FLAG_ZBUFFER)) {
+	    frag_at(ts, &f, x0, y, ts->attribs);
+	    for (x=x0; x<=x1; x++) {
+		deferred_write(ts, &f, x, y);
+		frag_step(ts, &f, ts->attribs);
+	    }
+	    return;
+	}
+	for (i=0; i<=x1-x0; i++) {	/* (plane equation z, like the forward spans) */
+	    z[i] = p0->sz + (x0 + i - p0->sx)*ts->DxDz + (y - p0->sy)*ts->DyDz;
+	    mask[i] = TRUE;
+	}
+	if (RPTestPutDepthSpan(x0, x1, y, z, mask) == 0)
+	    return;
+
+	next = x0 - 1;
+	for (x=x0; x<=x1; x++) {
+	    if (!mask[x-x0])
+		continue;
+
+	    if (x != next)
+		frag_at(ts, &f, x, y, ts->attribs);
+	    f.z = z[x-x0];		/* (as tested, like the forward spans) */
+
+	    deferred_write(ts, &f, x, y);
+
+	    frag_step(ts, &f, ts->attribs);
+	    next = x + 1;
+	}
+	return;
     }
-    if (p1->sy > p2->sy) {
-	tmpp = p1; p1 = p2; p2 = tmpp;
+
+    if (span_bench) {
+	unsigned long long	start = PaintCycles();
+
+	(*span_table[ts->variant])(ts, x0, x1, y);
+	span_cycles[ts->variant] += PaintCycles() - start;
+	span_pixels[ts->variant] += x1 - x0 + 1;
+	return;
     }
 
-    	/* edge deltas: */
-    Mdx = p1->sx - p0->sx;          Mdy = p1->sy - p0->sy;
-    Hdx = p2->sx - p0->sx;          Hdy = p2->sy - p0->sy;
-    r = Hdx*Mdy - Hdy*Mdx;
-    inv_r = 1.0/r;
-
-    	/* edge slopes: */
-    ydelh = p2->sy - p0->sy;
-    ydelm = p1->sy - p0->sy;
-    ydell = p2->sy - p1->sy;
-
-    if (ydelh != 0) dhdy = (float)(p2->sx - p0->sx)/(float) ydelh;
-    if (ydelm != 0) dmdy = (float)(p1->sx - p0->sx)/(float) ydelm;
-    if (ydell != 0) dldy = (float)(p2->sx - p1->sx)/(float) ydell;
-
-    	/* attribute deltas: */
-    Hdcol.r = p2->r - p0->r;   		Mdcol.r = p1->r - p0->r;
-    Hdcol.g = p2->g - p0->g;   		Mdcol.g = p1->g - p0->g;
-    Hdcol.b = p2->b - p0->b;   		Mdcol.b = p1->b - p0->b;
-    Hdcol.a = p2->a - p0->a;   		Mdcol.a = p1->a - p0->a;
-
-    Hds = p2->s - p0->s;    		Mds = p1->s - p0->s;
-    Hdt = p2->t - p0->t;    		Mdt = p1->t - p0->t;
-    Hdw = p2->inv_w - p0->inv_w;    	Mdw = p1->inv_w - p0->inv_w;
-    Hdz = p2->sz - p0->sz;  		Mdz = p1->sz - p0->sz;
-    Hdsurf.x = p2->pos.x - p0->pos.x;	Mdsurf.x = p1->pos.x - p0->pos.x;
-    Hdsurf.y = p2->pos.y - p0->pos.y;	Mdsurf.y = p1->pos.y - p0->pos.y;
-    Hdsurf.z = p2->pos.z - p0->pos.z;	Mdsurf.z = p1->pos.z - p0->pos.z;
-
-    Hdnorm.x = p2->n.x - p0->n.x;  	Mdnorm.x = p1->n.x - p0->n.x;
-    Hdnorm.y = p2->n.y - p0->n.y;  	Mdnorm.y = p1->n.y - p0->n.y;
-    Hdnorm.z = p2->n.z - p0->n.z;  	Mdnorm.z = p1->n.z - p0->n.z;
-
-    Hdeye.x = p2->e.x - p0->e.x;  	Mdeye.x = p1->e.x - p0->e.x;
-    Hdeye.y = p2->e.y - p0->e.y;  	Mdeye.y = p1->e.y - p0->e.y;
-    Hdeye.z = p2->e.z - p0->e.z;  	Mdeye.z = p1->e.z - p0->e.z;
-
-    	/* attribute slopes: */
-    pleq_dxdy(inv_r, Hdx, Hdy, Mdx, Mdy, Hdcol.r, Mdcol.r, &DxDcol.r, &DyDcol.r);
-    pleq_dxdy(inv_r, Hdx, Hdy, Mdx, Mdy, Hdcol.g, Mdcol.g, &DxDcol.g, &DyDcol.g);
-    pleq_dxdy(inv_r, Hdx, Hdy, Mdx, Mdy, Hdcol.b, Mdcol.b, &DxDcol.b, &DyDcol.b);
-    pleq_dxdy(inv_r, Hdx, Hdy, Mdx, Mdy, Hdcol.a, Mdcol.a, &DxDcol.a, &DyDcol.a);
-    pleq_dxdy(inv_r, Hdx, Hdy, Mdx, Mdy, Hds, Mds, &DxDs, &DyDs);
-    pleq_dxdy(inv_r, Hdx, Hdy, Mdx, Mdy, Hdt, Mdt, &DxDt, &DyDt);
-    pleq_dxdy(inv_r, Hdx, Hdy, Mdx, Mdy, Hdw, Mdw, &DxDw, &DyDw);
-    pleq_dxdy(inv_r, Hdx, Hdy, Mdx, Mdy, Hdz, Mdz, &DxDz, &DyDz);
-
-    pleq_dxdy(inv_r, Hdx, Hdy, Mdx, Mdy, Hdsurf.x, Mdsurf.x, &DxDsurf.x, &DyDsurf.x);
-    pleq_dxdy(inv_r, Hdx, Hdy, Mdx, Mdy, Hdsurf.y, Mdsurf.y, &DxDsurf.y, &DyDsurf.y);
-    pleq_dxdy(inv_r, Hdx, Hdy, Mdx, Mdy, Hdsurf.z, Mdsurf.z, &DxDsurf.z, &DyDsurf.z);
-
-    pleq_dxdy(inv_r, Hdx, Hdy, Mdx, Mdy, Hdnorm.x, Mdnorm.x, &DxDnorm.x, &DyDnorm.x);
-    pleq_dxdy(inv_r, Hdx, Hdy, Mdx, Mdy, Hdnorm.y, Mdnorm.y, &DxDnorm.y, &DyDnorm.y);
-    pleq_dxdy(inv_r, Hdx, Hdy, Mdx, Mdy, Hdnorm.z, Mdnorm.z, &DxDnorm.z, &DyDnorm.z);
-
-    pleq_dxdy(inv_r, Hdx, Hdy, Mdx, Mdy, Hdeye.x, Mdeye.x, &DxDeye.x, &DyDeye.x);
-    pleq_dxdy(inv_r, Hdx, Hdy, Mdx, Mdy, Hdeye.y, Mdeye.y, &DxDeye.y, &DyDeye.y);
-    pleq_dxdy(inv_r, Hdx, Hdy, Mdx, Mdy, Hdeye.z, Mdeye.z, &DxDeye.z, &DyDeye.z);
+    (*span_table[ts->variant])(ts, x0, x1, y);
+}
+
+/* rasterize a triangle by walking the edges, scanline by scanline */
+void
+walk_tri(TriSetup_t *ts, int usecfb)
+{
+    SetupVtx_t	*p0 = &(ts->p[0]), *p1 = &(ts->p[1]), *p2 = &(ts->p[2]);
+    float	xminor, xhigh;
+    int		y;
 
     y = p0->sy;
     xhigh = (float)p0->sx;
@@ -280,184 +595,100 @@ bary_tri_setup(Object_t *op, Tri_t *tri, Vtx_t *ip0, Vtx_t *ip1, Vtx_t *ip2, int
 	xminor = (float)p0->sx;
 
 
-	/* rasterize from ymin to ymax: */
-    while (y <= p2->sy) {
-
-	x = (int)xhigh;
-
-	do { 		/* walk the x's */
-	    /* barycentric evaluation of vertex color, normal, and texcoord: */
-	    thiscolor.r = p0->r     + (x - p0->sx)*DxDcol.r  + (y - p0->sy)*DyDcol.r;
-	    thiscolor.g = p0->g     + (x - p0->sx)*DxDcol.g  + (y - p0->sy)*DyDcol.g;
-	    thiscolor.b = p0->b     + (x - p0->sx)*DxDcol.b  + (y - p0->sy)*DyDcol.b;
-	    thiscolor.a = p0->a     + (x - p0->sx)*DxDcol.a  + (y - p0->sy)*DyDcol.a;
-	    thiss       = p0->s     + (x - p0->sx)*DxDs      + (y - p0->sy)*DyDs;
-	    thist       = p0->t     + (x - p0->sx)*DxDt      + (y - p0->sy)*DyDt;
-	    thisw       = p0->inv_w + (x - p0->sx)*DxDw      + (y - p0->sy)*DyDw;
-	    thisz       = p0->sz    + (x - p0->sx)*DxDz      + (y - p0->sy)*DyDz;
-	    thissurf.x  = p0->pos.x + (x - p0->sx)*DxDsurf.x + (y - p0->sy)*DyDsurf.x; 
-	    thissurf.y  = p0->pos.y + (x - p0->sx)*DxDsurf.y + (y - p0->sy)*DyDsurf.y; 
-	    thissurf.z  = p0->pos.z + (x - p0->sx)*DxDsurf.z + (y - p0->sy)*DyDsurf.z; 
-
-	    if (NearlyZero(thisw, Epsilon)) {
-		thispoint.x = p0->sx;
-		thispoint.y = p0->sy;
-		thispoint.z = p0->sz;
-  	    } else {
-	        thispoint.x = p0->sx * thisw;
-	        thispoint.y = p0->sy * thisw;
-		thispoint.z = p0->sz * thisw;
-	    }
-
-	    if (Flagged(op->flags, FLAG_FLATSHADE)) {
-		thisn.x = tri->normal.x;
-		thisn.y = tri->normal.y;
-		thisn.z = tri->normal.z;
-	    } else {
-	        thisn.x = p0->n.x + (x - p0->sx)*DxDnorm.x + (y - p0->sy)*DyDnorm.x;
-		thisn.y = p0->n.y + (x - p0->sx)*DxDnorm.y + (y - p0->sy)*DyDnorm.y;
-		thisn.z = p0->n.z + (x - p0->sx)*DxDnorm.z + (y - p0->sy)*DyDnorm.z;
-	    }
-
-	    thiseye.x = p0->e.x + (x - p0->sx)*DxDeye.x + (y - p0->sy)*DyDeye.x;
-	    thiseye.y = p0->e.y + (x - p0->sx)*DxDeye.y + (y - p0->sy)*DyDeye.y;
-	    thiseye.z = p0->e.z + (x - p0->sx)*DxDeye.z + (y - p0->sy)*DyDeye.z;
-
-	    if (Flagged(op->flags, FLAG_VERTSHADE)) {	
-		colorsum.r = thiscolor.r;
-		colorsum.g = thiscolor.g;
-		colorsum.b = thiscolor.b;
-		colorsum.a = thiscolor.a;
-	    } else {
-		colorsum.r = polycolor.r;
-		colorsum.g = polycolor.g;
-		colorsum.b = polycolor.b;
-		colorsum.a = polycolor.a;
-	    }
-
-	    if (m->texture[MATERIAL_COLOR] != (Texture_t *) NULL) {
-		Colorf_t	texcolor;
-
-		if (Flagged(m->texture[MATERIAL_COLOR]->flags, FLAG_TXT_FILT)) {
-		    tex_samp = RPFilterSampleTexture(m->texture[MATERIAL_COLOR],
-						   thiss, thist, thisw,
-						   DxDs, DyDs, DxDt, DyDt,
-						   DxDw, DyDw);
-		} else {
-		    tex_samp = RPPointSampleTexture(m->texture[MATERIAL_COLOR],
-						    thiss, thist, thisw);
-		}
-
-		texcolor.r = (float)tex_samp.r / MAX_COLOR_VAL;
-		texcolor.g = (float)tex_samp.g / MAX_COLOR_VAL;
-		texcolor.b = (float)tex_samp.b / MAX_COLOR_VAL;
-		texcolor.a = (float)tex_samp.a / MAX_COLOR_VAL;
-
-		if (Flagged(m->texture[MATERIAL_COLOR]->flags, FLAG_TXT_MODULATE)) {
-		    colorsum.r *= texcolor.r;
-		    colorsum.g *= texcolor.g;
-		    colorsum.b *= texcolor.b;
-		    colorsum.a *= texcolor.a;
-		} else {	/* decal, replace vert/poly color with tex color */
-		    colorsum.r = texcolor.r;
-		    colorsum.g = texcolor.g;
-		    colorsum.b = texcolor.b;
-		    colorsum.a = texcolor.a;
-		}
- 	    }
-
-	    if (Flagged(op->flags, FLAG_LIGHTING)) {
-		Colorf_t	shadeval;
-
-		shade_pixel(op, tri, &thisn, &thissurf, &thiseye, &shadeval);
-
-		/* mult colorsum by shade values */
-		colorsum.r *= shadeval.r;
-		colorsum.g *= shadeval.g;
-		colorsum.b *= shadeval.b;
-		colorsum.a *= shadeval.a;
-  	    }
-
-		/* we interpolate the world space z (not quite correct) so
-		 * we can simplify the fog calculations matching the librp
-		 * math... that's why we are using thissurf.z (fog z) instead of
-		 * thisz, which we use for the zbuffer.
-		 */
-	    if (Flagged(RPScene.flags, FLAG_FOG) && thissurf.z < RPScene.fog_start) {
-                float           f;
-                Colorf_t        new;
-
-                if (thissurf.z < RPScene.fog_end) {
-                    new.r = RPScene.fog_color.r;
-                    new.g = RPScene.fog_color.g;
-                    new.b = RPScene.fog_color.b;
-                } else {
-                    f = (thissurf.z - RPScene.fog_start) / 
-			(RPScene.fog_end - RPScene.fog_start);
-                    new.r = f * RPScene.fog_color.r + (1.0 - f) * colorsum.r;
-                    new.g = f * RPScene.fog_color.g + (1.0 - f) * colorsum.g;
-                    new.b = f * RPScene.fog_color.b + (1.0 - f) * colorsum.b;
-                }
-
-                colorsum.r = new.r;
-                colorsum.g = new.g;
-                colorsum.b = new.b;
-	    }
-
-	    thiscolor.r = Clamp0255(colorsum.r * MAX_COLOR_VAL);
-	    thiscolor.g = Clamp0255(colorsum.g * MAX_COLOR_VAL);
-	    thiscolor.b = Clamp0255(colorsum.b * MAX_COLOR_VAL);
-	    thiscolor.a = Clamp0255(colorsum.a * MAX_COLOR_VAL);
-
-	    if (usecfb) {
-
-	        if (Flagged(RPScene.flags, FLAG_ZBUFFER)) {
-		    if (RPTestDepthFB(x, y, thisz)) {
-		        RPPutDepthFBPixel(x, y, thisz);
-		        RPPutColorFBPixel(x, y, (int)thiscolor.r, (int)thiscolor.g,
-				  (int)thiscolor.b, (int)thiscolor.a);
-		    }
-	        } else {
-		    RPPutColorFBPixel(x, y, (int)thiscolor.r, (int)thiscolor.g,
-			      (int)thiscolor.b, (int)thiscolor.a);
-	        }
-
-	    } else { 	/* write zbuffer only */
-
-		if (RPTestDepthFB(x, y, thisz)) {
-		    RPPutDepthFBPixel(x, y, thisz);
-		}
-	    }
-	    
-	    if (x == (int)(xminor))
-		break;	/* exit from inner (x) loop */
-	    
-	    if (x < (int)(xminor)) {	/* walk direction changes when we hit low edge */
-		x++;
-	    } else {
-		x--;
-	    }
+	/* rasterize from ymin to ymax (or the bottom of the screen/tile): */
+    while (y <= p2->sy && y <= ts->maxy) {
 
-	} while (TRUE);		/* walk the x's */
+	    /* the span from the high edge to the minor edge (either may be left) */
+	if ((int)xhigh < (int)xminor)
+	    paint_span(ts, (int)xhigh, (int)xminor, y, usecfb);
+	else
+	    paint_span(ts, (int)xminor, (int)xhigh, y, usecfb);
 
 	if (y < p1->sy) {	/* swap minor edge slopes */
-	    xminor += dmdy;
+	    xminor += ts->dmdy;
 	} else {
-	    xminor += dldy;
+	    xminor += ts->dldy;
 	}
 
-	xhigh += dhdy;
+	xhigh += ts->dhdy;
 	y++;
     } 			/* rasterize from ymin to ymax: */
+}
+
+/*
+ * paint triangles tris[0..n-1] (n <= SETUP_BATCH) of an object, set up
+ * together as one batch
+ *
+ * If usecfb == FALSE, then just update the depth buffer, not the
+ * color frame buffer. (this is used by the hidden line renderer)
+ * That goes to the depth-only path in depth.c.
+ *
+ */
+void
+paint_tris(Object_t *op, int *tris, int n, int usecfb)
+{
+    TriSetup_t	batch[SETUP_BATCH], *ts;
+    SetupVtx_t	*p0, *p1, *p2;
+    double	start;
+    int		i, count;
 
-    /* optionally outline triangle, useful for debugging: */
-    if (Flagged(RPScene.generic_flags, FLAG_RENDER_02) && usecfb) {
-        rgba_t	red = {MAX_COLOR_VAL, 0, 0, MAX_COLOR_VAL};
-	RPDrawColorFBLine(p0->sx, p0->sy, p1->sx, p1->sy, red, TRUE);
-	RPDrawColorFBLine(p1->sx, p1->sy, p2->sx, p2->sy, red, TRUE);
-	RPDrawColorFBLine(p2->sx, p2->sy, p0->sx, p0->sy, red, TRUE);
+    if (!usecfb) {
+	depth_tris(op, tris, n);
+	return;
     }
 
-    drawn_polys++;
+    start = paint_usec();
+    count = setup_tris(batch, op, tris, n);
+    setup_usec += paint_usec() - start;
+    setup_count += n;
+
+    for (i=0; i<count; i++) {
+	ts = &(batch[i]);
+
+	    /* RENDER07 hierarchical z: skip it if it's behind everything there */
+	if (hiz_enabled && hiz_tri_hidden(ts)) {
+	    hiz_tris_rejected++;
+	    continue;
+	}
+	lights_tri((TriLights_t *) NULL, ts);
+
+	    /* MULTISAMPLE has its own rasterizer, tiny triangles have theirs,
+	     * RENDER04 selects the half-space (edge function) rasterizer
+	     */
+	if (msaa_samples > 0)
+	    msaa_tri(ts);
+	else if (ts->tiny)
+	    tiny_tri(ts, TRUE);
+	else if (Flagged(RPScene.generic_flags, FLAG_RENDER_04))
+	    halfspace_tri(ts, TRUE);
+	else
+	    walk_tri(ts, TRUE);
+
+	/* optionally outline triangle, useful for debugging: */
+	if (Flagged(RPScene.generic_flags, FLAG_RENDER_02)) {
+	    rgba_t	red = {MAX_COLOR_VAL, 0, 0, MAX_COLOR_VAL};
+	    p0 = &(ts->p[0]); p1 = &(ts->p[1]); p2 = &(ts->p[2]);
+	    if (paint_deferred || msaa_samples > 0) {  /* draw it on top after the resolve */
+		deferred_outline(p0->sx, p0->sy, p1->sx, p1->sy, p2->sx, p2->sy);
+	    } else {
+		RPDrawColorFBLine(p0->sx, p0->sy, p1->sx, p1->sy, red, TRUE);
+		RPDrawColorFBLine(p1->sx, p1->sy, p2->sx, p2->sy, red, TRUE);
+		RPDrawColorFBLine(p2->sx, p2->sy, p0->sx, p0->sy, red, TRUE);
+	    }
+	}
+
+	frags_rasterized += ts->rasterized;
+	frags_shaded += ts->shaded;
+	tiny_tris += ts->tiny;
+	drawn_polys++;
+    }
 }
 
+/* paint this triangle (a batch of one) */
+void
+paint_tri(Object_t *op, Tri_t *tri, int usecfb)
+{
+    int		t = tri - op->tris;
+
+    paint_tris(op, &t, 1, usecfb);
+}
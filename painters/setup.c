@@ -0,0 +1,478 @@
+
+/*
+ * File:	setup.c
+ *
+ * Batched triangle setup.
+ *
+ * Up to SETUP_BATCH triangles of an object are set up together. Their
+ * vertices are gathered (y-sorted) into structure-of-arrays streams, one
+ * short array per attribute and vertex, with a lane per triangle, and the
+ * edge deltas, slopes and plane equations are then computed lane by lane
+ * in straight loops over those arrays, which the compiler turns into
+ * SIMD code. The results are scattered into compact TriSetup_t records
+ * (screen positions plus the attribute values at the first vertex and
+ * their x and y deltas) for the rasterizers.
+ *
+ * Tiny triangles, whose screen bounds fit in TINY_TRI x TINY_TRI pixels,
+ * are split off before the batch: they only cover a few pixels, so
+ * tiny_tri() evaluates them straight from the vertices instead, and
+ * setting up the slopes and plane equations would cost more than that.
+ *
+ * Only the streams of the attributes the batch's span variants use are
+ * gathered and set up (depth always is).
+ *
+ * The arithmetic is the same, term for term, as the one triangle at a
+ * time version it replaced, so the images don't change.
+ *
+ */
+
+/*
+ *
+ * MIT License
+ *
+ * Copyright (c) 2018 Steve Anderson
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#include <stdio.h>
+#include <math.h>
+#include <string.h>
+
+#include "rp.h"
+#include "paint.h"
+
+long	setup_count = 0;	/* triangles through setup (main thread) */
+double	setup_usec = 0.0;
+
+	/* the interpolated attributes, in stream order: */
+#define SA_R		0
+#define SA_G		1
+#define SA_B		2
+#define SA_A		3
+#define SA_S		4
+#define SA_T		5
+#define SA_W		6
+#define SA_Z		7
+#define SA_SURF		8	/* x, y, z */
+#define SA_NORM		11	/* x, y, z */
+#define SA_EYE		14	/* x, y, z */
+#define SA_LIT		17	/* r, g, b, a */
+#define SA_COUNT	21
+
+	/* the attribute (ATTR_*) each stream belongs to, 0 for always */
+static const int sa_attrib[SA_COUNT] = {
+    ATTR_COLOR, ATTR_COLOR, ATTR_COLOR, ATTR_COLOR,
+    ATTR_TEX, ATTR_TEX, ATTR_TEX, 0,
+    ATTR_SURF, ATTR_SURF, ATTR_SURF,
+    ATTR_NORM, ATTR_NORM, ATTR_NORM,
+    ATTR_EYE, ATTR_EYE, ATTR_EYE,
+    ATTR_LIT, ATTR_LIT, ATTR_LIT, ATTR_LIT
+};
+
+typedef struct {	/* one batch, an array per attribute and vertex, a lane per triangle */
+    Tri_t	*tri[SETUP_BATCH];
+    int		out[SETUP_BATCH];	/* the record each lane goes to */
+    int		variant[SETUP_BATCH];	/* its span variant */
+    int		attribs[SETUP_BATCH];	/* and the attributes it interpolates */
+    int		sx[3][SETUP_BATCH], sy[3][SETUP_BATCH], sz[3][SETUP_BATCH];
+    float	a[SA_COUNT][3][SETUP_BATCH];
+	/* results: */
+    float	r[SETUP_BATCH];
+    float	dhdy[SETUP_BATCH], dmdy[SETUP_BATCH], dldy[SETUP_BATCH];
+    float	dxd[SA_COUNT][SETUP_BATCH], dyd[SA_COUNT][SETUP_BATCH];
+} SetupBatch_t;
+
+/* the base color of a triangle: MATERIAL, RANDSHADE or POLYSHADE */
+static void
+setup_polycolor(Object_t *op, Tri_t *tri, Material_t *m, Colorf_t *polycolor)
+{
+    *polycolor = m->color; 	/* start with material color: */
+
+    if (Flagged(op->flags, FLAG_RANDSHADE)) {
+	/* useful for debugging */
+	if (paint_binned) {	/* the same color in every tile */
+	    bin_tri_color(op, tri, polycolor);
+	} else {
+	    polycolor->r = RPRandom();
+	    polycolor->g = RPRandom();
+	    polycolor->b = RPRandom();
+	    polycolor->a = 1.0;
+	}
+    } else if (Flagged(op->flags, FLAG_POLYSHADE)) {
+	*polycolor = tri->color;
+    }
+    /* VERTSHADE: the rasterizer interpolates the vertex colors */
+}
+
+/* the texture coordinates of vertex p (the triangle's vertex number v) */
+static void
+setup_texcoord(Object_t *op, Tri_t *tri, Vtx_t *p, int v, float *s, float *t)
+{
+    int		tc = (v == 0) ? tri->t0 : (v == 1) ? tri->t1 : tri->t2;
+
+	/* we want to rasterize texture coordinates in perspected space: */
+    if (Flagged(tri->flags, FLAG_TRI_CLIP_GEN)) {	/* already in s,t */
+	*s = p->s * p->inv_w;
+	*t = p->t * p->inv_w;
+    } else if (op->tcoords != (uv_t *) NULL) {
+	*s = op->tcoords[tc].u * p->inv_w;
+	*t = op->tcoords[tc].v * p->inv_w;
+    } else {
+	*s = p->s;
+	*t = p->t;
+    }
+}
+
+/* copy vertex v (of the triangle's 3, y-sorted as j) into lane l of the streams */
+static void
+setup_gather(SetupBatch_t *b, Object_t *op, Tri_t *tri, Vtx_t *p, int v, int j, int l,
+	     int attribs)
+{
+    b->sx[j][l] = p->sx;
+    b->sy[j][l] = p->sy;
+    b->sz[j][l] = p->sz;
+    b->a[SA_Z][j][l] = (float) p->sz;
+
+    if (attribs & ATTR_COLOR) {
+	b->a[SA_R][j][l] = p->r;
+	b->a[SA_G][j][l] = p->g;
+	b->a[SA_B][j][l] = p->b;
+	b->a[SA_A][j][l] = p->a;
+    }
+    if (attribs & ATTR_TEX) {
+	setup_texcoord(op, tri, p, v, &(b->a[SA_S][j][l]), &(b->a[SA_T][j][l]));
+	b->a[SA_W][j][l] = p->inv_w;
+    } else {		/* (in case another lane's material is textured) */
+	b->a[SA_S][j][l] = b->a[SA_T][j][l] = b->a[SA_W][j][l] = 0.0;
+    }
+    if (attribs & ATTR_SURF) {
+	b->a[SA_SURF+0][j][l] = p->pos.x;
+	b->a[SA_SURF+1][j][l] = p->pos.y;
+	b->a[SA_SURF+2][j][l] = p->pos.z;
+    }
+    if (attribs & ATTR_NORM) {
+	b->a[SA_NORM+0][j][l] = p->n.x;
+	b->a[SA_NORM+1][j][l] = p->n.y;
+	b->a[SA_NORM+2][j][l] = p->n.z;
+    }
+    if (attribs & ATTR_EYE) {
+	b->a[SA_EYE+0][j][l] = p->e.x;
+	b->a[SA_EYE+1][j][l] = p->e.y;
+	b->a[SA_EYE+2][j][l] = p->e.z;
+    }
+    if (attribs & ATTR_LIT) {
+	Colorf_t	*lit = gouraud_vertex(op, tri, p - op->verts);
+
+	b->a[SA_LIT+0][j][l] = lit->r;
+	b->a[SA_LIT+1][j][l] = lit->g;
+	b->a[SA_LIT+2][j][l] = lit->b;
+	b->a[SA_LIT+3][j][l] = lit->a;
+    }
+}
+
+/*
+ * edge deltas, slopes and the plane equations of the streams in attribs,
+ * for the first n lanes. The loops always run over all SETUP_BATCH lanes
+ * (the unused ones copy lane 0), so a triangle gets the same setup down
+ * to the last bit in any batch - the vectorized loop body and the scalar
+ * remainder don't round the same, and RENDER06 batches the triangles of
+ * a tile differently than drawing them in order does.
+ */
+static void
+setup_lanes(SetupBatch_t *b, int n, int attribs)
+{
+    int		Hdx[SETUP_BATCH], Hdy[SETUP_BATCH], Mdx[SETUP_BATCH], Mdy[SETUP_BATCH];
+    int		ydell[SETUP_BATCH];
+    float	inv_r[SETUP_BATCH], Hd, Md;
+    int		j, k, l;
+
+    if (n == 0)
+	return;
+    for (l=n; l<SETUP_BATCH; l++) {
+	for (j=0; j<3; j++) {
+	    b->sx[j][l] = b->sx[j][0];
+	    b->sy[j][l] = b->sy[j][0];
+	    for (k=0; k<SA_COUNT; k++)
+		b->a[k][j][l] = b->a[k][j][0];
+	}
+    }
+
+    for (l=0; l<SETUP_BATCH; l++) {
+	Mdx[l] = b->sx[1][l] - b->sx[0][l];	Mdy[l] = b->sy[1][l] - b->sy[0][l];
+	Hdx[l] = b->sx[2][l] - b->sx[0][l];	Hdy[l] = b->sy[2][l] - b->sy[0][l];
+	ydell[l] = b->sy[2][l] - b->sy[1][l];
+	b->r[l] = Hdx[l]*Mdy[l] - Hdy[l]*Mdx[l];
+	inv_r[l] = 1.0/b->r[l];
+
+	    /* edge slopes (0 for a horizontal edge): */
+	b->dhdy[l] = (Hdy[l] != 0) ? (float) Hdx[l] / (float) Hdy[l] : 0.0;
+	b->dmdy[l] = (Mdy[l] != 0) ? (float) Mdx[l] / (float) Mdy[l] : 0.0;
+	b->dldy[l] = (ydell[l] != 0) ?
+		(float)(b->sx[2][l] - b->sx[1][l]) / (float) ydell[l] : 0.0;
+    }
+
+	/* attribute slopes, from the plane equation of each: */
+    for (k=0; k<SA_COUNT; k++) {
+	if (sa_attrib[k] != 0 && !(attribs & sa_attrib[k]))
+	    continue;
+	for (l=0; l<SETUP_BATCH; l++) {
+	    Hd = b->a[k][2][l] - b->a[k][0][l];
+	    Md = b->a[k][1][l] - b->a[k][0][l];
+	    b->dxd[k][l] = (((float)Mdy[l] * Hd) - ((float)Hdy[l] * Md)) * inv_r[l];
+	    b->dyd[k][l] = (((float)Hdx[l] * Md) - ((float)Mdx[l] * Hd)) * inv_r[l];
+	}
+    }
+}
+
+/* write lane l out as a rasterizer setup record */
+static void
+setup_scatter(SetupBatch_t *b, TriSetup_t *ts, int l)
+{
+    Frag_t	*f = &(ts->v[0]);
+    int		j;
+
+    for (j=0; j<3; j++) {
+	ts->p[j].sx = b->sx[j][l];
+	ts->p[j].sy = b->sy[j][l];
+	ts->p[j].sz = b->sz[j][l];
+    }
+    ts->r = b->r[l];
+    ts->dhdy = b->dhdy[l];
+    ts->dmdy = b->dmdy[l];
+    ts->dldy = b->dldy[l];
+
+	/* attribute values at p[0], and their deltas in x and y: */
+    f->z = b->a[SA_Z][0][l];
+    ts->DxDz = b->dxd[SA_Z][l];		ts->DyDz = b->dyd[SA_Z][l];
+    if (ts->attribs & ATTR_COLOR) {
+	f->color.r = b->a[SA_R][0][l];	f->color.g = b->a[SA_G][0][l];
+	f->color.b = b->a[SA_B][0][l];	f->color.a = b->a[SA_A][0][l];
+	ts->DxDcol.r = b->dxd[SA_R][l];	ts->DyDcol.r = b->dyd[SA_R][l];
+	ts->DxDcol.g = b->dxd[SA_G][l];	ts->DyDcol.g = b->dyd[SA_G][l];
+	ts->DxDcol.b = b->dxd[SA_B][l];	ts->DyDcol.b = b->dyd[SA_B][l];
+	ts->DxDcol.a = b->dxd[SA_A][l];	ts->DyDcol.a = b->dyd[SA_A][l];
+    }
+    if (ts->attribs & ATTR_TEX) {
+	f->s = b->a[SA_S][0][l];
+	f->t = b->a[SA_T][0][l];
+	f->w = b->a[SA_W][0][l];
+	ts->sh.DxDs = b->dxd[SA_S][l];	ts->sh.DyDs = b->dyd[SA_S][l];
+	ts->sh.DxDt = b->dxd[SA_T][l];	ts->sh.DyDt = b->dyd[SA_T][l];
+	ts->sh.DxDw = b->dxd[SA_W][l];	ts->sh.DyDw = b->dyd[SA_W][l];
+    }
+    if (ts->attribs & ATTR_SURF) {
+	f->surf.x = b->a[SA_SURF+0][0][l];	f->surf.y = b->a[SA_SURF+1][0][l];
+	f->surf.z = b->a[SA_SURF+2][0][l];
+	ts->DxDsurf.x = b->dxd[SA_SURF+0][l];	ts->DyDsurf.x = b->dyd[SA_SURF+0][l];
+	ts->DxDsurf.y = b->dxd[SA_SURF+1][l];	ts->DyDsurf.y = b->dyd[SA_SURF+1][l];
+	ts->DxDsurf.z = b->dxd[SA_SURF+2][l];	ts->DyDsurf.z = b->dyd[SA_SURF+2][l];
+    }
+    if (ts->attribs & ATTR_NORM) {
+	f->n.x = b->a[SA_NORM+0][0][l];	f->n.y = b->a[SA_NORM+1][0][l];
+	f->n.z = b->a[SA_NORM+2][0][l];
+	ts->DxDnorm.x = b->dxd[SA_NORM+0][l];	ts->DyDnorm.x = b->dyd[SA_NORM+0][l];
+	ts->DxDnorm.y = b->dxd[SA_NORM+1][l];	ts->DyDnorm.y = b->dyd[SA_NORM+1][l];
+	ts->DxDnorm.z = b->dxd[SA_NORM+2][l];	ts->DyDnorm.z = b->dyd[SA_NORM+2][l];
+    }
+    if (ts->attribs & ATTR_EYE) {
+	f->eye.x = b->a[SA_EYE+0][0][l];	f->eye.y = b->a[SA_EYE+1][0][l];
+	f->eye.z = b->a[SA_EYE+2][0][l];
+	ts->DxDeye.x = b->dxd[SA_EYE+0][l];	ts->DyDeye.x = b->dyd[SA_EYE+0][l];
+	ts->DxDeye.y = b->dxd[SA_EYE+1][l];	ts->DyDeye.y = b->dyd[SA_EYE+1][l];
+	ts->DxDeye.z = b->dxd[SA_EYE+2][l];	ts->DyDeye.z = b->dyd[SA_EYE+2][l];
+    }
+    if (ts->attribs & ATTR_LIT) {
+	f->lit.r = b->a[SA_LIT+0][0][l];	f->lit.g = b->a[SA_LIT+1][0][l];
+	f->lit.b = b->a[SA_LIT+2][0][l];	f->lit.a = b->a[SA_LIT+3][0][l];
+	ts->DxDlit.r = b->dxd[SA_LIT+0][l];	ts->DyDlit.r = b->dyd[SA_LIT+0][l];
+	ts->DxDlit.g = b->dxd[SA_LIT+1][l];	ts->DyDlit.g = b->dyd[SA_LIT+1][l];
+	ts->DxDlit.b = b->dxd[SA_LIT+2][l];	ts->DyDlit.b = b->dyd[SA_LIT+2][l];
+	ts->DxDlit.a = b->dxd[SA_LIT+3][l];	ts->DyDlit.a = b->dyd[SA_LIT+3][l];
+    }
+
+    ts->tiny = FALSE;
+}
+
+/*
+ * the rest of a setup record, the same for tiny triangles: its span
+ * variant, and the attributes to interpolate (those its pixel shading
+ * uses, none if it only writes depth)
+ */
+static void
+setup_record(TriSetup_t *ts, Object_t *op, Tri_t *tri, int variant, int attribs)
+{
+    ts->sh.op = op;
+    ts->sh.tri = tri;
+    ts->sh.m = &(op->materials[tri->material_id]);
+    ts->sh.lights = (TriLights_t *) NULL;	/* (lights_tri(), as it's drawn) */
+    ts->variant = variant;
+    ts->attribs = attribs;
+    if (attribs != 0 && SpanPerPixel(variant))
+	shade_setup(&(ts->sh));
+    ts->defer_id = -1;
+    ts->rasterized = ts->shaded = 0;
+
+	/* the pixels it may write, narrowed to a tile when binning: */
+    ts->minx = Max(RPScene.scissor_box->ulx, 0);
+    ts->miny = Max(RPScene.scissor_box->uly, 0);
+    ts->maxx = Min(RPScene.scissor_box->lrx, RPScene.xres-1);
+    ts->maxy = Min(RPScene.scissor_box->lry, RPScene.yres-1);
+}
+
+/*
+ * a tiny triangle (inside a TINY_TRI x TINY_TRI pixel box): tiny_tri()
+ * evaluates it at each pixel straight from the vertices, so it only needs
+ * the y-sorted vertices and their attributes, no slopes or plane equations
+ * (except for s, t and 1/w when its texture is filtered, which uses them).
+ */
+static void
+setup_tiny(TriSetup_t *ts, Object_t *op, Tri_t *tri, Vtx_t **p, int *ord,
+	   int variant, int attribs)
+{
+    Frag_t	*f;
+    int		Hdx, Hdy, Mdx, Mdy, j;
+    float	inv_r;
+
+    setup_record(ts, op, tri, variant, attribs);
+    ts->tiny = TRUE;
+
+    for (j=0; j<3; j++) {
+	ts->p[j].sx = p[j]->sx;
+	ts->p[j].sy = p[j]->sy;
+	ts->p[j].sz = p[j]->sz;
+
+	f = &(ts->v[j]);
+	f->color.r = p[j]->r;	f->color.g = p[j]->g;
+	f->color.b = p[j]->b;	f->color.a = p[j]->a;
+	setup_texcoord(op, tri, p[j], ord[j], &(f->s), &(f->t));
+	f->w = p[j]->inv_w;
+	f->z = (float) p[j]->sz;
+	f->surf = p[j]->pos;
+	f->n = p[j]->n;
+	f->eye = p[j]->e;
+	if (ts->attribs & ATTR_LIT)
+	    f->lit = *gouraud_vertex(op, tri, p[j] - op->verts);
+    }
+
+    Mdx = p[1]->sx - p[0]->sx;		Mdy = p[1]->sy - p[0]->sy;
+    Hdx = p[2]->sx - p[0]->sx;		Hdy = p[2]->sy - p[0]->sy;
+    ts->r = Hdx*Mdy - Hdy*Mdx;
+    ts->DxDz = ts->DyDz = 0.0;		/* (for hiz_tri_hidden()) */
+
+    if (SpanTex(ts->variant) >= SPAN_TEX_FILT_DECAL) {
+	inv_r = 1.0/ts->r;
+	ts->sh.DxDs = ((Mdy * (ts->v[2].s - ts->v[0].s)) - (Hdy * (ts->v[1].s - ts->v[0].s))) * inv_r;
+	ts->sh.DyDs = ((Hdx * (ts->v[1].s - ts->v[0].s)) - (Mdx * (ts->v[2].s - ts->v[0].s))) * inv_r;
+	ts->sh.DxDt = ((Mdy * (ts->v[2].t - ts->v[0].t)) - (Hdy * (ts->v[1].t - ts->v[0].t))) * inv_r;
+	ts->sh.DyDt = ((Hdx * (ts->v[1].t - ts->v[0].t)) - (Mdx * (ts->v[2].t - ts->v[0].t))) * inv_r;
+	ts->sh.DxDw = ((Mdy * (ts->v[2].w - ts->v[0].w)) - (Hdy * (ts->v[1].w - ts->v[0].w))) * inv_r;
+	ts->sh.DyDw = ((Hdx * (ts->v[1].w - ts->v[0].w)) - (Mdx * (ts->v[2].w - ts->v[0].w))) * inv_r;
+    }
+}
+
+/*
+ * set up the triangles tris[0..n-1] (n <= SETUP_BATCH) of object op,
+ * writing a record to ts[] for each one that is to be drawn (not clipped,
+ * degenerate or culled), in order, and returning how many that is.
+ * (triangles that only write depth are set up by depth.c instead)
+ */
+int
+setup_tris(TriSetup_t *ts, Object_t *op, int *tris, int n)
+{
+    SetupBatch_t	b;
+    Tri_t	*tri;
+    Vtx_t	*p[3], *tmpp;
+    int		ord[3], sx[SETUP_BATCH][3], sy[SETUP_BATCH][3];
+    int		i, j, l, tmpi, area[SETUP_BATCH], lanes, count;
+    int		variant[SETUP_BATCH], attribs[SETUP_BATCH], used;
+
+	/*
+	 * if a triangle was clipped, then we don't want to draw it.
+	 * We know the clip process generated new triangles for the visible
+	 * portions, so drawing this one would be redundant (and potentially
+	 * mathematically error-prone)
+	 */
+    for (i=0; i<n; i++) {
+	tri = &(op->tris[tris[i]]);
+	sx[i][0] = op->verts[tri->v0].sx;	sy[i][0] = op->verts[tri->v0].sy;
+	sx[i][1] = op->verts[tri->v1].sx;	sy[i][1] = op->verts[tri->v1].sy;
+	sx[i][2] = op->verts[tri->v2].sx;	sy[i][2] = op->verts[tri->v2].sy;
+    }
+
+	/* the signed areas, in the triangles' own vertex order, for culling: */
+    for (i=0; i<n; i++)
+	area[i] = (sx[i][2] - sx[i][0])*(sy[i][1] - sy[i][0]) -
+		  (sy[i][2] - sy[i][0])*(sx[i][1] - sx[i][0]);
+
+    lanes = count = 0;
+    for (i=0; i<n; i++) {
+	tri = &(op->tris[tris[i]]);
+	if (Flagged(tri->flags, FLAG_TRI_CLIPPED) || tri_cull(op, (float) area[i]))
+	    continue;
+
+	p[0] = &(op->verts[tri->v0]);
+	p[1] = &(op->verts[tri->v1]);
+	p[2] = &(op->verts[tri->v2]);
+	ord[0] = 0; ord[1] = 1; ord[2] = 2;
+
+    	    /* y-sort the 3 vertices of the triangle: */
+	if (p[0]->sy > p[1]->sy) {
+	    tmpp = p[0]; p[0] = p[1]; p[1] = tmpp; tmpi = ord[0]; ord[0] = ord[1]; ord[1] = tmpi;
+	}
+	if (p[0]->sy > p[2]->sy) {
+	    tmpp = p[0]; p[0] = p[2]; p[2] = tmpp; tmpi = ord[0]; ord[0] = ord[2]; ord[2] = tmpi;
+	}
+	if (p[1]->sy > p[2]->sy) {
+	    tmpp = p[1]; p[1] = p[2]; p[2] = tmpp; tmpi = ord[1]; ord[1] = ord[2]; ord[2] = tmpi;
+	}
+
+	setup_polycolor(op, tri, &(op->materials[tri->material_id]), &(ts[count].polycolor));
+	variant[i] = span_variant(op, &(op->materials[tri->material_id]));
+	attribs[i] = SpanAttribs(variant[i]);
+
+	    /* tiny ones skip the batch (multisampling needs the plane equations) */
+	if (msaa_samples == 0 && p[2]->sy - p[0]->sy < TINY_TRI &&
+	    Max3(sx[i][0], sx[i][1], sx[i][2]) - Min3(sx[i][0], sx[i][1], sx[i][2]) < TINY_TRI) {
+	    setup_tiny(&(ts[count++]), op, tri, p, ord, variant[i], attribs[i]);
+	    continue;
+	}
+
+	l = lanes++;
+	b.tri[l] = tri;
+	b.out[l] = count++;
+	b.variant[l] = variant[i];
+	b.attribs[l] = attribs[i];
+	for (j=0; j<3; j++)
+	    setup_gather(&b, op, tri, p[j], ord[j], j, l, attribs[i]);
+    }
+
+	/* (the lanes' attributes only differ in the textures) */
+    for (l=0, used=0; l<lanes; l++)
+	used |= b.attribs[l];
+    setup_lanes(&b, lanes, used);
+
+    for (l=0; l<lanes; l++) {
+	setup_record(&(ts[b.out[l]]), op, b.tri[l], b.variant[l], b.attribs[l]);
+	setup_scatter(&b, &(ts[b.out[l]]), l);
+    }
+
+    return (count);
+}
@@ -39,59 +39,176 @@
 #include "rp.h"
 #include "paint.h"
 
-/*
- * 
- * tex contrib, etc. happens in the rasterizer. This calculates
- * only the lighting factor for appication there.
- *
- */
-void
-shade_pixel(Object_t *op, Tri_t *tri, xyz_t *norm, xyz_t *point, xyz_t *view, Colorf_t *shade)
+/* log2(x) for x > 0: the exponent bits plus a polynomial in the mantissa */
+static inline float
+shade_log2(float x)
 {
-    Material_t		*m;
-    Light_t		*light;
-    xyz_t		N, L, H;
-    float       	NdotL, NdotH;
-    int			i;
+    union { float f; int i; } u;
+    float	e, m;
 
-    m = &(op->materials[tri->material_id]);
+    u.f = x;
+    e = (float) (((u.i >> 23) & 0xff) - 127);
+    u.i = (u.i & 0x007fffff) | 0x3f800000;	/* mantissa, in [1,2) */
+    m = u.f - 1.0f;
 
-    shade->r = 0.0; shade->g = 0.0; shade->b = 0.0; shade->a = 0.0;
+    return (e + m * (1.44253476f + m * (-0.71803322f + m * (0.45715621f +
+		m * (-0.27733738f + m * (0.12146867f + m * -0.02579076f))))));
+}
 
-    for (i=0; i<RPScene.light_count; i++) {
+/* 2^x: a polynomial in the fraction, scaled by the integer part as exponent bits */
+static inline float
+shade_exp2(float x)
+{
+    union { float f; int i; } u;
+    float	f;
+    int		i;
 
-        light = RPScene.light_list[i];
+    x = Clamp0x(x + 127.0f, 253.0f);	/* keep the exponent in range (and > 0, so (int) floors) */
+    i = (int) x;
+    f = x - (float) i;
+    u.i = i << 23;
 
-             /* calculate N vector */
-        N.x = norm->x; N.y = norm->y; N.z = norm->z;
-        vector_normalize(&N);
+    return (u.f * (0.99999993f + f * (0.69315296f + f * (0.24015454f +
+		f * (0.05582358f + f * (0.00899259f + f * 0.00187623f))))));
+}
 
-             /* calculate L vector */
-        vector_sub(&L, &(light->pos), point);
-        vector_normalize(&L);
+/* x^e for x in [0,1], the specular highlight (powf() within about 1e-5) */
+static inline float
+shade_pow(float x, float e)
+{
+    return ((x > 0.0f) ? shade_exp2(e * shade_log2(x)) : ((e > 0.0f) ? 0.0f : 1.0f));
+}
 
-             /* calculate H vector */
-        vector_add(&H, &L, view);
-        vector_normalize(&H);
+/* the per triangle lighting constants: the material's terms times the light colors */
+void
+shade_setup(ShadeTri_t *sh)
+{
+    Material_t	*m = sh->m;
+
+    sh->amb.r = m->amb.r * lights_ambient.r;	/* the ambient term doesn't vary */
+    sh->amb.g = m->amb.g * lights_ambient.g;
+    sh->amb.b = m->amb.b * lights_ambient.b;
+    sh->amb.a = m->amb.a * lights_ambient.a;
+    sh->diff = m->diff;
+    sh->spec.r = m->spec.r * m->highlight.r;
+    sh->spec.g = m->spec.g * m->highlight.g;
+    sh->spec.b = m->spec.b * m->highlight.b;
+    sh->spec.a = m->spec.a * m->highlight.a;
+    sh->shiny = m->shiny;
+}
 
-        NdotL = Clamp0x(vector_dot(N,L), 1.0f);
-        NdotH = Clamp0x(vector_dot(N,H), 1.0f);
+/*
+ * 
+ * tex contrib, etc. happens in the rasterizer. This calculates
+ * only the lighting factor for appication there.
+ *
+ * The lights (those of the pixel's tile, lights_at()) are done
+ * SHADE_LANES at a time, in plain loops over the lanes the compiler
+ * vectorizes: each lane gets its L and H vectors, spot and range
+ * falloff, N.L and (N.H)^shiny, and the diffuse and specular sums are
+ * weighted by the material constants once at the end. Lights with a
+ * shadow map are also weighted by how much of them the point sees
+ * (looked up only for lanes that light it at all).
+ *
+ */
+static inline __attribute__((always_inline)) void
+shade_lanes(ShadeTri_t *sh, ShadeLights_t *sl, xyz_t *norm, xyz_t *point, xyz_t *at,
+	    xyz_t *view, Colorf_t *shade, const int falloffs, const int shadows)
+{
+    float		nl[SHADE_LANES], nh[SHADE_LANES];
+    float		dr[SHADE_LANES], dg[SHADE_LANES], db[SHADE_LANES], da[SHADE_LANES];
+    float		sr[SHADE_LANES], sg[SHADE_LANES], sb[SHADE_LANES], sa[SHADE_LANES];
+    float		Nx, Ny, Nz, len;
+    int			i, k;
+
+	/* calculate N vector, once */
+    len = Sqr(norm->x) + Sqr(norm->y) + Sqr(norm->z);
+    len = (len > 0.0f) ? 1.0f / sqrtf(len) : 1.0f;
+    Nx = norm->x * len; Ny = norm->y * len; Nz = norm->z * len;
+
+    for (k=0; k<SHADE_LANES; k++) {
+	dr[k] = 0.0f; dg[k] = 0.0f; db[k] = 0.0f; da[k] = 0.0f;
+	sr[k] = 0.0f; sg[k] = 0.0f; sb[k] = 0.0f; sa[k] = 0.0f;
+    }
 
-        NdotH = powf(NdotH, m->shiny);
+    for (i=0; i<sl->count; i+=SHADE_LANES) {
+	for (k=0; k<SHADE_LANES; k++) {
+	    float	Lx, Ly, Lz, Hx, Hy, Hz, NdotL, NdotH, dist, falloff;
+
+		/* calculate L vector */
+	    Lx = sl->x[i+k] - point->x;
+	    Ly = sl->y[i+k] - point->y;
+	    Lz = sl->z[i+k] - point->z;
+	    dist = Sqr(Lx) + Sqr(Ly) + Sqr(Lz);
+	    len = (dist > 0.0f) ? 1.0f / sqrtf(dist) : 1.0f;
+	    dist *= len;
+	    Lx *= len; Ly *= len; Lz *= len;
+
+		/* spot cone and range */
+	    falloff = 1.0f;
+	    if (falloffs)
+		falloff = Clamp0x(-(Lx*sl->dx[i+k] + Ly*sl->dy[i+k] + Lz*sl->dz[i+k]) *
+				  sl->spot_scale[i+k] + sl->spot_bias[i+k], 1.0f) *
+			  Clamp0x(1.0f - dist * sl->inv_range[i+k], 1.0f);
+
+		/* calculate H vector */
+	    Hx = Lx + view->x;
+	    Hy = Ly + view->y;
+	    Hz = Lz + view->z;
+	    len = Sqr(Hx) + Sqr(Hy) + Sqr(Hz);
+	    len = (len > 0.0f) ? 1.0f / sqrtf(len) : 1.0f;
+
+	    NdotL = Clamp0x(Nx*Lx + Ny*Ly + Nz*Lz, 1.0f);
+	    NdotH = Clamp0x((Nx*Hx + Ny*Hy + Nz*Hz) * len, 1.0f);
+	    nh[k] = shade_pow(NdotH, sh->shiny) * falloff;
+	    nl[k] = NdotL * falloff;
+	}
+	if (shadows) {		/* (a lookup per lit lane, not vectorized) */
+	    xyz_t	N = {Nx, Ny, Nz};
+	    float	vis;
+
+	    for (k=0; k<SHADE_LANES; k++) {
+		if (sl->shadow[i+k] > 0.0f && (nl[k] > 0.0f || nh[k] > 0.0f)) {
+		    vis = shadow_lookup((int) sl->shadow[i+k] - 1, at, &N);
+		    nl[k] *= vis;
+		    nh[k] *= vis;
+		}
+	    }
+	}
+	for (k=0; k<SHADE_LANES; k++) {
+	    dr[k] += nl[k] * sl->r[i+k];
+	    dg[k] += nl[k] * sl->g[i+k];
+	    db[k] += nl[k] * sl->b[i+k];
+	    da[k] += nl[k] * sl->a[i+k];
+	    sr[k] += nh[k] * sl->r[i+k];
+	    sg[k] += nh[k] * sl->g[i+k];
+	    sb[k] += nh[k] * sl->b[i+k];
+	    sa[k] += nh[k] * sl->a[i+k];
+	}
+    }
 
-        shade->r += (m->amb.r * light->color.r) +
-                    (m->diff.r * NdotL * light->color.r) +
-                    (m->spec.r * NdotH * m->highlight.r * light->color.r);
-        shade->g += (m->amb.g * light->color.g) +
-                    (m->diff.g * NdotL * light->color.g) +
-                    (m->spec.g * NdotH * m->highlight.g * light->color.g);
-        shade->b += (m->amb.b * light->color.b) +
-                    (m->diff.b * NdotL * light->color.b) +
-                    (m->spec.b * NdotH * m->highlight.b * light->color.b);
-        shade->a += (m->amb.a * light->color.r) +
-                    (m->diff.a * NdotL * light->color.a) +
-                    (m->spec.a * NdotH * m->highlight.a * light->color.a);
+    shade->r = sh->amb.r; shade->g = sh->amb.g; shade->b = sh->amb.b; shade->a = sh->amb.a;
+    for (k=0; k<SHADE_LANES; k++) {
+	shade->r += sh->diff.r * dr[k] + sh->spec.r * sr[k];
+	shade->g += sh->diff.g * dg[k] + sh->spec.g * sg[k];
+	shade->b += sh->diff.b * db[k] + sh->spec.b * sb[k];
+	shade->a += sh->diff.a * da[k] + sh->spec.a * sa[k];
     }
 }
 
-
+/*
+ * (a version without the spot and range math, for sets of point lights,
+ * and one with the shadow map lookups too, which are made at the point
+ * at instead, only set if sl->shadows)
+ */
+void
+shade_pixel(ShadeTri_t *sh, ShadeLights_t *sl, xyz_t *norm, xyz_t *point, xyz_t *at,
+	    xyz_t *view, Colorf_t *shade)
+{
+    if (sl->shadows)
+	shade_lanes(sh, sl, norm, point, at, view, shade, TRUE, TRUE);
+    else if (sl->falloffs)
+	shade_lanes(sh, sl, norm, point, at, view, shade, TRUE, FALSE);
+    else
+	shade_lanes(sh, sl, norm, point, at, view, shade, FALSE, FALSE);
+}
@@ -0,0 +1,646 @@
+
+/*
+ * File:	shadow.c
+ *
+ * Shadow maps.
+ *
+ * Before the scene is painted, the depth of what is nearest to each
+ * light is drawn into a map from the light's point of view: one fitted
+ * to a spot light's cone, or to the scene for a light that sees all of
+ * it in a narrow enough cone, otherwise six, a cube around it, using
+ * the depth-only triangle path (depth.c) into
+ * the depth buffer, which is then copied out. For each face the
+ * triangles are put into light space and clipped to its frustum (the
+ * near plane, and a guard band around the sides) into a stand-in
+ * object whose screen positions are the map's; spheres are cast into
+ * the map exactly, texel by texel, like impostors.
+ *
+ * shade_pixel() then weights each light by shadow_lookup(): the shaded
+ * point, pushed out along its normal by about a texel, is projected into
+ * the light's map and compared with the 3x3 texels around it, weighted
+ * as a tent filter (percentage closer filtering), so the shadow edges
+ * are soft by a texel or so instead of stair-stepped.
+ *
+ * The maps are only made when the scene asks for them (shadowmap()) and
+ * NOSHADOW isn't set, up to SHADOW_MAX_BYTES of them.
+ *
+ */
+
+/*
+ *
+ * MIT License
+ *
+ * Copyright (c) 2018 Steve Anderson
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "rp.h"
+#include "paint.h"
+
+int	shadow_maps = 0;	/* faces drawn */
+int	shadow_polys = 0;	/* triangles drawn into them */
+long	shadow_bytes = 0;
+double	shadow_usec = 0.0;
+
+typedef struct {	/* a light's shadow map */
+    int		faces;		/* 1 (spot light) or 6 (cube) */
+    xyz_t	pos;		/* the light, in eye space */
+    xyz_t	axis[6][3];	/* each face's right, up and forward */
+    float	scale;		/* 1 / tan(half the field of view of a face) */
+    float	near;
+    float	dA, dB;		/* depth = dA - dB/z, for z (along forward) near to far */
+    float	*depth;		/* faces x size x size */
+} ShadowMap_t;
+
+typedef struct {	/* a point in a face's light space */
+    float	x, y, z;
+} ShadowPt_t;
+
+static ShadowMap_t	*maps = (ShadowMap_t *) NULL;
+static int		*light_map = (int *) NULL;	/* map number + 1 (0 for none) */
+static int		map_count = 0;
+static int		size = 0;
+
+	/* the stand-in object a face's triangles are drawn from: */
+static Object_t		proxy;
+static Material_t	proxy_material;
+static Vtx_t		*pverts = (Vtx_t *) NULL;
+static Tri_t		*ptris = (Tri_t *) NULL;
+static int		pvert_size = 0, ptri_size = 0;
+static ShadowPt_t	*lpts = (ShadowPt_t *) NULL;	/* an object's vertices in light space */
+static int		*lcodes = (int *) NULL;		/* and their clip codes */
+static int		lpt_size = 0;
+
+/* the cube faces: +x, -x, +y, -y, +z, -z (eye space) */
+static float	cube_axes[6][3][3] = {
+    {{ 0, 0,-1}, { 0, 1, 0}, { 1, 0, 0}},
+    {{ 0, 0, 1}, { 0, 1, 0}, {-1, 0, 0}},
+    {{ 1, 0, 0}, { 0, 0,-1}, { 0, 1, 0}},
+    {{ 1, 0, 0}, { 0, 0, 1}, { 0,-1, 0}},
+    {{ 1, 0, 0}, { 0, 1, 0}, { 0, 0, 1}},
+    {{-1, 0, 0}, { 0, 1, 0}, { 0, 0,-1}},
+};
+
+/* point p in the light space of face f of map sm */
+static inline void
+shadow_space(ShadowMap_t *sm, int f, xyz_t *p, ShadowPt_t *lp)
+{
+    xyz_t	*a = sm->axis[f];
+    float	dx = p->x - sm->pos.x, dy = p->y - sm->pos.y, dz = p->z - sm->pos.z;
+
+    lp->x = dx * a[0].x + dy * a[0].y + dz * a[0].z;
+    lp->y = dx * a[1].x + dy * a[1].y + dz * a[1].z;
+    lp->z = dx * a[2].x + dy * a[2].y + dz * a[2].z;
+}
+
+/* the clip codes of a light space point: near plane, then the guard band sides */
+static inline int
+shadow_codes(ShadowMap_t *sm, ShadowPt_t *lp)
+{
+    float	g = lp->z * SHADOW_GUARD / sm->scale;
+    int		codes = 0;
+
+    if (lp->z < sm->near) codes |= 0x01;
+    if (lp->x > g) codes |= 0x02;
+    if (lp->x < -g) codes |= 0x04;
+    if (lp->y > g) codes |= 0x08;
+    if (lp->y < -g) codes |= 0x10;
+    return (codes);
+}
+
+/* signed distance (unnormalized) of a light space point from clip plane k */
+static inline float
+shadow_plane(ShadowMap_t *sm, ShadowPt_t *lp, int k)
+{
+    float	g = lp->z * SHADOW_GUARD / sm->scale;
+
+    switch (k) {
+      case 0:	return (lp->z - sm->near);
+      case 1:	return (g - lp->x);
+      case 2:	return (g + lp->x);
+      case 3:	return (g - lp->y);
+      default:	return (g + lp->y);
+    }
+}
+
+/* a proxy vertex at light space point lp (inside the near plane) */
+static int
+shadow_vert(ShadowMap_t *sm, ShadowPt_t *lp, int v)
+{
+    Vtx_t	*p;
+    float	w = sm->scale / lp->z;
+
+    if (v >= pvert_size) {
+	pvert_size = Max(2 * pvert_size, v + 1024);
+	pverts = (Vtx_t *) realloc(pverts, pvert_size * sizeof(Vtx_t));
+    }
+    p = &(pverts[v]);
+    memset(p, 0, sizeof(Vtx_t));
+	/* map pixel i is at the center of the i-th of size steps across -1 to 1: */
+    p->sx = (int) floorf((lp->x * w + 1.0) * 0.5 * size);
+    p->sy = (int) floorf((1.0 - lp->y * w) * 0.5 * size);
+    p->sz = (int) (sm->dA - sm->dB / lp->z + 0.5);
+    return (v + 1);
+}
+
+/* a proxy triangle */
+static int
+shadow_tri(int v0, int v1, int v2, int t)
+{
+    if (t >= ptri_size) {
+	ptri_size = Max(2 * ptri_size, 1024);
+	ptris = (Tri_t *) realloc(ptris, ptri_size * sizeof(Tri_t));
+    }
+    memset(&(ptris[t]), 0, sizeof(Tri_t));
+    ptris[t].v0 = v0;
+    ptris[t].v1 = v1;
+    ptris[t].v2 = v2;
+    return (t + 1);
+}
+
+/* clip triangle tri (light space points) to the planes in codes, adding it as a fan */
+static void
+shadow_clip(ShadowMap_t *sm, ShadowPt_t *tri, int codes, int *nv, int *nt)
+{
+    ShadowPt_t	buf[2][8], *in, *out, *a, *b;
+    float	da, db, t;
+    int		i, k, n, m, first;
+
+    in = buf[0]; out = buf[1];
+    in[0] = tri[0]; in[1] = tri[1]; in[2] = tri[2];
+    n = 3;
+    for (k=0; k<5 && n >= 3; k++) {
+	if (!(codes & (1 << k)))
+	    continue;
+	for (i=0, m=0; i<n; i++) {
+	    a = &(in[i]);
+	    b = &(in[(i+1) % n]);
+	    da = shadow_plane(sm, a, k);
+	    db = shadow_plane(sm, b, k);
+	    if (da >= 0.0)
+		out[m++] = *a;
+	    if ((da >= 0.0) != (db >= 0.0)) {
+		t = da / (da - db);
+		out[m].x = a->x + t * (b->x - a->x);
+		out[m].y = a->y + t * (b->y - a->y);
+		out[m].z = a->z + t * (b->z - a->z);
+		if (k == 0)
+		    out[m].z = sm->near;	/* (exactly on it) */
+		m++;
+	    }
+	}
+	a = in; in = out; out = a;
+	n = m;
+    }
+    if (n < 3)
+	return;
+
+    first = *nv;
+    for (i=0; i<n; i++)
+	*nv = shadow_vert(sm, &(in[i]), *nv);
+    for (i=1; i<n-1; i++)
+	*nt = shadow_tri(first, first + i, first + i + 1, *nt);
+}
+
+/* is the sphere (light space center c, radius r) outside face f's frustum? */
+static int
+shadow_cull(ShadowMap_t *sm, ShadowPt_t *c, float r)
+{
+    float	g = SHADOW_GUARD / sm->scale, len = sqrtf(1.0 + Sqr(g));
+
+    return (c->z + r < sm->near ||
+	    (g * c->z - c->x) / len < -r || (g * c->z + c->x) / len < -r ||
+	    (g * c->z - c->y) / len < -r || (g * c->z + c->y) / len < -r);
+}
+
+/* draw the triangles of object op into face f */
+static void
+shadow_object(ShadowMap_t *sm, int f, Object_t *op)
+{
+    ShadowPt_t	c, tri[3];
+    Tri_t	*tp;
+    int		batch[SETUP_BATCH];
+    int		i, n, nv, nt, c0, c1, c2;
+
+    if (op->sphere != (Sphere_t *) NULL) {
+	shadow_space(sm, f, &(op->sphere->center), &c);
+	if (shadow_cull(sm, &c, op->sphere->radius))
+	    return;
+    }
+
+    if (op->vert_count > lpt_size) {
+	lpt_size = op->vert_count;
+	lpts = (ShadowPt_t *) realloc(lpts, lpt_size * sizeof(ShadowPt_t));
+	lcodes = (int *) realloc(lcodes, lpt_size * sizeof(int));
+    }
+
+	/* the vertices in light space; those inside the near plane get a proxy */
+    for (i=0; i<op->vert_count; i++) {
+	shadow_space(sm, f, &(op->verts[i].pos), &(lpts[i]));
+	lcodes[i] = shadow_codes(sm, &(lpts[i]));
+	if (!(lcodes[i] & 0x01))
+	    shadow_vert(sm, &(lpts[i]), i);
+    }
+
+	/* the triangles inside, and the pieces of those across the planes */
+    nv = op->vert_count;
+    nt = 0;
+    for (i=0; i<op->tri_count; i++) {
+	tp = &(op->tris[i]);
+	if (Flagged(tp->flags, FLAG_TRI_CLIP_GEN))
+	    continue;	/* (made by the eye's clipping, the original is still there) */
+	c0 = lcodes[tp->v0]; c1 = lcodes[tp->v1]; c2 = lcodes[tp->v2];
+	if (c0 & c1 & c2)
+	    continue;
+	if ((c0 | c1 | c2) == 0) {
+	    nt = shadow_tri(tp->v0, tp->v1, tp->v2, nt);
+	} else {
+	    tri[0] = lpts[tp->v0]; tri[1] = lpts[tp->v1]; tri[2] = lpts[tp->v2];
+	    shadow_clip(sm, tri, c0 | c1 | c2, &nv, &nt);
+	}
+    }
+
+    proxy.id = op->id;
+    proxy.verts = pverts;
+    proxy.vert_count = nv;
+    proxy.tris = ptris;
+    proxy.tri_count = nt;
+
+    for (i=0, n=0; i<nt; i++) {
+	batch[n++] = i;
+	if (n == SETUP_BATCH || i == nt-1) {
+	    depth_tris(&proxy, batch, n);
+	    n = 0;
+	}
+    }
+}
+
+/* cast sphere op into face f, nearest hit per texel */
+static void
+shadow_sphere(ShadowMap_t *sm, int f, Object_t *op)
+{
+    ShadowPt_t	c;
+    float	r = op->sphere->radius, a, b, cc, disc, t, u0, u1, v0, v1, q;
+    float	z[MAX_XRES];
+    u8		mask[MAX_XRES];
+    int		x, y, i, x0, x1, y0, y1;
+
+    shadow_space(sm, f, &(op->sphere->center), &c);
+    cc = Sqr(c.x) + Sqr(c.y) + Sqr(c.z) - Sqr(r);
+    if (cc <= 0.0 || shadow_cull(sm, &c, r))
+	return;		/* (a light inside a sphere is all shadowed anyway) */
+
+	/* the texels between the planes through the light tangent to it in x and y */
+    x0 = 0; x1 = size-1; y0 = 0; y1 = size-1;
+    if (c.z > r) {
+	q = r * sqrtf(Sqr(c.x) + Sqr(c.z) - Sqr(r));
+	u0 = (c.x * c.z - q) / (Sqr(c.z) - Sqr(r)) * sm->scale;
+	u1 = (c.x * c.z + q) / (Sqr(c.z) - Sqr(r)) * sm->scale;
+	q = r * sqrtf(Sqr(c.y) + Sqr(c.z) - Sqr(r));
+	v0 = (c.y * c.z + q) / (Sqr(c.z) - Sqr(r)) * sm->scale;
+	v1 = (c.y * c.z - q) / (Sqr(c.z) - Sqr(r)) * sm->scale;
+	x0 = Max(x0, (int) floorf((u0 + 1.0) * 0.5 * size - 0.5));
+	x1 = Min(x1, (int) ceilf((u1 + 1.0) * 0.5 * size - 0.5));
+	y0 = Max(y0, (int) floorf((1.0 - v0) * 0.5 * size - 0.5));
+	y1 = Min(y1, (int) ceilf((1.0 - v1) * 0.5 * size - 0.5));
+    }
+
+    for (y=y0; y<=y1; y++) {
+	float	dy = (1.0 - (2.0*y + 1.0) / size) / sm->scale;
+
+	for (x=x0, i=0; x<=x1; x++, i++) {
+	    float	dx = ((2.0*x + 1.0) / size - 1.0) / sm->scale;
+
+		/* the ray (dx, dy, 1) from the light: t is the distance along forward */
+	    a = Sqr(dx) + Sqr(dy) + 1.0;
+	    b = dx * c.x + dy * c.y + c.z;
+	    disc = Sqr(b) - a * cc;
+	    mask[i] = FALSE;
+	    if (disc < 0.0)
+		continue;
+	    t = (b - sqrtf(disc)) / a;
+	    if (t < sm->near)
+		continue;
+	    z[i] = sm->dA - sm->dB / t;
+	    mask[i] = TRUE;
+	}
+	RPTestPutDepthSpan(x0, x1, y, z, mask);
+    }
+}
+
+/* draw face f of shadow map sm: everything, into the depth buffer, then copied out */
+static void
+shadow_face(ShadowMap_t *sm, int f)
+{
+    Object_t	*op;
+    float	*d = sm->depth + (long) f * size * size;
+    int		i, y;
+
+    RPClearDepthFB((float *) NULL);
+    for (i=0; i<RPScene.obj_count; i++) {
+	op = RPScene.obj_list[i];
+	if (op->type == OBJ_TYPE_SPHERE)
+	    shadow_sphere(sm, f, op);
+	else if (op->type == OBJ_TYPE_POLY)
+	    shadow_object(sm, f, op);
+    }
+    for (y=0; y<size; y++)
+	memcpy(d + (long) y * size, &(RPDepthFrameBuffer[y][0]), size * sizeof(float));
+    shadow_maps++;
+}
+
+/*
+ * the sphere around all the objects (their bounding spheres), FALSE if
+ * some object has none
+ */
+static int
+shadow_bound(xyz_t *center, float *radius)
+{
+    Object_t	*op;
+    xyz_t	lo, hi, d;
+    float	r = 0.0;
+    int		i;
+
+    lo.x = lo.y = lo.z = REALLY_BIG_FLOAT;
+    hi.x = hi.y = hi.z = -REALLY_BIG_FLOAT;
+    for (i=0; i<RPScene.obj_count; i++) {
+	op = RPScene.obj_list[i];
+	if (op->sphere == (Sphere_t *) NULL)
+	    return (FALSE);
+	lo.x = Min(lo.x, op->sphere->center.x - op->sphere->radius);
+	lo.y = Min(lo.y, op->sphere->center.y - op->sphere->radius);
+	lo.z = Min(lo.z, op->sphere->center.z - op->sphere->radius);
+	hi.x = Max(hi.x, op->sphere->center.x + op->sphere->radius);
+	hi.y = Max(hi.y, op->sphere->center.y + op->sphere->radius);
+	hi.z = Max(hi.z, op->sphere->center.z + op->sphere->radius);
+    }
+    if (RPScene.obj_count == 0)
+	return (FALSE);
+
+    center->x = 0.5 * (lo.x + hi.x);
+    center->y = 0.5 * (lo.y + hi.y);
+    center->z = 0.5 * (lo.z + hi.z);
+    for (i=0; i<RPScene.obj_count; i++) {
+	op = RPScene.obj_list[i];
+	vector_sub(&d, &(op->sphere->center), center);
+	r = Max(r, sqrtf(vector_dot(d, d)) + op->sphere->radius);
+    }
+    *radius = r;
+    return (TRUE);
+}
+
+/* set up the map of light lp: where it is, which way its faces look, its depth range */
+static void
+shadow_setup(ShadowMap_t *sm, Light_t *lp)
+{
+    Object_t	*op;
+    xyz_t	dir, d, c, *R, *U, *F;
+    float	half = 0.0, far = 0.0, near = REALLY_BIG_FLOAT, dist, r;
+    int		i, f;
+
+    sm->pos = lp->pos;
+    sm->faces = 6;
+    if (lp->type == SPOT_LIGHT && lp->fov > 0.0 && lp->fov <= SHADOW_MAX_FOV) {
+	sm->faces = 1;
+	half = 0.5 * lp->fov * DegToRad;
+	vector_sub(&dir, &(lp->coi), &(lp->pos));
+    } else if (shadow_bound(&c, &r)) {
+	    /* a point light (or a wide spot) that sees all of the scene in
+	     * a narrow enough cone gets one face fitted to it, rather than
+	     * a cube that would spend only a few texels on it
+	     */
+	vector_sub(&dir, &c, &(lp->pos));
+	dist = sqrtf(vector_dot(dir, dir));
+	if (dist > r && asinf(r / dist) <= 0.5 * SHADOW_MAX_FOV * DegToRad) {
+	    sm->faces = 1;
+	    half = asinf(r / dist);
+	}
+    }
+
+	/* a cube's faces are 90 degrees (and a border), one face fits its cone */
+    if (sm->faces == 6) {
+	for (f=0; f<6; f++)
+	    for (i=0; i<3; i++) {
+		sm->axis[f][i].x = cube_axes[f][i][0];
+		sm->axis[f][i].y = cube_axes[f][i][1];
+		sm->axis[f][i].z = cube_axes[f][i][2];
+	    }
+	sm->scale = (float) size / (float) (size + 2*SHADOW_BORDER);
+    } else {
+	R = &(sm->axis[0][0]); U = &(sm->axis[0][1]); F = &(sm->axis[0][2]);
+	vector_normalize(&dir);
+	*F = dir;
+	d.x = 0.0; d.y = 1.0; d.z = 0.0;
+	if (fabsf(dir.y) > 0.9) {
+	    d.x = 1.0; d.y = 0.0;
+	}
+	vector_cross(R, F, &d);
+	vector_normalize(R);
+	vector_cross(U, R, F);
+	sm->scale = 1.0 / tanf(half) * (float) size / (float) (size + 2*SHADOW_BORDER);
+    }
+
+	/* the depth range: out to the farthest object, in to the nearest (or a bit) */
+    for (i=0; i<RPScene.obj_count; i++) {
+	op = RPScene.obj_list[i];
+	if (op->sphere == (Sphere_t *) NULL)
+	    continue;
+	vector_sub(&d, &(op->sphere->center), &(sm->pos));
+	dist = sqrtf(vector_dot(d, d));
+	r = op->sphere->radius;
+	far = Max(far, dist + r);
+	if (dist > r)
+	    near = Min(near, 0.9 * (dist - r));
+    }
+    far = Max(far, Epsilon);
+    sm->near = Max(Min(near, far), far / SHADOW_DEPTH_RANGE);
+    sm->dA = SHADOW_ZSCALE * far / Max(far - sm->near, Epsilon);
+    sm->dB = sm->dA * sm->near;
+}
+
+/* make the shadow maps (once the scene and lights are in eye space) */
+void
+shadow_init(void)
+{
+    ShadowMap_t	*sm;
+    Scissor_t	scissor = *(RPScene.scissor_box);
+    double	start;
+    long	face_bytes;
+    int		xres = RPScene.xres, yres = RPScene.yres;
+    int		i, f, faces;
+	/* (the shadow pass isn't counted with the scene's polygons) */
+    int		save_drawn = drawn_polys, save_culled = culled_polys, save_tiny = tiny_tris;
+    int		save_degen = RPScene.tiny_rejected_polys;
+    long	save_rast = frags_rasterized, save_setup = setup_count;
+    double	save_setup_usec = setup_usec;
+
+    shadow_maps = shadow_polys = 0;
+    shadow_bytes = 0;
+    shadow_usec = 0.0;
+    size = RPScene.shadow_size;
+    if (size <= 0 || RPScene.light_count == 0 || Flagged(RPScene.flags, FLAG_NOSHADOW))
+	return;
+
+    start = paint_usec();
+    maps = (ShadowMap_t *) calloc(RPScene.light_count, sizeof(ShadowMap_t));
+    light_map = (int *) calloc(RPScene.light_count, sizeof(int));
+    memset(&proxy, 0, sizeof(Object_t));
+    memset(&proxy_material, 0, sizeof(Material_t));
+    proxy.type = OBJ_TYPE_POLY;
+    proxy.materials = &proxy_material;	/* (untextured, unlit, just depth) */
+    proxy.material_count = 1;
+
+	/* the depth buffer, sized to the map */
+    RPScene.xres = RPScene.yres = size;
+    RPScene.scissor_box->ulx = RPScene.scissor_box->uly = 0;
+    RPScene.scissor_box->lrx = RPScene.scissor_box->lry = size-1;
+
+    face_bytes = (long) size * size * sizeof(float);
+    for (i=0; i<RPScene.light_count; i++) {
+	sm = &(maps[map_count]);
+	shadow_setup(sm, RPScene.light_list[i]);
+	faces = sm->faces;
+	if (shadow_bytes + faces * face_bytes > SHADOW_MAX_BYTES) {
+	    fprintf(stderr,"%s : WARNING : shadow maps over %ld bytes, lights %d to %d have none\n",
+		    program_name, (long) SHADOW_MAX_BYTES, i, RPScene.light_count-1);
+	    break;
+	}
+	sm->depth = (float *) malloc(faces * face_bytes);
+	shadow_bytes += faces * face_bytes;
+	for (f=0; f<faces; f++)
+	    shadow_face(sm, f);
+	light_map[i] = ++map_count;
+    }
+
+    RPScene.xres = xres;
+    RPScene.yres = yres;
+    *(RPScene.scissor_box) = scissor;
+    RPClearDepthFB((float *) NULL);
+
+    shadow_polys = drawn_polys - save_drawn;
+    drawn_polys = save_drawn;
+    culled_polys = save_culled;
+    tiny_tris = save_tiny;
+    RPScene.tiny_rejected_polys = save_degen;
+    frags_rasterized = save_rast;
+    setup_count = save_setup;
+    setup_usec = save_setup_usec;
+    shadow_usec = paint_usec() - start;
+}
+
+/* the shadow map number (+1) of light i, 0 if it has none */
+int
+shadow_index(int i)
+{
+    return ((light_map == (int *) NULL) ? 0 : light_map[i]);
+}
+
+/*
+ * how much of light map m (shadow_index() - 1) reaches eye space point p,
+ * with (unit) normal n, from 0.0 (in shadow) to 1.0 (lit)
+ */
+float
+shadow_lookup(int m, xyz_t *p, xyz_t *n)
+{
+    ShadowMap_t	*sm = &(maps[m]);
+    ShadowPt_t	lp;
+    xyz_t	q, d, *F;
+    float	texel, cosl, offset, ref, u, v, fu, fv, wu[3], wv[3], lit, *row;
+    int		f = 0, iu, iv, i, j, x, y;
+
+    d.x = p->x - sm->pos.x; d.y = p->y - sm->pos.y; d.z = p->z - sm->pos.z;
+    if (sm->faces == 6) {	/* the cube face it's in front of */
+	if (fabsf(d.x) >= fabsf(d.y) && fabsf(d.x) >= fabsf(d.z))
+	    f = (d.x > 0.0) ? 0 : 1;
+	else if (fabsf(d.y) >= fabsf(d.z))
+	    f = (d.y > 0.0) ? 2 : 3;
+	else
+	    f = (d.z > 0.0) ? 4 : 5;
+    }
+
+	/* pushed off the surface by a texel or two (the size of one there),
+	 * more the more it's turned away from the light (the filter reaches
+	 * out over the surface, which the map sees as steeper in depth)
+	 */
+    F = &(sm->axis[f][2]);
+    texel = 2.0 * (d.x * F->x + d.y * F->y + d.z * F->z) / (sm->scale * size);
+    cosl = -(n->x * d.x + n->y * d.y + n->z * d.z) / sqrtf(Max(Sqr(d.x) + Sqr(d.y) + Sqr(d.z), Epsilon));
+    offset = texel * SHADOW_NORMAL_OFFSET * sqrtf(Max(1.0 - Sqr(cosl), 0.0));
+    q.x = p->x + n->x * offset;
+    q.y = p->y + n->y * offset;
+    q.z = p->z + n->z * offset;
+    shadow_space(sm, f, &q, &lp);
+    lp.z -= texel * SHADOW_BIAS;
+    if (lp.z <= sm->near)
+	return (1.0);
+
+    ref = sm->dA - sm->dB / lp.z;
+    u = (lp.x * sm->scale / lp.z + 1.0) * 0.5 * size - 0.5;
+    v = (1.0 - lp.y * sm->scale / lp.z) * 0.5 * size - 0.5;
+    if (u < -0.5 || u > size - 0.5 || v < -0.5 || v > size - 0.5)
+	return (1.0);	/* (outside a one face map is outside the cone or the scene) */
+
+	/* 3x3 texels, weighted as two bilinear lookups half a texel apart */
+    iu = (int) floorf(u - 0.5);	fu = (u - 0.5) - iu;
+    iv = (int) floorf(v - 0.5);	fv = (v - 0.5) - iv;
+    wu[0] = 1.0 - fu; wu[1] = 1.0; wu[2] = fu;
+    wv[0] = 1.0 - fv; wv[1] = 1.0; wv[2] = fv;
+
+    lit = 0.0;
+    for (j=0; j<3; j++) {
+	y = Clamp0x(iv + j, size-1);
+	row = sm->depth + ((long) f * size + y) * size;
+	for (i=0; i<3; i++) {
+	    x = Clamp0x(iu + i, size-1);
+	    if (ref <= row[x])
+		lit += wu[i] * wv[j];
+	}
+    }
+    return (lit * 0.25);
+}
+
+void
+shadow_cleanup(void)
+{
+    int		i;
+
+    for (i=0; i<map_count; i++)
+	free(maps[i].depth);
+    free(maps);
+    free(light_map);
+    free(pverts);
+    free(ptris);
+    free(lpts);
+    free(lcodes);
+    maps = (ShadowMap_t *) NULL;
+    light_map = (int *) NULL;
+    pverts = (Vtx_t *) NULL;
+    ptris = (Tri_t *) NULL;
+    lpts = (ShadowPt_t *) NULL;
+    lcodes = (int *) NULL;
+    pvert_size = ptri_size = lpt_size = 0;
+    map_count = 0;
+}
@@ -59,6 +59,12 @@ RPSetLight(xyz_t pos, Colorf_t color)
 {
     Light_t	*lp;
 
+    if (RPScene.light_count >= MAX_LIGHTS) {
+	fprintf(stderr,"%s : ERROR : too many lights! (%d)\n",
+		program_name, RPScene.light_count);
+	return;
+    }
+
     if (RPScene.light_list[RPScene.light_count] == (Light_t *) NULL) {
 	lp = (Light_t *) calloc(1, sizeof(Light_t));
     } else {
@@ -89,6 +95,12 @@ RPSetSpotLight(xyz_t pos, xyz_t coi, float fov, float focus, float range, float
 {
     Light_t	*lp;
 
+    if (RPScene.light_count >= MAX_LIGHTS) {
+	fprintf(stderr,"%s : ERROR : too many lights! (%d)\n",
+		program_name, RPScene.light_count);
+	return;
+    }
+
     if (RPScene.light_list[RPScene.light_count] == (Light_t *) NULL) {
 	lp = (Light_t *) calloc(1, sizeof(Light_t));
     } else {
@@ -128,6 +140,22 @@ RPSetSpotLight(xyz_t pos, xyz_t coi, float fov, float focus, float range, float
     RPScene.light_list[RPScene.light_count++] = lp;
 }
 
+/* set the shadow map resolution (called from parser) */
+void
+RPSetShadowMap(int size)
+{
+    if (size < 0 || size > MAX_YRES) {
+	fprintf(stderr,"%s : WARNING : shadow map size %d out of range (0 - %d)\n",
+		program_name, size, MAX_YRES);
+	size = Clamp0x(size, MAX_YRES);
+    }
+    RPScene.shadow_size = size;
+
+    if (Flagged(RPScene.flags, FLAG_VERBOSE)) {
+	fprintf(stderr," +Shadow maps %d x %d\n", size, size);
+    }
+}
+
 /* transform the lights by the V matrix before rendering */
 void
 RPTransformLights(void)
@@ -156,6 +184,24 @@ RPTransformLights(void)
 	lp->pos.x = outpt.x;
 	lp->pos.y = outpt.y;
 	lp->pos.z = outpt.z;
+
+	if (lp->type == SPOT_LIGHT) {	/* and where it's pointing */
+	    outpt.x = (v_mtx[0][0] * lp->coi.x +
+		       v_mtx[1][0] * lp->coi.y +
+		       v_mtx[2][0] * lp->coi.z +
+		       v_mtx[3][0] * 1.0);
+	    outpt.y = (v_mtx[0][1] * lp->coi.x +
+		       v_mtx[1][1] * lp->coi.y +
+		       v_mtx[2][1] * lp->coi.z +
+		       v_mtx[3][1] * 1.0);
+	    outpt.z = (v_mtx[0][2] * lp->coi.x +
+		       v_mtx[1][2] * lp->coi.y +
+		       v_mtx[2][2] * lp->coi.z +
+		       v_mtx[3][2] * 1.0);
+	    lp->coi.x = outpt.x;
+	    lp->coi.y = outpt.y;
+	    lp->coi.z = outpt.z;
+	}
     }
 }
 
@@ -115,6 +115,7 @@ int 	yylex(void); /* added this to quiet warnings with bison -y */
 %token	<integer>	MATRIX
 %token	<integer>	LIGHT
 %token	<integer>	SPOTLIGHT
+%token	<integer>	SHADOWMAP
 %token	<integer>	MATERIAL
 %token	<integer>	COLOR
 %token	<integer>	AMBIENT
@@ -160,6 +161,7 @@ int 	yylex(void); /* added this to quiet warnings with bison -y */
 %token	<integer>	RANDSHADE
 %token	<integer>	POLYSHADE
 %token	<integer>	VERTSHADE
+%token	<integer>	GOURAUD
 %token	<integer>	VERTNORM
 %token	<integer>	REFLECT
 %token	<integer>	BUMP
@@ -499,6 +501,10 @@ command:
 
 	    RPSetSpotLight(pos, coi, fov, focus, range, 1.0, col);
 	}
+        |   SHADOWMAP OP_PAREN iexpression CL_PAREN SEMICOLON
+	{
+	    RPSetShadowMap($3);
+	}
 	/* material() commands have a keyword, with the attribute they set */
 	| MATERIAL OP_PAREN NAME COMMA QSTRING CL_PAREN SEMICOLON
         {
@@ -1032,6 +1038,14 @@ objflagval:
 	{
 	    RPClearObjectFlags(FLAG_VERTSHADE);
 	}
+        |   GOURAUD
+	{
+	    RPSetObjectFlags(FLAG_GOURAUD);
+	}
+        |   NOT_OP GOURAUD
+	{
+	    RPClearObjectFlags(FLAG_GOURAUD);
+	}
         |   VERTNORM
 	{
 	    RPSetObjectFlags(FLAG_VERTNORM);
@@ -101,6 +101,7 @@ RPInitScene(void)
     RPScene.obj_count = 0;
 	/* light_list is empty */
     RPScene.light_count = 0;
+    RPScene.shadow_size = 0;
     RPScene.ambient.r = 0.0;
     RPScene.ambient.g = 0.0;
     RPScene.ambient.b = 0.0;
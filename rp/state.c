@@ -154,7 +154,7 @@ int
 RPTestDepthFB(int x, int y, float z)
 {
     if ((x >= RPScene.scissor_box->ulx) && (x <= RPScene.scissor_box->lrx) &&
-        (y >= RPScene.scissor_box->uly) && (y <= RPScene.scissor_box->lrx)) {
+        (y >= RPScene.scissor_box->uly) && (y <= RPScene.scissor_box->lry)) {
         if (z < RPDepthFrameBuffer[y][x])
             return TRUE;
         else
@@ -169,11 +169,120 @@ void
 RPPutDepthFBPixel(int x, int y, float z)
 {
     if ((x >= RPScene.scissor_box->ulx) && (x <= RPScene.scissor_box->lrx) &&
-        (y >= RPScene.scissor_box->uly) && (y <= RPScene.scissor_box->lrx)) {
+        (y >= RPScene.scissor_box->uly) && (y <= RPScene.scissor_box->lry)) {
         RPDepthFrameBuffer[y][x] = z;
     }
 }
 
+/* Span access:
+ *
+ * The rasterizers and line drawers test and write a run of pixels of
+ * one row at a time, x0 to x1 of row y, rather than one pixel per call.
+ * The per pixel arrays are indexed from x0 (z[i], color[i] and mask[i]
+ * are for pixel x0+i). The span is clipped to the scissor box (and the
+ * frame buffer) once, and a mask, nonzero for the pixels to touch,
+ * picks the pixels within it (NULL for all of them, where allowed).
+ */
+
+/* the part of span x0..x1 of row y inside the scissor box, FALSE if none */
+static int
+clip_span(int *x0, int *x1, int y)
+{
+    if (y < Max(RPScene.scissor_box->uly, 0) ||
+	y > Min(RPScene.scissor_box->lry, RPScene.yres-1))
+	return (FALSE);
+
+    *x0 = Max(*x0, Max(RPScene.scissor_box->ulx, 0));
+    *x1 = Min(*x1, Min(RPScene.scissor_box->lrx, RPScene.xres-1));
+
+    return (*x0 <= *x1);
+}
+
+/* clear the mask outside the clipped span cx0..cx1 (empty if cx0 > cx1) */
+static void
+clear_mask(int x0, int x1, int cx0, int cx1, u8 *mask)
+{
+    if (cx0 > cx1) {
+	memset(mask, 0, x1 - x0 + 1);
+	return;
+    }
+    memset(mask, 0, cx0 - x0);
+    memset(&(mask[cx1 - x0 + 1]), 0, x1 - cx1);
+}
+
+/* depth test the pixels of a span set in mask (which is required),
+ * clearing those that aren't nearer than the z-buffer (or are outside
+ * the scissor box); returns how many are left. The z-buffer isn't written.
+ */
+int
+RPTestDepthSpan(int x0, int x1, int y, float *z, u8 *mask)
+{
+    float	*zrow;
+    int		cx0 = x0, cx1 = x1, i, n = 0;
+
+    if (x1 < x0)
+	return (0);
+    if (!clip_span(&cx0, &cx1, y)) {
+	clear_mask(x0, x1, 1, 0, mask);
+	return (0);
+    }
+    clear_mask(x0, x1, cx0, cx1, mask);
+    z += cx0 - x0;		/* (from here on, from the clipped start) */
+    mask += cx0 - x0;
+
+    zrow = &(RPDepthFrameBuffer[y][cx0]);
+    for (i=0; i<=cx1-cx0; i++) {
+	if (mask[i]) {
+	    mask[i] = (z[i] < zrow[i]);
+	    n += mask[i];
+	}
+    }
+    return (n);
+}
+
+/* the same, also writing the depth of the pixels that pass (with a
+ * NULL mask, all of the span's pixels are tested, and none reported)
+ */
+int
+RPTestPutDepthSpan(int x0, int x1, int y, float *z, u8 *mask)
+{
+    float	*zrow;
+    int		cx0 = x0, cx1 = x1, i, n = 0;
+
+    if (x1 < x0)
+	return (0);
+    if (!clip_span(&cx0, &cx1, y)) {
+	if (mask != (u8 *) NULL)
+	    clear_mask(x0, x1, 1, 0, mask);
+	return (0);
+    }
+
+    z += cx0 - x0;		/* (from here on, from the clipped start) */
+    zrow = &(RPDepthFrameBuffer[y][cx0]);
+    if (mask == (u8 *) NULL) {
+	for (i=0; i<=cx1-cx0; i++) {
+	    if (z[i] < zrow[i]) {
+		zrow[i] = z[i];
+		n++;
+	    }
+	}
+	return (n);
+    }
+
+    clear_mask(x0, x1, cx0, cx1, mask);
+    mask += cx0 - x0;
+    for (i=0; i<=cx1-cx0; i++) {
+	if (mask[i]) {
+	    mask[i] = (z[i] < zrow[i]);
+	    if (mask[i]) {
+		zrow[i] = z[i];
+		n++;
+	    }
+	}
+    }
+    return (n);
+}
+
 
 
 /* load an image into the frame buffer as a background 
@@ -265,7 +374,7 @@ RPPutColorFBPixel(int x, int y, int r, int g, int b, int a)
     float       f;
 
     if ((x >= RPScene.scissor_box->ulx) && (x <= RPScene.scissor_box->lrx) && 
-	(y >= RPScene.scissor_box->uly) && (y <= RPScene.scissor_box->lrx)) {
+	(y >= RPScene.scissor_box->uly) && (y <= RPScene.scissor_box->lry)) {
         r = Clamp0255(r);
         g = Clamp0255(g);
         b = Clamp0255(b);
@@ -290,6 +399,41 @@ RPPutColorFBPixel(int x, int y, int r, int g, int b, int a)
     }
 }
 
+/* store the colors of the pixels of a span set in mask (NULL for all),
+ * alpha-blending them like RPPutColorFBPixel()
+ */
+void
+RPPutColorSpan(int x0, int x1, int y, rgba_t *color, u8 *mask)
+{
+    rgba_t	*fb, *c;
+    float       f;
+    int		cx0 = x0, cx1 = x1, i;
+
+    if (x1 < x0 || !clip_span(&cx0, &cx1, y))
+	return;
+
+    color += cx0 - x0;		/* (from the clipped start) */
+    if (mask != (u8 *) NULL)
+	mask += cx0 - x0;
+
+    fb = &(RPColorFrameBuffer[y][cx0]);
+    for (i=0; i<=cx1-cx0; i++) {
+	if (mask != (u8 *) NULL && !mask[i])
+	    continue;
+	c = &(color[i]);
+
+        if (c->a == MAX_COLOR_VAL) {
+	    fb[i] = *c;
+        } else {    /* do alpha-blending */
+            f = (float)c->a/(float)MAX_COLOR_VAL;
+            fb[i].r = (u8) Clamp0255(f*c->r + (1.0-f)*fb[i].r);
+            fb[i].g = (u8) Clamp0255(f*c->g + (1.0-f)*fb[i].g);
+            fb[i].b = (u8) Clamp0255(f*c->b + (1.0-f)*fb[i].b);
+            fb[i].a = (u8) Clamp0255(f*c->a + (1.0-f)*fb[i].a);
+        }
+    }
+}
+
 /* write frame buffer to a file */
 int
 RPWriteColorFB(void)
@@ -0,0 +1,362 @@
+
+/*
+ * File:        abuffer.c
+ *
+ * A-buffer style anti-aliasing for the scanline renderer.
+ *
+ * For each pixel, every active edgepair gets an analytic coverage mask
+ * over a grid of subsamples (a subsample is covered if its camera ray
+ * passes inside all three edge planes of the triangle). Visibility is
+ * resolved per subsample with the triangle plane depth, then each
+ * fragment that is visible in at least one subsample is shaded ONCE
+ * (with a ray through the centroid of its visible subsamples) and the
+ * pixel is the coverage weighted average.
+ *
+ * Implicit spheres get their coverage and depth per subsample straight
+ * from the ray-sphere discriminant.
+ *
+ */
+
+/*
+ *
+ * MIT License
+ *
+ * Copyright (c) 2018 Steve Anderson
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "rp.h"
+#include "ray.h"
+#include "scan.h"
+
+extern int	epprocessed;
+
+int		abuf_frags_shaded = 0;
+
+typedef struct {	/* one triangle's contribution to the pixel */
+    Object_t	*op;
+    Tri_t	*tp;
+    u32		mask;		/* subsamples this triangle covers */
+    u32		visible;	/* subsamples it wins after depth resolve */
+} frag_t;
+
+static frag_t	*frags = (frag_t *) NULL;
+static int	frag_max = 0;
+
+static Ray_t	aaray;
+static rgba_t	misscolor;
+static float	ax, bx, ay, by;		/* camera ray dir = (ax*px + bx, ay*py + by, -1) */
+
+	/* subsample grid offsets inside a pixel, the same for x and y */
+static float	suboff[ABUF_GRID];
+
+/* camera ray direction (unnormalized) through continuous pixel position px, py */
+static void
+sample_dir(xyz_t *dir, float px, float py)
+{
+    dir->x = ax * px + bx;
+    dir->y = ay * py + by;
+    dir->z = RPScene.camera->dir.z;
+}
+
+/* 
+ * coverage mask of a triangle for pixel x,y: with the eye at the origin,
+ * a ray dir D is inside the triangle if it is on the same side of all three
+ * planes through the eye and an edge, (vi x vj) . D. That is linear in the
+ * pixel position, so it is an edge function in screen space.
+ */
+static u32
+coverage_mask(int x, int y, Object_t *op, Tri_t *tp)
+{
+    xyz_t	*p0, *p1, *p2, n[3], D;
+    float	e[3][3], sign;
+    u32		mask = 0x0;
+    int		i, j, k;
+
+    p0 = &(op->verts[tp->v0].pos);
+    p1 = &(op->verts[tp->v1].pos);
+    p2 = &(op->verts[tp->v2].pos);
+
+    vector_cross(&(n[0]), p0, p1);
+    vector_cross(&(n[1]), p1, p2);
+    vector_cross(&(n[2]), p2, p0);
+
+	/* orient the edge planes so inside is positive */
+    sign = (vector_dot(n[0], *p2) < 0.0) ? -1.0 : 1.0;
+
+    for (k=0; k<3; k++) {	/* edge k = a*px + b*py + c */
+	e[k][0] = sign * n[k].x * ax;
+	e[k][1] = sign * n[k].y * ay;
+	e[k][2] = sign * (n[k].x * bx + n[k].y * by + n[k].z * RPScene.camera->dir.z);
+    }
+
+    for (j=0; j<ABUF_GRID; j++) {
+	D.y = (float) y + suboff[j];
+        for (i=0; i<ABUF_GRID; i++) {
+	    D.x = (float) x + suboff[i];
+	    if (e[0][0]*D.x + e[0][1]*D.y + e[0][2] >= 0.0 &&
+	        e[1][0]*D.x + e[1][1]*D.y + e[1][2] >= 0.0 &&
+	        e[2][0]*D.x + e[2][1]*D.y + e[2][2] >= 0.0)
+		mask |= (0x1 << (j*ABUF_GRID + i));
+	}
+    }
+
+    return (mask);
+}
+
+/* coverage mask of a sphere for pixel x,y, and the depth (along the subsample ray) where covered */
+static u32
+sphere_coverage(int x, int y, Sphere_t *sp, float *depth)
+{
+    xyz_t	D, c;
+    float	b, cc, dd, discr;
+    u32		mask = 0x0;
+    int		s;
+
+    vector_sub(&c, &(sp->center), &(aaray.orig));
+    cc = vector_dot(c, c) - Sqr(sp->radius);
+
+    for (s=0; s<ABUF_SAMPLES; s++) {
+	sample_dir(&D, (float) x + suboff[s % ABUF_GRID], (float) y + suboff[s / ABUF_GRID]);
+	b = vector_dot(c, D);
+	dd = vector_dot(D, D);
+	discr = Sqr(b) - dd * cc;
+	if (discr < 0.0 || b < 0.0)
+	    continue;
+	depth[s] = Max((b - sqrtf(discr)) / dd, 0.0);
+	mask |= (0x1 << s);
+    }
+
+    return (mask);
+}
+
+/* shade a fragment once, with a ray through the centroid of its visible subsamples */
+static int
+shade_fragment(int x, int y, frag_t *fp, rgba_t *color)
+{
+    xyz_t	surf, view, normal;
+    float	t, len, px = 0.0, py = 0.0;
+    int		i, count = 0, found;
+
+    for (i=0; i<ABUF_SAMPLES; i++) {
+	if (fp->visible & (0x1 << i)) {
+	    px += suboff[i % ABUF_GRID];
+	    py += suboff[i / ABUF_GRID];
+	    count++;
+	}
+    }
+
+    aaray.depth = 1;
+    aaray.t = MAX_RAY_T;
+    aaray.surf = (TriShade_t *) NULL;
+
+    sample_dir(&(aaray.dir), (float) x + px/(float) count, (float) y + py/(float) count);
+    len = 1.0f / sqrtf(vector_dot(aaray.dir, aaray.dir));
+    vector_scale(&(aaray.dir), &(aaray.dir), len);
+
+    if (fp->op->type == OBJ_TYPE_SPHERE)
+        found = sphere_intersect(&aaray, fp->op->sphere, &t, &surf, &normal);
+    else
+        found = tri_intersect(&aaray, fp->op, fp->tp, &t, &surf, &normal);
+
+    if (found) {
+        aaray.t = t;
+        vector_scale(&view, &(aaray.dir), -1.0f); /* view vector is -ray.dir */
+
+        RayStats.primary_ray_hit_count++;
+	abuf_frags_shaded++;
+
+	if (fp->op->type == OBJ_TYPE_SPHERE)
+            shade_sphere_pixel(color, &(fp->op->materials[0]), &aaray, &normal, &surf, &view, fp->op);
+	else
+            shade_tri_pixel(color, &aaray, &normal, &surf, &view, fp->op);
+
+	if (aaray.surf != (TriShade_t *) NULL)
+	    free (aaray.surf);
+	aaray.surf = (TriShade_t *) NULL;
+    }
+
+    return (found);
+}
+
+/* anti-aliased version of cast_primary_ray() */
+void
+cast_abuffer_ray(int x, int y, ep_t *eplist)
+{
+    ep_t	*ep;
+    frag_t	*fp;
+    Object_t	*op;
+    Tri_t	*tp;
+    rgba_t	bg, fcolor;
+    xyz_t	D;
+    float	depth[ABUF_SAMPLES], fdepth[ABUF_SAMPLES], NdotD;
+    int		owner[ABUF_SAMPLES], sum[4], nfrags = 0, i, j, s;
+    u32		mask;
+
+    for (i=0; i<ABUF_SAMPLES; i++) {
+	depth[i] = MAX_RAY_T;
+	owner[i] = -1;
+    }
+
+	/* pass 1: coverage and depth of every active triangle */
+    for (ep = eplist; ep != (ep_t *) NULL; ep = ep->next) {
+
+	epprocessed++;
+	op = ep->op;
+
+	if (op->type == OBJ_TYPE_SPHERE) {
+	    tp = (Tri_t *) NULL;
+	    mask = sphere_coverage(x, y, op->sphere, fdepth);
+	} else {
+            tp = &(op->tris[ep->polyid]);
+
+                /* do front/back face culling here */
+            if ((Flagged(op->flags, FLAG_CULL_BACK) && Flagged(tp->flags, FLAG_CULL_BACK)) ||
+                (Flagged(op->flags, FLAG_CULL_FRONT) && Flagged(tp->flags, FLAG_CULL_FRONT))) {
+	        RayStats.culled_polys++;
+	        continue;
+	    }
+
+	    mask = coverage_mask(x, y, op, tp);
+
+	        /* depth per subsample, along the subsample ray (eye at origin) */
+	    for (s=0; s<ABUF_SAMPLES; s++) {
+	        if (!(mask & (0x1 << s)))
+		    continue;
+	        sample_dir(&D, (float) x + suboff[s % ABUF_GRID], (float) y + suboff[s / ABUF_GRID]);
+	        NdotD = vector_dot(tp->pN, D);
+	        if (NdotD > -EpEpsilon && NdotD < EpEpsilon)
+		    fdepth[s] = -1.0;
+	        else
+	            fdepth[s] = (tp->d - vector_dot(tp->pN, aaray.orig)) / NdotD;
+	    }
+	}
+
+	if (mask == 0x0)
+	    continue;
+
+	if (nfrags == frag_max) {
+	    frag_max = (frag_max == 0) ? 64 : frag_max * 2;
+	    frags = (frag_t *) realloc(frags, frag_max * sizeof(frag_t));
+	}
+	fp = &(frags[nfrags]);
+	fp->op = op;
+	fp->tp = tp;
+	fp->mask = mask;
+	fp->visible = 0x0;
+
+	    /* resolve visibility per subsample */
+	for (s=0; s<ABUF_SAMPLES; s++) {
+	    if ((mask & (0x1 << s)) && fdepth[s] >= 0.0 && fdepth[s] < depth[s]) {
+		depth[s] = fdepth[s];
+		owner[s] = nfrags;
+	    }
+	}
+	nfrags++;
+    }
+
+    for (s=0; s<ABUF_SAMPLES; s++) {
+	if (owner[s] >= 0)
+	    frags[owner[s]].visible |= (0x1 << s);
+    }
+
+	/* pass 2: shade each visible fragment once, weight it by what it covers */
+    if (Flagged(RPScene.flags, FLAG_BACKGROUND_IMAGE))
+	bg = RPColorFrameBuffer[y][x];
+    else
+	bg = misscolor;
+
+    sum[0] = sum[1] = sum[2] = sum[3] = 0;
+    j = ABUF_SAMPLES;	/* subsamples not covered by anything */
+
+    for (i=0; i<nfrags; i++) {
+	fp = &(frags[i]);
+	if (fp->visible == 0x0)
+	    continue;
+
+	fcolor = misscolor;
+	if (!shade_fragment(x, y, fp, &fcolor))
+	    continue;		/* numerically just missed, leave it as background */
+
+	s = __builtin_popcount(fp->visible);
+	sum[0] += s * fcolor.r;
+	sum[1] += s * fcolor.g;
+	sum[2] += s * fcolor.b;
+	sum[3] += s * fcolor.a;
+	j -= s;
+    }
+
+    sum[0] += j * bg.r;
+    sum[1] += j * bg.g;
+    sum[2] += j * bg.b;
+    sum[3] += j * bg.a;
+
+    RPColorFrameBuffer[y][x].r = (u8) ((sum[0] + ABUF_SAMPLES/2) / ABUF_SAMPLES);
+    RPColorFrameBuffer[y][x].g = (u8) ((sum[1] + ABUF_SAMPLES/2) / ABUF_SAMPLES);
+    RPColorFrameBuffer[y][x].b = (u8) ((sum[2] + ABUF_SAMPLES/2) / ABUF_SAMPLES);
+    RPColorFrameBuffer[y][x].a = (u8) ((sum[3] + ABUF_SAMPLES/2) / ABUF_SAMPLES);
+
+    RayStats.primary_ray_count++;
+}
+
+void
+abuffer_init(void)
+{
+    float	tanfov;
+    int		i;
+
+        /* fov is actually fov/2.0 */
+    tanfov = tanf(RPScene.camera->fovr/2.0);
+
+	/* same camera plane as cast_primary_ray(), in continuous pixel coords */
+    ax = 2.0 * RPScene.camera->aspect * tanfov / (float)RPScene.xres;
+    bx = -RPScene.camera->aspect * tanfov;
+    ay = -2.0 * tanfov / (float)RPScene.yres;
+    by = tanfov;
+
+    for (i=0; i<ABUF_GRID; i++) {
+	suboff[i] = ((float) i + 0.5) / (float) ABUF_GRID;
+    }
+
+    aaray.type = PRIMARY_RAY;
+    aaray.origid = -1;
+    aaray.orig.x = RPScene.camera->eye.x;       /* orig is (0,0,0) */
+    aaray.orig.y = RPScene.camera->eye.y;
+    aaray.orig.z = RPScene.camera->eye.z;
+    aaray.surf = (TriShade_t *) NULL;
+
+	/* the same background (or fog) color raytracer_init() set up */
+    misscolor = raytracer_misscolor();
+}
+
+void
+abuffer_cleanup(void)
+{
+    if (frags != (frag_t *) NULL)
+	free(frags);
+    frags = (frag_t *) NULL;
+    frag_max = 0;
+}
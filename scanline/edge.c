@@ -42,6 +42,10 @@
 
 extern int	avg_epp;
 
+	/* bytes of bucket/edgepair memory in use, and the high water mark */
+static long	mem_current = 0;
+static long	mem_peak = 0;
+
 /*
  * this version is a little messy, quick and sloppy:
  *
@@ -55,6 +59,22 @@ extern int	avg_epp;
  */
 
 
+/* account for memory allocated (bytes > 0) or freed (bytes < 0) by the renderer */
+void
+track_scan_memory(long bytes)
+{
+    mem_current += bytes;
+    if (mem_current > mem_peak)
+	mem_peak = mem_current;
+}
+
+/* the most memory in use at any one time, so we can size jobs */
+long
+scan_memory_peak(void)
+{
+    return (mem_peak);
+}
+
 /* allocate and return an edgepair structure */
 ep_t *
 new_ep(void)
@@ -62,6 +82,7 @@ new_ep(void)
     ep_t	*ep;
 
     ep = (ep_t *) calloc(1, sizeof(ep_t));
+    track_scan_memory(sizeof(ep_t));
 
     return (ep);
 }
@@ -79,7 +100,8 @@ free_eplist(ep_t **eplist)
 
     if (e->next == (ep_t *) NULL) {
 	free(e);
-	e = (ep_t *) NULL;
+	track_scan_memory(-(long)sizeof(ep_t));
+	*eplist = (ep_t *) NULL;
 	return;
     }
 
@@ -87,7 +109,9 @@ free_eplist(ep_t **eplist)
 	prev = e;
   	e = e->next;
 	free(prev);
+	track_scan_memory(-(long)sizeof(ep_t));
     }
+    *eplist = (ep_t *) NULL;
 }
 
 /* insert puts an ep into it's sorted position in an edgepair list */
@@ -126,7 +150,8 @@ insert_edgepair(ep_t **eplist, ep_t *ep)
     ep->next = e;
 }
 
-/* add a copy of an edgepair to the end of an unsorted list, used for short/fast active list */
+/* add a copy of an edgepair to a list sorted front to back by zmin, used for short/fast active list */
+/* (equal depths keep their x order) */
 /* allocated memory free'd after the pixel is rendered with call to free_eplist() */ 
 static ep_t *
 add_edgepair(ep_t *eplist, ep_t *ep)
@@ -141,13 +166,19 @@ add_edgepair(ep_t *eplist, ep_t *ep)
         return (newp);
     }
 
+    if (newp->zmin < eplist->zmin) {
+	newp->next = eplist;
+        return (newp);
+    }
+
     prev = eplist;
     e = eplist->next;
-    while (e != (ep_t *) NULL) {
+    while (e != (ep_t *) NULL && e->zmin <= newp->zmin) {
 	prev = e;
 	e = e->next;
     }
 
+    newp->next = e;
     prev->next = newp;
 
     return (eplist);
@@ -197,7 +228,11 @@ void
 process_edgepairs(int y, ep_t **eplist)
 {
     ep_t	*active;
-    int 	i;
+    int 	i, aa;
+
+    aa = Flagged(RPScene.generic_flags, FLAG_RENDER_05);
+
+    begin_primary_row(y);
 
     for (i=0; i<RPScene.xres; i++) {
 
@@ -205,7 +240,10 @@ process_edgepairs(int y, ep_t **eplist)
 
 	avg_epp += count_edgepairs(active);
         
-	cast_primary_ray(i, y, active);
+	if (aa)
+	    cast_abuffer_ray(i, y, active);
+	else
+	    cast_primary_ray(i, y, active);
 
 	free_eplist(&active);
     }
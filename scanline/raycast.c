@@ -51,38 +51,59 @@ extern int	epprocessed;
 
 static float	tanfov, sinfov;
 
-static rgba_t *
+	/* primary ray reused for every pixel, and the camera plane stepping for it */
+static Ray_t	eyeray;
+static rgba_t	misscolor;
+static float	dirx0, dirdx;	/* dir.x = dirx0 + x * dirdx */
+static float	diry, dirz;	/* unnormalized dir.y, dir.z for the current scanline */
+static float	rowlen2;	/* dir.y^2 + dir.z^2 for the current scanline */
+
+static rgba_t
 trace_primary_ray(Ray_t *ray, ep_t *eplist)
 {
     ep_t	*ep = eplist;
     Object_t    *op;
     Tri_t	*tp;
-    rgba_t      *color = (rgba_t *) NULL;
+    rgba_t      color = misscolor;
     xyz_t       surf, view, normal;
     float       t = MAX_RAY_T;
     int         cullthis = FALSE, found = FALSE;
     ray->depth++;
-
-    color = (rgba_t *) malloc(sizeof(rgba_t));
-
-        /* handle fog in the background */
-    if (Flagged(RPScene.flags, FLAG_FOG)) {
-        color->r = (u8) Clamp0255(RPScene.fog_color.r * 255.0);
-        color->g = (u8) Clamp0255(RPScene.fog_color.g * 255.0);
-        color->b = (u8) Clamp0255(RPScene.fog_color.b * 255.0);
-        color->a = (u8) Clamp0255(RPScene.fog_color.a * 255.0);
-    } else {
-        color->r = RPScene.background_color.r;
-        color->g = RPScene.background_color.g;
-        color->b = RPScene.background_color.b;
-        color->a = RPScene.background_color.a;
-    }
    
         /* intersect ray with all of the edgepairs */
 
     while (ep != (ep_t *) NULL) {
 
+	    /* list is sorted by nearest depth; a hit (distance t >= depth) closer
+	     * than the rest of the list can't be beaten, so stop looking */
+	if (ep->zmin > ray->t) {
+	    while (ep != (ep_t *) NULL) {
+		epskipped++;
+		ep = ep->next;
+	    }
+	    break;
+	}
+
 	op = ep->op;
+
+	if (op->type == OBJ_TYPE_SPHERE) {	/* implicit sphere, no culling */
+
+	    found = sphere_intersect(ray, op->sphere, &t, &surf, &normal);
+
+	    if (found && t < ray->t) {
+                ray->t = t;
+                vector_scale(&view, &(ray->dir), -1.0f); /* view vector is -ray.dir */
+
+                RayStats.primary_ray_hit_count++;
+
+	        shade_sphere_pixel(&color, &(op->materials[0]), ray, &normal, &surf, &view, op);
+	    }
+
+	    ep = ep->next;
+	    epprocessed++;
+	    continue;
+	}
+
         tp = &(op->tris[ep->polyid]);
    
             /* do front/back face culling here */
@@ -113,14 +134,16 @@ trace_primary_ray(Ray_t *ray, ep_t *eplist)
 
             RayStats.primary_ray_hit_count++;
 
-            shade_tri_pixel(color, ray, &normal, &surf, &view, op);
+            shade_tri_pixel(&color, ray, &normal, &surf, &view, op);
 
 	    if (ray->surf != (TriShade_t *) NULL)
 	        free (ray->surf);
+	    ray->surf = (TriShade_t *) NULL;
         } else {
 	    if (found) {
 	        if (ray->surf != (TriShade_t *) NULL)
 	            free (ray->surf);
+	        ray->surf = (TriShade_t *) NULL;
 	    }
 	}
 
@@ -132,49 +155,52 @@ trace_primary_ray(Ray_t *ray, ep_t *eplist)
 }
 
 
+/* set up the primary ray for scanline y; only x changes across the row */
+void
+begin_primary_row(int y)
+{
+    eyeray.orig.x = RPScene.camera->eye.x;       /* orig is (0,0,0) */
+    eyeray.orig.y = RPScene.camera->eye.y;
+    eyeray.orig.z = RPScene.camera->eye.z;
+
+    diry = (1.0 - 2 * (y + 0.5) / (float)RPScene.yres) * tanfov;
+    dirz = RPScene.camera->dir.z;
+    rowlen2 = Sqr(diry) + Sqr(dirz);
+}
+
 void
 cast_primary_ray(int x, int y, ep_t *eplist)
 {
-    rgba_t	*color;
-    Ray_t	*eyeray;
-
-    eyeray = NewRay(PRIMARY_RAY, -1);
-
-    eyeray->depth = 0;
-    eyeray->t = MAX_RAY_T;
-    eyeray->surf = (TriShade_t *) NULL;
-
-    eyeray->orig.x = RPScene.camera->eye.x;       /* orig is (0,0,0) */
-    eyeray->orig.y = RPScene.camera->eye.y;
-    eyeray->orig.z = RPScene.camera->eye.z;
-
-        /* clean up this obfuscated code... */
-    eyeray->dir.x = (2.0 * (x + 0.5) / (float)RPScene.xres - 1.0) * 
-			RPScene.camera->aspect * tanfov;
-    eyeray->dir.y = (1.0 - 2 * (y + 0.5) / (float)RPScene.yres) * tanfov;;
-    eyeray->dir.z = RPScene.camera->dir.z;
-    vector_normalize(&(eyeray->dir));
-
-    color = trace_primary_ray(eyeray, eplist);
-
-    if (color != NULL) {
-        if (eyeray->t == MAX_RAY_T &&
-            Flagged(RPScene.flags, FLAG_BACKGROUND_IMAGE)) {
-                     /* miss, but background image was loaded */
-         } else {
-            RPColorFrameBuffer[y][x].r = color->r;
-            RPColorFrameBuffer[y][x].g = color->g;
-            RPColorFrameBuffer[y][x].b = color->b;
-            RPColorFrameBuffer[y][x].a = color->a;
-         }
-        free(color); /* free color allocated in trace_ray() */
-        color = (rgba_t *) NULL;
+    rgba_t	color;
+    float	dx, len;
+
+    eyeray.depth = 0;
+    eyeray.t = MAX_RAY_T;
+    eyeray.surf = (TriShade_t *) NULL;
+
+	/* step across the camera plane, normalizing as we go */
+    dx = dirx0 + (float) x * dirdx;
+    len = 1.0f / sqrtf(dx * dx + rowlen2);
+
+    eyeray.dir.x = dx * len;
+    eyeray.dir.y = diry * len;
+    eyeray.dir.z = dirz * len;
+
+    color = trace_primary_ray(&eyeray, eplist);
+
+    if (eyeray.t == MAX_RAY_T &&
+        Flagged(RPScene.flags, FLAG_BACKGROUND_IMAGE)) {
+                 /* miss, but background image was loaded */
     } else {
-        /* ray depth exceeded, no color returned */
+        RPColorFrameBuffer[y][x] = color;
     }
     RayStats.primary_ray_count++;
+}
 
-    free(eyeray);
+rgba_t
+raytracer_misscolor(void)
+{
+    return (misscolor);
 }
 
 void
@@ -183,6 +209,22 @@ raytracer_init(void)
         /* fov is actually fov/2.0 */
     tanfov = tanf(RPScene.camera->fovr/2.0);
     sinfov = sinf(RPScene.camera->fovr/2.0);
-}
 
+	/* (2.0 * (x + 0.5) / xres - 1.0) * aspect * tanfov, as a step per pixel */
+    dirdx = 2.0 * RPScene.camera->aspect * tanfov / (float)RPScene.xres;
+    dirx0 = (1.0 / (float)RPScene.xres - 1.0) * RPScene.camera->aspect * tanfov;
 
+    eyeray.type = PRIMARY_RAY;
+    eyeray.origid = -1;
+    eyeray.surf = (TriShade_t *) NULL;
+
+        /* handle fog in the background */
+    if (Flagged(RPScene.flags, FLAG_FOG)) {
+        misscolor.r = (u8) Clamp0255(RPScene.fog_color.r * 255.0);
+        misscolor.g = (u8) Clamp0255(RPScene.fog_color.g * 255.0);
+        misscolor.b = (u8) Clamp0255(RPScene.fog_color.b * 255.0);
+        misscolor.a = (u8) Clamp0255(RPScene.fog_color.a * 255.0);
+    } else {
+        misscolor = RPScene.background_color;
+    }
+}
@@ -43,11 +43,13 @@
 
 int		epprocessed = 0;
 int		avg_epp = 0;
+int		epskipped = 0;
 
 static ep_t	**buckets;
 static int	epcount = 0;
 
 static void	fill_buckets(void);
+static void	scan_banded(void);
 
 void     
 scan_scene(void)
@@ -67,27 +69,40 @@ scan_scene(void)
         /* tranform objects to camera space */
     RPProcessObjects(TRUE);
 
-    /* build edgepair structure */
+    if (Flagged(RPScene.generic_flags, FLAG_RENDER_04)) {
 
-    buckets = (ep_t **) calloc(RPScene.yres, sizeof(ep_t *));
+	/* build and process the buckets a band of scanlines at a time */
+	scan_banded();
 
-    fill_buckets();
+    } else {
 
-	/* set up primary camera ray paramters */
-    raytracer_init();
+        /* build edgepair structure */
 
-    fprintf(stderr,"Progress:  %5.2f %%",progress*100.0);
+        buckets = (ep_t **) calloc(RPScene.yres, sizeof(ep_t *));
+        track_scan_memory(RPScene.yres * sizeof(ep_t *));
 
-    for (i=0; i<RPScene.yres; i++) {
+        fill_buckets();
 
-	/* process edgepairs */
+	    /* set up primary camera ray paramters */
+        raytracer_init();
+        abuffer_init();
 
-	process_edgepairs(i, &(buckets[i]));
+        fprintf(stderr,"Progress:  %5.2f %%",progress*100.0);
 
-	free_eplist(&(buckets[i]));
+        for (i=0; i<RPScene.yres; i++) {
 
-        progress = (float)i/(float)RPScene.yres;
-        fprintf(stderr,"\b\b\b\b\b\b\b%5.2f %%",progress*100.0);
+	    /* process edgepairs */
+
+	    process_edgepairs(i, &(buckets[i]));
+
+	    free_eplist(&(buckets[i]));
+
+            progress = (float)i/(float)RPScene.yres;
+            fprintf(stderr,"\b\b\b\b\b\b\b%5.2f %%",progress*100.0);
+        }
+
+        free(buckets);
+        track_scan_memory(-(long)(RPScene.yres * sizeof(ep_t *)));
     }
 
 	/* draw triangle outlines if desired: */
@@ -117,6 +132,7 @@ scan_scene(void)
         } /* for all objects */
     }
 
+    abuffer_cleanup();
     RPCleanupObjects();
     RPCleanupTextures();
     RPCleanupMaterials();
@@ -138,9 +154,16 @@ scan_scene(void)
 	    program_name, epcount);
     fprintf(stderr,"%s : [%'16d]\tedge pairs processed\n",
 	    program_name, epprocessed);
+    fprintf(stderr,"%s : [%'16d]\tedge pairs skipped (depth early-out)\n",
+	    program_name, epskipped);
     fprintf(stderr,"%s : [%16.2f]\tavg edge pairs per pixel\n",
 	    program_name, (float)avg_epp/(float)RayStats.primary_ray_count);
+    fprintf(stderr,"%s : [%'16ld]\tpeak bucket memory (bytes)\n",
+	    program_name, scan_memory_peak());
 
+    if (Flagged(RPScene.generic_flags, FLAG_RENDER_05))
+        fprintf(stderr,"%s : [%'16d]\tA-buffer fragments shaded\t(%d subsamples)\n",
+	        program_name, abuf_frags_shaded, ABUF_SAMPLES);
     fprintf(stderr,"%s : [%'16d]\tprimary rays cast\t(%'d hits)\n",
 	    program_name, RayStats.primary_ray_count, RayStats.primary_ray_hit_count);
     fprintf(stderr,"%s : [%'16d]\treflection rays cast\t(%'d hits)\n",
@@ -152,25 +175,21 @@ scan_scene(void)
     fprintf(stderr,"\n");
 }
 
-static void
-insert_poly(Object_t *op, int poly)
+/* clip a polygon and fill in its screen bounds, returns FALSE if nothing to draw */
+static int
+clip_poly(Object_t *op, int poly, scantri_t *st)
 {
     Tri_t	*tp;
     Vtx_t	*v0, *v1, *v2;
-    ep_t	*ep;
-    int		i, miny, maxy, clipped = CLIP_TRIVIAL_ACCEPT;;
+    int		clipped = CLIP_TRIVIAL_ACCEPT;
 
     tp = &(op->tris[poly]);
 
-    v0  = &(op->verts[tp->v0]);
-    v1  = &(op->verts[tp->v1]);
-    v2  = &(op->verts[tp->v2]);
-
     if (!Flagged(RPScene.generic_flags, FLAG_RENDER_01)) /* turn off clipping */
         clipped = RPClipTriangle(op, tp); 
 
     if (clipped < CLIP_TRIVIAL_ACCEPT) {
-	return;
+	return (FALSE);
     } 
 
     tp = &(op->tris[poly]);
@@ -178,52 +197,131 @@ insert_poly(Object_t *op, int poly)
 	/* poly was clipped, generating new data, so skip the old tri */
 	/* if poly was clipped, any new polys added to the end of object trilist */
 	/* we will get to them in their own time... */
-	return;
+	return (FALSE);
     } 
 
-/*
-    fprintf(stderr,"insert poly (%d):\n",poly);
-    fprintf(stderr,"\tflags = %08x\n",tp->flags);
-    fprintf(stderr,"\tv indx= %d %d %d\n",tp->v0,tp->v1,tp->v2);
-    fprintf(stderr,"\tv0 : %d, %d : %8.4f, %8.4f, %8.4f\n",
-		v0->sx,v0->sy, v0->pos.x, v0->pos.y, v0->pos.z);
-    fprintf(stderr,"\tv1 : %d, %d : %8.4f, %8.4f, %8.4f\n",v1->sx,v1->sy,
-		v1->pos.x, v1->pos.y, v1->pos.z);
-    fprintf(stderr,"\tv2 : %d, %d : %8.4f, %8.4f, %8.4f\n",v2->sx,v2->sy,
-		v2->pos.x, v2->pos.y, v2->pos.z);
-
-    fprintf(stderr,"\tcolor = %f,%f,%f,%f\n",tp->color.r,tp->color.g,tp->color.b,tp->color.a);
-    fprintf(stderr,"\tnorm = %f,%f,%f\n",tp->normal.x,tp->normal.y,tp->normal.z);
-    fprintf(stderr,"\tpN   = %f,%f,%f\n",tp->pN.x,tp->pN.y,tp->pN.z);
-    fprintf(stderr,"\td    = %f\n",tp->d);
-    fprintf(stderr,"\tv1v0 = %f,%f,%f\n",tp->v1_v0.x,tp->v1_v0.y,tp->v1_v0.z);
-    fprintf(stderr,"\tv2v1 = %f,%f,%f\n",tp->v2_v1.x,tp->v2_v1.y,tp->v2_v1.z);
-    fprintf(stderr,"\tv0v2 = %f,%f,%f\n",tp->v0_v2.x,tp->v0_v2.y,tp->v0_v2.z);
-*/
+    v0  = &(op->verts[tp->v0]);
+    v1  = &(op->verts[tp->v1]);
+    v2  = &(op->verts[tp->v2]);
 
 	/* compute min and max */
-    miny = Min3(v0->sy, v1->sy, v2->sy);
-    maxy = Max3(v0->sy, v1->sy, v2->sy);
-
-	/* insert into all the right y-buckets */
-    for (i=miny; i<=maxy; i++) {
-	if (i >= 0 && i < RPScene.yres) {
-
-            ep = new_ep();
-            ep->min.x = Min3(v0->sx, v1->sx, v2->sx);
-            ep->min.y = miny;
-            ep->max.x = Max3(v0->sx, v1->sx, v2->sx);
-            ep->max.y = maxy;
-            ep->id = epcount++;
-            ep->op = op;
-            ep->polyid = poly;
-            ep->next = (ep_t *) NULL;
-
-	    insert_edgepair(&(buckets[i]), ep);
-        }
+    st->min.x = Min3(v0->sx, v1->sx, v2->sx);
+    st->min.y = Min3(v0->sy, v1->sy, v2->sy);
+    st->max.x = Max3(v0->sx, v1->sx, v2->sx);
+    st->max.y = Max3(v0->sy, v1->sy, v2->sy);
+    st->zmin = -Max3(v0->pos.z, v1->pos.z, v2->pos.z);	/* looking down -z */
+
+    if (Flagged(RPScene.generic_flags, FLAG_RENDER_05)) {
+	/* A-buffer needs every pixel the triangle touches, not just its centers */
+	st->min.x--;	st->min.y--;
+	st->max.x++;	st->max.y++;
+    }
+    st->op = op;
+    st->polyid = poly;
+
+    return (TRUE);
+}
+
+/* 
+ * one axis of the screen bounds of a sphere: the slopes (u = a / -z) of the two
+ * lines through the eye that are tangent to the circle of radius r at (a, zc)
+ */
+static void
+sphere_slopes(float a, float zc, float r, float *umin, float *umax)
+{
+    float	q, den;
+
+    q = r * sqrtf(Sqr(a) + Sqr(zc) - Sqr(r));
+    den = Sqr(zc) - Sqr(r);
+
+    *umin = (a * zc - q) / den;
+    *umax = (a * zc + q) / den;
+}
+
+/* fill in the screen bounds of an implicit sphere, returns FALSE if nothing to draw */
+static int
+sphere_bounds(Object_t *op, scantri_t *st)
+{
+    Sphere_t	*sp = op->sphere;
+    float	zc, tanfov, umin, umax, vmin, vmax;
+
+    zc = -sp->center.z;		/* distance in front of the eye, looking down -z */
+
+    if (zc + sp->radius <= 0.0)
+	return (FALSE);		/* all behind us */
+
+    st->op = op;
+    st->polyid = -1;
+    st->zmin = Max(zc - sp->radius, 0.0);
+
+    if (zc - sp->radius <= Epsilon) {
+	/* eye is in (or touching) the sphere's slab, it could be anywhere */
+	st->min.x = 0;			st->min.y = 0;
+	st->max.x = RPScene.xres-1;	st->max.y = RPScene.yres-1;
+	return (TRUE);
+    }
+
+    sphere_slopes(sp->center.x, zc, sp->radius, &umin, &umax);
+    sphere_slopes(sp->center.y, zc, sp->radius, &vmin, &vmax);
+
+	/* same camera plane the primary rays use, in pixels (+ a pixel to be safe) */
+    tanfov = tanf(RPScene.camera->fovr/2.0);
+    st->min.x = (int) floorf((umin/(RPScene.camera->aspect*tanfov) + 1.0) * RPScene.xres * 0.5) - 1;
+    st->max.x = (int) ceilf((umax/(RPScene.camera->aspect*tanfov) + 1.0) * RPScene.xres * 0.5) + 1;
+    st->min.y = (int) floorf((1.0 - vmax/tanfov) * RPScene.yres * 0.5) - 1;
+    st->max.y = (int) ceilf((1.0 - vmin/tanfov) * RPScene.yres * 0.5) + 1;
+
+    if (st->max.x < 0 || st->min.x >= RPScene.xres ||
+	st->max.y < 0 || st->min.y >= RPScene.yres)
+	return (FALSE);
+
+    st->min.x = Max(st->min.x, 0);	st->min.y = Max(st->min.y, 0);
+    st->max.x = Min(st->max.x, RPScene.xres-1);
+    st->max.y = Min(st->max.y, RPScene.yres-1);
+
+    return (TRUE);
+}
+
+/* insert a polygon into the y-buckets for scanlines y0 to y1; rowbuckets[0] is scanline y0 */
+static void
+bucket_poly(scantri_t *st, ep_t **rowbuckets, int y0, int y1)
+{
+    ep_t	*ep;
+    int		i;
+
+    for (i=Max(st->min.y, y0); i<=Min(st->max.y, y1); i++) {
+
+        ep = new_ep();
+        ep->min = st->min;
+        ep->max = st->max;
+        ep->zmin = st->zmin;
+        ep->id = epcount++;
+        ep->op = st->op;
+        ep->polyid = st->polyid;
+        ep->next = (ep_t *) NULL;
+
+	insert_edgepair(&(rowbuckets[i-y0]), ep);
     }
 }
 
+static void
+insert_poly(Object_t *op, int poly)
+{
+    scantri_t	st;
+
+    if (clip_poly(op, poly, &st))
+	bucket_poly(&st, buckets, 0, RPScene.yres-1);
+}
+
+static void
+insert_sphere(Object_t *op)
+{
+    scantri_t	st;
+
+    if (sphere_bounds(op, &st))
+	bucket_poly(&st, buckets, 0, RPScene.yres-1);
+}
+
 /* put all the polygons in the scene into the right bucket(s) */
 static void
 fill_buckets(void)
@@ -237,10 +335,144 @@ fill_buckets(void)
 
     for (i=0; i<RPScene.obj_count; i++) {
 	op = RPScene.obj_list[i];
+	if (op->type == OBJ_TYPE_SPHERE) {
+	    insert_sphere(op);
+	    continue;
+	}
 	for (j=0; j<op->tri_count; j++) {
 	    insert_poly(op, j);
 	}
     }
 }
 
+/* qsort() helpers for the banded path */
+static int
+cmp_scantri_miny(const void *a, const void *b)
+{
+    const scantri_t	*sa = (const scantri_t *) a, *sb = (const scantri_t *) b;
+
+    if (sa->min.y != sb->min.y)
+	return (sa->min.y - sb->min.y);
+    return (sa->seq - sb->seq);
+}
+
+static int
+cmp_scantri_seq(const void *a, const void *b)
+{
+    return ((*(scantri_t * const *) a)->seq - (*(scantri_t * const *) b)->seq);
+}
+
+	/* screen bounds of everything visible, for scan_banded() */
+static scantri_t	*bandtris;
+static int		bandcount, bandsize;
+
+/* add the screen bounds of something visible to the banded record array */
+static void
+keep_scantri(scantri_t *st)
+{
+    if (st->max.y < 0 || st->min.y >= RPScene.yres)
+	return;
+
+    if (bandcount == bandsize) {
+	bandsize *= 2;
+	bandtris = (scantri_t *) realloc(bandtris, bandsize * sizeof(scantri_t));
+    }
+    st->seq = bandcount;
+    bandtris[bandcount++] = *st;
+}
+
+/*
+ * Watkins-style banded bucket construction:
+ *
+ * Clip everything once and keep only the screen bounds of the visible triangles,
+ * sorted by top scanline. Then walk down the screen SCAN_BAND_ROWS at a time,
+ * keeping an active set of triangles that overlap the band and only building
+ * edgepairs for those rows. Memory is bounded by the band, not the whole image.
+ *
+ * Triangles are bucketed in their original submission order within a band, so
+ * the edgepair lists (and the image) come out the same as the unbanded path.
+ */
+static void
+scan_banded(void)
+{
+    Object_t	*op;
+    scantri_t	**active, st;
+    ep_t	*band[SCAN_BAND_ROWS];
+    float	progress = 0.0;
+    int		i, j, y0, y1, next = 0, nactive = 0;
+
+    bandcount = 0;
+    bandsize = 1024;
+    bandtris = (scantri_t *) malloc(bandsize * sizeof(scantri_t));
+
+    for (i=0; i<RPScene.obj_count; i++) {
+	op = RPScene.obj_list[i];
+	if (op->type == OBJ_TYPE_SPHERE) {
+	    if (sphere_bounds(op, &st))
+		keep_scantri(&st);
+	    continue;
+	}
+	for (j=0; j<op->tri_count; j++) {	/* tri_count may grow as we clip */
+	    if (clip_poly(op, j, &st))
+		keep_scantri(&st);
+	}
+    }
+    track_scan_memory(bandsize * sizeof(scantri_t));
+
+    qsort(bandtris, bandcount, sizeof(scantri_t), cmp_scantri_miny);
+
+    active = (scantri_t **) malloc(Max(bandcount, 1) * sizeof(scantri_t *));
+    track_scan_memory(Max(bandcount, 1) * sizeof(scantri_t *));
+
+	/* set up primary camera ray paramters */
+    raytracer_init();
+    abuffer_init();
+
+    fprintf(stderr,"Progress:  %5.2f %%",progress*100.0);
+
+    for (y0=0; y0<RPScene.yres; y0+=SCAN_BAND_ROWS) {
+	y1 = Min(y0 + SCAN_BAND_ROWS, RPScene.yres) - 1;
+
+	    /* retire triangles above this band */
+	for (i=0, j=0; i<nactive; i++) {
+	    if (active[i]->max.y >= y0)
+		active[j++] = active[i];
+	}
+	nactive = j;
+
+	    /* add triangles that start in (or above) this band */
+	while (next < bandcount && bandtris[next].min.y <= y1) {
+	    if (bandtris[next].max.y >= y0)
+		active[nactive++] = &(bandtris[next]);
+	    next++;
+	}
+
+	qsort(active, nactive, sizeof(scantri_t *), cmp_scantri_seq);
+
+	for (i=0; i<=y1-y0; i++) {
+	    band[i] = (ep_t *) NULL;
+	}
+
+	for (i=0; i<nactive; i++) {
+	    bucket_poly(active[i], band, y0, y1);
+	}
+
+	for (i=y0; i<=y1; i++) {
+
+	    /* process edgepairs */
+
+	    process_edgepairs(i, &(band[i-y0]));
+
+	    free_eplist(&(band[i-y0]));
+
+            progress = (float)i/(float)RPScene.yres;
+            fprintf(stderr,"\b\b\b\b\b\b\b%5.2f %%",progress*100.0);
+	}
+    }
+
+    free(active);
+    track_scan_memory(-(long)(Max(bandcount, 1) * sizeof(scantri_t *)));
+    free(bandtris);
+    track_scan_memory(-(long)(bandsize * sizeof(scantri_t)));
+}
 
@@ -37,6 +37,11 @@
 
 	/* defines: */
 
+#define SCAN_BAND_ROWS	(64)	/* scanlines per band when building buckets banded */
+
+#define ABUF_GRID	(4)	/* A-buffer subsamples are an ABUF_GRID x ABUF_GRID grid */
+#define ABUF_SAMPLES	(ABUF_GRID * ABUF_GRID)	/* must fit in a u32 coverage mask */
+
 	/* data types: */
 
 typedef struct { 
@@ -47,17 +52,29 @@ typedef struct ep {	/* edge-pair structure */
 
     int		id;
     xyi_t	min, max;
+    float	zmin;		/* nearest camera space depth of the triangle */
     Object_t	*op;
     int		polyid;
     struct ep  	*next;
 
 } ep_t;
 
+typedef struct {	/* screen bounds of a visible triangle, for banded buckets */
+
+    int		seq;		/* submission order, keeps bucket order stable */
+    xyi_t	min, max;
+    float	zmin;
+    Object_t	*op;
+    int		polyid;
+
+} scantri_t;
+
 
 	/* extern variables/functions: */
 
 /* from scan.c */
 extern int	input_polys;
+extern int	epskipped;
 extern int	primary_ray_count;
 extern int	ray_hit_count;
 
@@ -65,8 +82,17 @@ extern void     scan_scene(void);
 
 /* from raycast.c */
 extern void	raytracer_init(void);
+extern rgba_t	raytracer_misscolor(void);
+extern void	begin_primary_row(int y);
 extern void	cast_primary_ray(int x, int y, ep_t *eplist);
 
+/* from abuffer.c */
+extern int	abuf_frags_shaded;
+
+extern void	abuffer_init(void);
+extern void	abuffer_cleanup(void);
+extern void	cast_abuffer_ray(int x, int y, ep_t *eplist);
+
 /* from edge.c */
 
 extern ep_t	*new_ep(void);
@@ -74,6 +100,8 @@ extern void	free_eplist(ep_t **eplist);
 extern void	insert_edgepair(ep_t **eplist, ep_t *ep);
 extern void	process_edgepairs(int y, ep_t **eplist);
 extern void	print_edgepairs(ep_t *eplist);
+extern void	track_scan_memory(long bytes);
+extern long	scan_memory_peak(void);
 
 #endif
 /* __SCAN_H__ */